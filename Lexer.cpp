@@ -1,51 +1,68 @@
 #include "Lexer.h"
 
 #include "ast_node.h"
-#include <ios>
-#include <iostream>
-
-Token Lexer::peek() {
-  size_t cursor_pos = cursor;
-  const Token next_token = next();
-  cursor = cursor_pos;
-  return next_token;
-}
+#include "keywords.h"
+#include "trace.h"
+#include <cassert>
 
-char Lexer::peekChar() { return source[cursor]; }
+static_assert((Lexer::max_lookahead & (Lexer::max_lookahead - 1)) == 0,
+              "max_lookahead must be a power of two");
 
-void Lexer::skipWhitespace() {
-  char current = peekChar();
-  while (current == ' ') {
-    cursor++;
-    current = peekChar();
-  }
+Token Lexer::next() {
+  if (lookahead_count == 0)
+    return lex();
+  Token token = lookahead[lookahead_head];
+  lookahead_head = (lookahead_head + 1) & (max_lookahead - 1);
+  lookahead_count--;
+  return token;
 }
 
-const char *Lexer::get_sequence() const {
-  char *slice = (char *)malloc(sizeof(char) * (cursor + 1));
-  size_t i = 0;
-  for (i = 0; i < cursor; ++i) {
-    slice[i] = source[i];
+Token Lexer::peek(size_t distance) {
+  assert(distance < max_lookahead);
+  while (lookahead_count <= distance) {
+    size_t slot = (lookahead_head + lookahead_count) & (max_lookahead - 1);
+    lookahead[slot] = lex();
+    lookahead_count++;
   }
-  slice[i + 1] = '\0';
-  return slice;
+  return lookahead[(lookahead_head + distance) & (max_lookahead - 1)];
+}
+
+char Lexer::peekChar() { return source[cursor]; }
+
+void Lexer::skipWhitespace() {
+  if (is_char_class(peekChar(), CharWhitespace))
+    cursor = scan.whitespace(source + cursor) - source;
 }
 
 char Lexer::peekChar(size_t index) { return source[index]; }
 
-Token Lexer::next() {
+Token Lexer::make(TokenType type, size_t start) const {
+  Token token;
+  token.type = type;
+  token.offset = static_cast<uint32_t>(start);
+  token.length = static_cast<uint32_t>(cursor - start);
+  token.line = static_cast<uint32_t>(line);
+  token.column = static_cast<uint32_t>(start - line_start + 1);
+  return token;
+}
+
+Token Lexer::lex() {
   skipWhitespace();
 
+  const size_t start = cursor;
   const char current = peekChar();
   // printf("Current Char: %c\n", current);
-  if (current == '\0') {
-    return Token{TokenType::End, "<end>"};
+  if (current == '\0' || start >= limit) {
+    return make(TokenType::End, start);
   }
 
   // Handle newlines as tokens
   if (current == '\n') {
     cursor++;
-    return Token{TokenType::NewLine, "<newline>"};
+    Token token = make(TokenType::NewLine, start);
+    line++;
+    line_start = cursor;
+    return token;
   }
 
   // Handle ::
@@ -53,9 +70,9 @@ Token Lexer::next() {
     cursor++;
     if (peekChar() == ':') {
       cursor++;
-      return Token(TokenType::DoubleColon, "::");
+      return make(TokenType::DoubleColon, start);
     }
-    return Token(TokenType::Colon, ":");
+    return make(TokenType::Colon, start);
   }
 
   // Handle ->
@@ -63,120 +80,79 @@ Token Lexer::next() {
     cursor++;
     if (peekChar() == '>') {
       cursor++;
-      return Token(TokenType::RightArrow, "->");
+      return make(TokenType::RightArrow, start);
     }
-    return Token(TokenType::Minus, "-");
+    return make(TokenType::Minus, start);
   }
 
   // Identifiers or keywords
-  if (std::isalpha(current) || current == '@') {
-    std::string identifier;
+  if (is_char_class(current, CharAlpha) || current == '@') {
     if (peekChar() == '@') {
-      identifier += peekChar();
-      cursor++;
-    }
-    while (std::isalnum(peekChar()) || peekChar() == '_') {
-      identifier += peekChar();
       cursor++;
     }
+    cursor = scan.identifier(source + cursor) - source;
+    const std::string_view identifier(source + start, cursor - start);
 
     // Keywords
-    fprintf(stdout, "Identifier: %s\n", identifier.c_str());
-    if (identifier == "vertex") {
-      return Token{TokenType::Identifier, identifier};
-    }
-    if (identifier == "fragment") {
-      return Token{TokenType::Identifier, identifier};
-    }
-    if (identifier == "let") {
-      return Token{TokenType::Let, identifier};
-    }
-    if (identifier == "data") {
-      return Token{TokenType::Data, identifier};
-    }
-    if (identifier == "@internal") {
-      return Token{TokenType::Internal, identifier};
+    TRACE_DEBUG("Identifier: %.*s", (int)identifier.size(),
+                identifier.data());
+    if (const Keyword *keyword = find_keyword(identifier)) {
+      return make(keyword->type, start);
     }
-    if (identifier == "@main") {
-      return Token{TokenType::Main, identifier};
-    }
-    if (identifier == "@include") {
-      return Token{TokenType::Include, identifier};
-    }
-    if (identifier == "@uniform") {
-      return Token{TokenType::Uniforms, identifier};
-    }
-    if (identifier == "@in") {
-      return Token{TokenType::Input, identifier};
-    }
-    if (identifier == "@out") {
-      return Token{TokenType::Output, identifier};
-    }
-    // types
-    // TODO: add different types
-    if (identifier == "float" || identifier == "int")
-      return Token{TokenType::Type, identifier};
-
-    return Token{TokenType::Identifier, identifier};
+    return make(TokenType::Identifier, start);
   }
 
   // Numbers
-  if (std::isdigit(current)) {
-    std::string number;
-    bool dot = false;
-
-    while (std::isdigit(peekChar()) || peekChar() == '.') {
-      if (peekChar() == '.') {
-        if (dot)
-          break;
-        dot = true;
-      }
-      number += peekChar();
+  if (is_char_class(current, CharDigit)) {
+    cursor = scan.digits(source + cursor) - source;
+    if (peekChar() == '.') {
       cursor++;
+      cursor = scan.digits(source + cursor) - source;
     }
-    return Token{TokenType::Number, number};
+    return make(TokenType::Number, start);
   }
 
   // One-character tokens
   cursor++;
   switch (current) {
   case '+':
-    return Token{TokenType::Plus, "+"};
+    return make(TokenType::Plus, start);
   case '*':
-    return Token{TokenType::Multiply, "*"};
+    return make(TokenType::Multiply, start);
   case '/':
-    return Token{TokenType::Divide, "/"};
+    return make(TokenType::Divide, start);
   case '>': {
-    if (peekChar(cursor + 1) == '=') {
+    if (peekChar() == '=') {
       cursor++;
-      return Token{TokenType::GreaterThan, "/"};
+      return make(TokenType::GreaterOrEqualsThan, start);
     }
-    return Token{TokenType::GreaterThan, "/"};
+    return make(TokenType::GreaterThan, start);
   }
   case '<': {
-    if (peekChar(cursor + 1) == '=') {
+    if (peekChar() == '=') {
       cursor++;
-      return Token{TokenType::LessThan, "/"};
+      return make(TokenType::LessOrEqualsThan, start);
     }
-    return Token{TokenType::LessThan, "/"};
+    return make(TokenType::LessThan, start);
   }
   case '{':
-    return Token{TokenType::LeftBrace, "{"};
+    return make(TokenType::LeftBrace, start);
   case '}':
-    return Token{TokenType::RightBrace, "}"};
+    return make(TokenType::RightBrace, start);
   case '(':
-    return Token{TokenType::LeftParen, "("};
+    return make(TokenType::LeftParen, start);
   case ')':
-    return Token{TokenType::RightParen, ")"};
+    return make(TokenType::RightParen, start);
   case ']':
-    return Token{TokenType::RightBracket, "]"};
+    return make(TokenType::RightBracket, start);
   case '[':
-    return Token{TokenType::LeftBracket, "["};
+    return make(TokenType::LeftBracket, start);
   case ',':
-    return Token{TokenType::Comma, ","};
+    return make(TokenType::Comma, start);
   case '=':
-    return Token{TokenType::Equals, "="};
+    return make(TokenType::Equals, start);
   case '.':
-    return Token{TokenType::Dot, "."};
+    return make(TokenType::Dot, start);
   }
+  return make(TokenType::Unknown, start);
 }
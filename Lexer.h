@@ -1,12 +1,28 @@
 #pragma once
+#include "lexer_scan.h"
 #include "token.h"
+#include <cstdint>
+#include <string_view>
 
 class Lexer {
 public:
-  Lexer(const char *lexme) : source(lexme), cursor(0) {}
+  Lexer(const char *lexme)
+      : cursor(0), source(lexme), scan(scan_functions()) {}
+  // Lexes only [begin, end) of `lexme`, reporting End at `end`. `begin` must
+  // be the start of line `first_line`. Token offsets stay relative to
+  // `lexme`.
+  Lexer(const char *lexme, size_t begin, size_t end, size_t first_line)
+      : cursor(begin), source(lexme), scan(scan_functions()), limit(end),
+        line(first_line), line_start(begin) {}
+  // Hands out tokens in order. Tokens are scanned once into a small ring
+  // buffer, so lookahead through peek() never re-lexes the source.
   Token next();
-  Token peek();
-  const char *get_sequence() const;
+  // The token `distance` positions after the one next() returns next.
+  Token peek(size_t distance = 0);
+  static constexpr size_t max_lookahead = 8;
+  std::string_view text(const Token &token) const {
+    return std::string_view(source + token.offset, token.length);
+  }
   char peekChar();
   char peekChar(size_t index);
   void skipWhitespace();
@@ -14,4 +30,13 @@ public:
   const char *source;
 
 private:
+  Token lex();
+  Token make(TokenType type, size_t start) const;
+  const ScanFunctions &scan;
+  size_t limit = SIZE_MAX;
+  size_t line = 1;
+  size_t line_start = 0;
+  Token lookahead[max_lookahead];
+  size_t lookahead_head = 0;
+  size_t lookahead_count = 0;
 };
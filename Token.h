@@ -1,8 +1,8 @@
 #pragma once
 
-#include <string>
+#include <cstdint>
 
-enum class TokenType {
+enum class TokenType : uint8_t {
   Number = 0,
   At = 1,
   LineBreak = 2,
@@ -46,10 +46,15 @@ enum class TokenType {
   LessThan = 41,
   GreaterOrEqualsThan = 42,
   LessOrEqualsThan = 43,
+  Variant = 44,
 };
 
+// A token does not own its text: `offset` and `length` address the source
+// buffer the Lexer was constructed with, see Lexer::text().
 struct Token {
-  Token(TokenType type, std::string data) : type(type), data(data) {}
-  TokenType type;
-  std::string data;
+  TokenType type = TokenType::None;
+  uint32_t offset = 0;
+  uint32_t length = 0;
+  uint32_t line = 0;
+  uint32_t column = 0;
 };
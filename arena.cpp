@@ -0,0 +1,63 @@
+#include "arena.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+Arena::~Arena() {
+  while (head) {
+    Block *next = head->next;
+    std::free(head);
+    head = next;
+  }
+}
+
+void *Arena::allocate(size_t size, size_t align) {
+  uintptr_t p = (reinterpret_cast<uintptr_t>(ptr) + align - 1) & ~(align - 1);
+  if (!ptr || p + size > reinterpret_cast<uintptr_t>(end)) {
+    size_t needed = size + align + sizeof(Block);
+    size_t size_of_block = needed > block_size ? needed : block_size;
+    Block *block = static_cast<Block *>(std::malloc(size_of_block));
+    if (!block)
+      throw std::bad_alloc();
+    block->size = size_of_block;
+    // The first block stays at the head of the list so reset() can keep it.
+    if (head) {
+      block->next = head->next;
+      head->next = block;
+    } else {
+      block->next = nullptr;
+      head = block;
+    }
+    ptr = reinterpret_cast<char *>(block + 1);
+    end = reinterpret_cast<char *>(block) + size_of_block;
+    p = (reinterpret_cast<uintptr_t>(ptr) + align - 1) & ~(align - 1);
+  }
+  ptr = reinterpret_cast<char *>(p + size);
+  used += size;
+  return reinterpret_cast<void *>(p);
+}
+
+std::string_view Arena::copy(std::string_view text) {
+  if (text.empty())
+    return {};
+  char *dst = static_cast<char *>(allocate(text.size(), 1));
+  std::memcpy(dst, text.data(), text.size());
+  return std::string_view(dst, text.size());
+}
+
+void Arena::reset() {
+  if (!head)
+    return;
+  Block *block = head->next;
+  while (block) {
+    Block *next = block->next;
+    std::free(block);
+    block = next;
+  }
+  head->next = nullptr;
+  ptr = reinterpret_cast<char *>(head + 1);
+  end = reinterpret_cast<char *>(head) + head->size;
+  used = 0;
+}
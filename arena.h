@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+// Bump allocator. Memory is handed out from large blocks and is only
+// released all at once, either by reset() or when the arena is destroyed.
+class Arena {
+public:
+  explicit Arena(size_t block_size = 64 * 1024) : block_size(block_size) {}
+  ~Arena();
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *allocate(size_t size, size_t align = alignof(std::max_align_t));
+  std::string_view copy(std::string_view text);
+  template <typename T> T *allocate_array(size_t count) {
+    return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+  }
+  // Drops everything but the first block, which is kept for reuse.
+  void reset();
+  size_t bytes_used() const { return used; }
+
+private:
+  struct Block {
+    Block *next;
+    size_t size;
+  };
+  Block *head = nullptr;
+  char *ptr = nullptr;
+  char *end = nullptr;
+  size_t block_size;
+  size_t used = 0;
+};
@@ -0,0 +1,95 @@
+#include "ast_node.h"
+
+Ast::Ast(size_t source_size) {
+  // Roughly one node per four bytes of source is plenty for .hgl files, so
+  // a whole parse usually fits in the initial reservation.
+  size_t estimate = source_size / 4 + 16;
+  nodes.reserve(estimate);
+  offsets.reserve(estimate);
+  child_ids.reserve(estimate);
+  scratch.reserve(64);
+}
+
+NodeId Ast::add(NodeType type, Symbol value) {
+  ASTNode node{type};
+  node.value = value;
+  nodes.push_back(node);
+  offsets.push_back(location);
+  return static_cast<NodeId>(nodes.size() - 1);
+}
+
+NodeId Ast::add(NodeType type, Symbol value,
+                std::initializer_list<NodeId> children) {
+  NodeId id = add(type, value);
+  set_children(id, children.begin(), children.size());
+  return id;
+}
+
+void Ast::set_children(NodeId node, size_t mark) {
+  set_children(node, scratch.data() + mark, scratch.size() - mark);
+  scratch.resize(mark);
+}
+
+void Ast::set_children(NodeId node, const NodeId *children, size_t count) {
+  ASTNode &n = nodes[node];
+  n.first_child = static_cast<uint32_t>(child_ids.size());
+  n.child_count = static_cast<uint32_t>(count);
+  if (children >= child_ids.data() &&
+      children < child_ids.data() + child_ids.size()) {
+    // Re-using another node's range: copy by index, the array may grow.
+    size_t first = children - child_ids.data();
+    for (size_t i = 0; i < count; ++i)
+      child_ids.push_back(child_ids[first + i]);
+    return;
+  }
+  child_ids.insert(child_ids.end(), children, children + count);
+}
+
+uint32_t Ast::offset_of(NodeId id) const {
+  uint32_t offset = offsets[id];
+  while (nodes[id].child_count != 0) {
+    id = child_ids[nodes[id].first_child];
+    if (offsets[id] < offset)
+      offset = offsets[id];
+  }
+  return offset;
+}
+
+NodeRange Ast::children(NodeId id) const {
+  const ASTNode &n = nodes[id];
+  const NodeId *first = child_ids.data() + n.first_child;
+  return NodeRange{first, first + n.child_count};
+}
+
+void Ast::assign(const ASTNode *node_array, const uint32_t *offset_array,
+                 size_t node_count, const NodeId *child_array,
+                 size_t child_count) {
+  nodes.assign(node_array, node_array + node_count);
+  offsets.assign(offset_array, offset_array + node_count);
+  child_ids.assign(child_array, child_array + child_count);
+  scratch.clear();
+}
+
+void Ast::clear() {
+  nodes.clear();
+  offsets.clear();
+  child_ids.clear();
+  scratch.clear();
+  location = 0;
+  root = NoNode;
+}
+
+NodeId Ast::append(const Ast &other) {
+  NodeId base = static_cast<NodeId>(nodes.size());
+  uint32_t child_base = static_cast<uint32_t>(child_ids.size());
+  nodes.reserve(nodes.size() + other.nodes.size());
+  for (ASTNode node : other.nodes) {
+    node.first_child += child_base;
+    nodes.push_back(node);
+  }
+  offsets.insert(offsets.end(), other.offsets.begin(), other.offsets.end());
+  child_ids.reserve(child_ids.size() + other.child_ids.size());
+  for (NodeId child : other.child_ids)
+    child_ids.push_back(child + base);
+  return base;
+}
@@ -1,8 +1,11 @@
 #pragma once
-#include <string>
+#include "interner.h"
+#include <cstdint>
+#include <initializer_list>
+#include <string_view>
 #include <vector>
 
-enum class NodeType {
+enum class NodeType : uint8_t {
   Program = 0,
   Identifier = 1,
   Assignment = 2,
@@ -33,12 +36,102 @@ enum class NodeType {
   LetBinding = 27,
   FieldAccess = 28,
   OperatorOverload = 29,
-  Let = 30
+  Let = 30,
+  UnaryOp = 31,
+  Error = 32,
+  AttributeFormat = 33,
+  Variant = 34
 };
 
+using NodeId = uint32_t;
+constexpr NodeId NoNode = UINT32_MAX;
+
+// Nodes live in one flat array owned by an Ast. Children are a contiguous
+// range [first_child, first_child + child_count) of Ast's child index array
+// and values are interned symbols.
 struct ASTNode {
   NodeType type;
-  std::string value;
-  std::vector<ASTNode *> children;
   bool internal = false;
+  Symbol value = NoSymbol;
+  uint32_t first_child = 0;
+  uint32_t child_count = 0;
+};
+
+struct NodeRange {
+  const NodeId *first;
+  const NodeId *last;
+  const NodeId *begin() const { return first; }
+  const NodeId *end() const { return last; }
+  size_t size() const { return last - first; }
+  bool empty() const { return first == last; }
+  NodeId operator[](size_t i) const { return first[i]; }
+};
+
+// Storage for one compilation unit: the node array, the source offset of
+// each node and the child index array. Names live in the global interner,
+// so a node is plain data and the arrays can be copied or serialized as
+// they are.
+class Ast {
+public:
+  explicit Ast(size_t source_size = 0);
+
+  NodeId add(NodeType type, Symbol value = NoSymbol);
+  NodeId add(NodeType type, Symbol value,
+             std::initializer_list<NodeId> children);
+  NodeId add(NodeType type, std::string_view value) {
+    return add(type, intern(value));
+  }
+  NodeId add(NodeType type, std::string_view value,
+             std::initializer_list<NodeId> children) {
+    return add(type, intern(value), children);
+  }
+
+  // Children are collected on a scratch stack while a node is being parsed
+  // and moved into the child index array in one go once it is complete.
+  size_t mark() const { return scratch.size(); }
+  void push(NodeId child) { scratch.push_back(child); }
+  void set_children(NodeId node, size_t mark);
+  void set_children(NodeId node, const NodeId *children, size_t count);
+
+  ASTNode &operator[](NodeId id) { return nodes[id]; }
+  const ASTNode &operator[](NodeId id) const { return nodes[id]; }
+  // The returned range is invalidated by adding children to any node.
+  NodeRange children(NodeId id) const;
+  NodeId child(NodeId id, size_t index) const {
+    return child_ids[nodes[id].first_child + index];
+  }
+  std::string_view value(NodeId id) const {
+    return symbol_text(nodes[id].value);
+  }
+
+  // Source offset recorded for nodes added from now on. The parser keeps it
+  // at the last token consumed, so leaves get the offset of their token.
+  void set_location(uint32_t offset) { location = offset; }
+  // Offset of the first token of a node: for composite nodes that is the
+  // start of their leftmost child.
+  uint32_t offset_of(NodeId id) const;
+
+  size_t size() const { return nodes.size(); }
+  void clear();
+
+  // Raw access to the flat arrays, for serialization and merging.
+  const ASTNode *node_data() const { return nodes.data(); }
+  const NodeId *child_data() const { return child_ids.data(); }
+  const uint32_t *offset_data() const { return offsets.data(); }
+  size_t child_index_count() const { return child_ids.size(); }
+  void assign(const ASTNode *node_array, const uint32_t *offset_array,
+              size_t node_count, const NodeId *child_array,
+              size_t child_count);
+  // Copies every node of `other` to the end of this tree and returns the
+  // amount its NodeIds were shifted by.
+  NodeId append(const Ast &other);
+
+  NodeId root = NoNode;
+
+private:
+  std::vector<ASTNode> nodes;
+  std::vector<uint32_t> offsets;
+  std::vector<NodeId> child_ids;
+  std::vector<NodeId> scratch;
+  uint32_t location = 0;
 };
@@ -0,0 +1,125 @@
+#include "bench.h"
+
+#include "Lexer.h"
+#include "lexer_scan.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace {
+// Deterministic input so runs are comparable across machines and builds.
+struct Generator {
+  uint32_t state = 0x9E3779B9u;
+  uint32_t next(uint32_t bound) {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) % bound;
+  }
+
+  void identifier(std::string &out) {
+    static const char alphabet[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+    out += "abcdefghijklmnopqrstuvwxyz"[next(26)];
+    uint32_t length = next(20);
+    for (uint32_t i = 0; i < length; ++i)
+      out += alphabet[next(sizeof(alphabet) - 11)];
+  }
+
+  void number(std::string &out) {
+    out += std::to_string(next(100000));
+    if (next(2)) {
+      out += '.';
+      out += std::to_string(next(1000));
+    }
+  }
+
+  void spaces(std::string &out) {
+    uint32_t count = 1 + next(next(4) == 0 ? 24 : 3);
+    for (uint32_t i = 0; i < count; ++i)
+      out += next(8) == 0 ? '\t' : ' ';
+  }
+};
+
+std::string generate_source(size_t bytes) {
+  static const char *const operators[] = {"+", "-", "*", "/", "<", ">="};
+  Generator gen;
+  std::string out;
+  out.reserve(bytes + 256);
+  while (out.size() < bytes) {
+    out += "@main vertex =\n    let ";
+    gen.identifier(out);
+    out += " = 1.0\n";
+    uint32_t bindings = 4 + gen.next(12);
+    for (uint32_t b = 0; b < bindings; ++b) {
+      gen.spaces(out);
+      gen.identifier(out);
+      gen.spaces(out);
+      out += "= ";
+      uint32_t terms = 1 + gen.next(6);
+      for (uint32_t t = 0; t < terms; ++t) {
+        if (t != 0) {
+          out += ' ';
+          out += operators[gen.next(6)];
+          out += ' ';
+        }
+        if (gen.next(3) == 0) {
+          gen.number(out);
+        } else {
+          out += '(';
+          gen.identifier(out);
+          gen.spaces(out);
+          gen.identifier(out);
+          out += ')';
+        }
+      }
+      out += gen.next(4) == 0 ? "\r\n" : "\n";
+    }
+    out += "    @in fragment ";
+    gen.identifier(out);
+    out += "\n\n";
+  }
+  return out;
+}
+
+size_t count_tokens(const char *source) {
+  Lexer lexer{source};
+  size_t tokens = 0;
+  while (lexer.next().type != TokenType::End)
+    tokens++;
+  return tokens;
+}
+} // namespace
+
+int run_lexer_bench(size_t bytes) {
+  std::string source = generate_source(bytes);
+  fprintf(stdout, "lexing %zu bytes of generated source\n", source.size());
+
+  const ScanImpl previous = scan_impl();
+  double scalar_rate = 0.0;
+  for (ScanImpl impl : {ScanImpl::Scalar, ScanImpl::SSE2, ScanImpl::AVX2}) {
+    if (!scan_select(impl))
+      continue;
+    size_t tokens = count_tokens(source.c_str()); // warm up
+    double best = 1e30;
+    for (int run = 0; run < 5; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      tokens = count_tokens(source.c_str());
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      if (elapsed.count() < best)
+        best = elapsed.count();
+    }
+    double rate = tokens / best;
+    if (impl == ScanImpl::Scalar)
+      scalar_rate = rate;
+    fprintf(stdout, "%-8s %10zu tokens %8.3f ms %8.2f Mtok/s %8.1f MB/s",
+            scan_impl_name(impl), tokens, best * 1e3, rate / 1e6,
+            source.size() / best / 1e6);
+    if (impl != ScanImpl::Scalar && scalar_rate > 0.0)
+      fprintf(stdout, "  x%.2f vs scalar", rate / scalar_rate);
+    fprintf(stdout, "\n");
+  }
+  scan_select(previous);
+  return 0;
+}
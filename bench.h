@@ -0,0 +1,6 @@
+#pragma once
+#include <cstddef>
+
+// Lexes `bytes` of generated .hgl source with every character-class
+// scanner this CPU supports and prints tokens/second for each of them.
+int run_lexer_bench(size_t bytes);
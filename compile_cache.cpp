@@ -0,0 +1,229 @@
+#include "compile_cache.h"
+#include "hash.h"
+#include "serialize.h"
+#include "source_file.h"
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char entry_magic[4] = {'H', 'G', 'L', 'O'};
+constexpr uint32_t entry_version = 1;
+constexpr const char *entry_extension = ".hglo";
+
+struct EntryHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint32_t dependency_count;
+  uint32_t file_count;
+};
+
+static_assert(sizeof(EntryHeader) == 24, "EntryHeader layout");
+
+void add_dependencies(const std::vector<std::shared_ptr<const Module>> &imports,
+                      std::vector<const Module *> &closure) {
+  for (const auto &module : imports) {
+    if (std::find(closure.begin(), closure.end(), module.get()) !=
+        closure.end())
+      continue;
+    closure.push_back(module.get());
+    add_dependencies(module->imports, closure);
+  }
+}
+
+// Writes next to the target and renames, so concurrent readers see either
+// the old file or a complete new one.
+bool write_atomically(const std::string &path, std::string_view contents) {
+  std::error_code ec;
+  fs::create_directories(fs::path(path).parent_path(), ec);
+  std::string temp =
+      path + ".tmp" +
+      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+      '-' +
+      std::to_string(
+          std::chrono::steady_clock::now().time_since_epoch().count());
+  FILE *file = fopen(temp.c_str(), "wb");
+  if (!file)
+    return false;
+  bool ok = fwrite(contents.data(), 1, contents.size(), file) ==
+            contents.size();
+  ok = fclose(file) == 0 && ok;
+  if (ok)
+    fs::rename(temp, path, ec);
+  if (!ok || ec) {
+    fs::remove(temp, ec);
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+CompileCache::CompileCache(std::string dir, uint64_t max_bytes, uint64_t salt)
+    : dir(std::move(dir)), max_bytes(max_bytes), salt(salt) {}
+
+uint64_t CompileCache::key(std::string_view path,
+                           std::string_view source) const {
+  uint64_t key = hash_combine(salt, hash_bytes(path.data(), path.size()));
+  return hash_combine(key, hash_bytes(source.data(), source.size()));
+}
+
+std::string CompileCache::entry_path(uint64_t key) const {
+  // Two levels keep directories small with many thousands of entries.
+  char name[32];
+  snprintf(name, sizeof(name), "%02x/%016" PRIx64, static_cast<int>(key >> 56),
+           key);
+  return (fs::path(dir) / (name + std::string(entry_extension))).string();
+}
+
+bool CompileCache::lookup(uint64_t key, CachedCompile &compile) {
+  std::string path = entry_path(key);
+  bool hit = [&] {
+    SourceFile file;
+    if (!file.open(path.c_str()) || file.size() < sizeof(EntryHeader))
+      return false;
+    EntryHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, entry_magic, sizeof(header.magic)) != 0 ||
+        header.version != entry_version || header.key != key)
+      return false;
+
+    Reader reader{file.data() + sizeof(header), file.data() + file.size()};
+    for (uint32_t i = 0; i < header.dependency_count; ++i) {
+      std::string dependency;
+      uint64_t hash;
+      if (!reader.get(dependency) || !reader.get(hash))
+        return false;
+      SourceFile source;
+      if (!source.open(dependency.c_str()) ||
+          hash_bytes(source.data(), source.size()) != hash)
+        return false;
+    }
+    compile.files.resize(header.file_count);
+    for (OutputFile &output : compile.files) {
+      if (!reader.get(output.name) || !reader.get(output.contents))
+        return false;
+    }
+    return reader.get(compile.output) && reader.get(compile.diagnostics);
+  }();
+
+  std::lock_guard<std::mutex> guard(mutex);
+  if (!hit) {
+    counters.misses++;
+    return false;
+  }
+  // The modification time is the entry's last use, for trim().
+  std::error_code ec;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+  counters.hits++;
+  return true;
+}
+
+void CompileCache::store(
+    uint64_t key, const std::vector<std::shared_ptr<const Module>> &imports,
+    const CachedCompile &compile) {
+  std::vector<const Module *> closure;
+  add_dependencies(imports, closure);
+
+  EntryHeader header{};
+  std::memcpy(header.magic, entry_magic, sizeof(header.magic));
+  header.version = entry_version;
+  header.key = key;
+  header.dependency_count = static_cast<uint32_t>(closure.size());
+  header.file_count = static_cast<uint32_t>(compile.files.size());
+  std::string entry(reinterpret_cast<const char *>(&header), sizeof(header));
+  for (const Module *module : closure) {
+    put(entry, module->path);
+    put(entry, module->content_hash);
+  }
+  for (const OutputFile &output : compile.files) {
+    put(entry, output.name);
+    put(entry, output.contents);
+  }
+  put(entry, compile.output);
+  put(entry, compile.diagnostics);
+  if (!write_atomically(entry_path(key), entry))
+    return;
+  std::lock_guard<std::mutex> guard(mutex);
+  counters.stored++;
+}
+
+void CompileCache::trim() {
+  if (stats().stored == 0)
+    return;
+  struct Entry {
+    fs::file_time_type used;
+    uint64_t size;
+    fs::path path;
+  };
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (auto it = fs::recursive_directory_iterator(dir, ec);
+       !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+    if (!it->is_regular_file(ec) || it->path().extension() != entry_extension)
+      continue;
+    Entry entry{it->last_write_time(ec), it->file_size(ec), it->path()};
+    total += entry.size;
+    entries.push_back(std::move(entry));
+  }
+  if (total <= max_bytes)
+    return;
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.used < b.used; });
+  size_t evicted = 0;
+  for (const Entry &entry : entries) {
+    if (total <= max_bytes)
+      break;
+    if (fs::remove(entry.path, ec)) {
+      total -= entry.size;
+      evicted++;
+    }
+  }
+  std::lock_guard<std::mutex> guard(mutex);
+  counters.evicted += evicted;
+}
+
+CompileCache::Stats CompileCache::stats() const {
+  std::lock_guard<std::mutex> guard(mutex);
+  return counters;
+}
+
+void CompileCache::save_totals() {
+  Stats run = stats();
+  if (run.hits == 0 && run.misses == 0)
+    return;
+  // Runs that finish together may lose each other's counts; the totals
+  // are only there to show a hit rate.
+  DiskStats totals = disk_stats();
+  char text[64];
+  snprintf(text, sizeof(text), "%" PRIu64 " %" PRIu64 "\n",
+           totals.hits + run.hits, totals.misses + run.misses);
+  write_atomically((fs::path(dir) / "totals").string(), text);
+}
+
+CompileCache::DiskStats CompileCache::disk_stats() const {
+  DiskStats stats;
+  std::error_code ec;
+  for (auto it = fs::recursive_directory_iterator(dir, ec);
+       !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+    if (!it->is_regular_file(ec) || it->path().extension() != entry_extension)
+      continue;
+    stats.entries++;
+    stats.bytes += it->file_size(ec);
+  }
+  if (FILE *file = fopen((fs::path(dir) / "totals").string().c_str(), "rb")) {
+    if (fscanf(file, "%" SCNu64 " %" SCNu64, &stats.hits, &stats.misses) != 2)
+      stats.hits = stats.misses = 0;
+    fclose(file);
+  }
+  return stats;
+}
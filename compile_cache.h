@@ -0,0 +1,72 @@
+#pragma once
+#include "module.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A file compiling an input wrote, relative to the output directory.
+struct OutputFile {
+  std::string name;
+  std::string contents;
+};
+
+// Everything compiling one input produced, as the cache replays it.
+struct CachedCompile {
+  std::string output;
+  std::string diagnostics;
+  std::vector<OutputFile> files;
+};
+
+// On-disk cache of compile results, shared between runs and processes.
+// Entries are keyed on the input's path and bytes plus a salt standing for
+// the compiler and its options, and record the path and content hash of
+// every module the input includes, directly or not; a lookup checks those
+// by hashing the files, so a hit never lexes anything. Entries are written
+// to a temporary file and renamed into place, and used entries are
+// touched, so trim() can drop the least recently used ones. Thread-safe.
+class CompileCache {
+public:
+  CompileCache(std::string dir, uint64_t max_bytes, uint64_t salt);
+
+  uint64_t key(std::string_view path, std::string_view source) const;
+  bool lookup(uint64_t key, CachedCompile &compile);
+  void store(uint64_t key,
+             const std::vector<std::shared_ptr<const Module>> &imports,
+             const CachedCompile &compile);
+  // Removes the least recently used entries until the cache fits in its
+  // size limit. Only scans the directory if this run stored anything.
+  void trim();
+
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t stored = 0;
+    size_t evicted = 0;
+  };
+  // Counts of this run.
+  Stats stats() const;
+
+  struct DiskStats {
+    size_t entries = 0;
+    uint64_t bytes = 0;
+    // Hits and misses of every run so far.
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+  // Adds this run's counts to the totals kept in the cache directory.
+  void save_totals();
+  DiskStats disk_stats() const;
+
+private:
+  std::string entry_path(uint64_t key) const;
+
+  std::string dir;
+  uint64_t max_bytes;
+  uint64_t salt;
+  // Guards `counters`.
+  mutable std::mutex mutex;
+  Stats counters;
+};
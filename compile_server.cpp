@@ -0,0 +1,378 @@
+#include "compile_server.h"
+#include "serialize.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+
+int run_server(const std::string &, const CompileHandler &) {
+  fprintf(stderr, "ERROR: -server needs Unix domain sockets\n");
+  return 1;
+}
+
+int run_client(const std::string &, const CompileRequest &) {
+  fprintf(stderr, "ERROR: -client needs Unix domain sockets\n");
+  return 1;
+}
+
+int stop_server(const std::string &path) { return run_client(path, {}); }
+
+int run_server_bench(const std::string &path, const CompileRequest &request,
+                     size_t, size_t) {
+  return run_client(path, request);
+}
+
+#else
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+enum class MessageType : uint32_t { Compile = 1, Reply = 2, Stop = 3 };
+
+struct FrameHeader {
+  uint32_t size;
+  MessageType type;
+};
+
+static_assert(sizeof(FrameHeader) == 8, "FrameHeader layout");
+
+// Larger frames are taken for a confused peer rather than allocated.
+constexpr uint32_t max_frame_size = 256 * 1024 * 1024;
+
+volatile sig_atomic_t stop_signal = 0;
+
+void on_stop_signal(int) { stop_signal = 1; }
+
+bool read_exact(int fd, void *data, size_t size) {
+  char *cursor = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t count = read(fd, cursor, size);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      return false;
+    cursor += count;
+    size -= static_cast<size_t>(count);
+  }
+  return true;
+}
+
+bool write_all(int fd, const void *data, size_t size) {
+  const char *cursor = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t count = write(fd, cursor, size);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      return false;
+    cursor += count;
+    size -= static_cast<size_t>(count);
+  }
+  return true;
+}
+
+bool send_frame(int fd, MessageType type, std::string_view body) {
+  if (body.size() > max_frame_size)
+    return false;
+  FrameHeader header{static_cast<uint32_t>(body.size()), type};
+  return write_all(fd, &header, sizeof(header)) &&
+         write_all(fd, body.data(), body.size());
+}
+
+bool receive_frame(int fd, MessageType &type, std::string &body) {
+  FrameHeader header;
+  if (!read_exact(fd, &header, sizeof(header)) ||
+      header.size > max_frame_size)
+    return false;
+  type = header.type;
+  body.resize(header.size);
+  return read_exact(fd, body.data(), body.size());
+}
+
+std::string encode(const CompileRequest &request) {
+  std::string body;
+  put(body, request.cwd);
+  put(body, static_cast<uint64_t>(request.inputs.size()));
+  for (const std::string &input : request.inputs)
+    put(body, input);
+  return body;
+}
+
+bool decode(std::string_view body, CompileRequest &request) {
+  Reader reader{body.data(), body.data() + body.size()};
+  uint64_t count;
+  if (!reader.get(request.cwd) || !reader.get(count) ||
+      count > body.size())
+    return false;
+  request.inputs.resize(count);
+  for (std::string &input : request.inputs) {
+    if (!reader.get(input))
+      return false;
+  }
+  return true;
+}
+
+std::string encode(const CompileReply &reply) {
+  std::string body;
+  put(body, reply.failed);
+  put(body, reply.output);
+  put(body, reply.diagnostics);
+  return body;
+}
+
+bool decode(std::string_view body, CompileReply &reply) {
+  Reader reader{body.data(), body.data() + body.size()};
+  uint64_t failed;
+  if (!reader.get(failed) || !reader.get(reply.output) ||
+      !reader.get(reply.diagnostics))
+    return false;
+  reply.failed = static_cast<uint32_t>(failed);
+  return true;
+}
+
+bool socket_address(const std::string &path, sockaddr_un &address) {
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path))
+    return false;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
+
+int connect_to(const std::string &path) {
+  sockaddr_un address;
+  if (!socket_address(path, address))
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) !=
+      0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int connect_or_report(const std::string &path) {
+  int fd = connect_to(path);
+  if (fd < 0)
+    fprintf(stderr, "ERROR: could not connect to %s: %s\n", path.c_str(),
+            strerror(errno));
+  return fd;
+}
+
+// Sends `request` over `fd` and waits for the reply.
+bool round_trip(int fd, const std::string &request, CompileReply &reply) {
+  MessageType type;
+  std::string body;
+  return send_frame(fd, MessageType::Compile, request) &&
+         receive_frame(fd, type, body) && type == MessageType::Reply &&
+         decode(body, reply);
+}
+
+// Connections being served, so stopping can wake their blocking reads.
+class Connections {
+public:
+  void add(int fd) {
+    std::lock_guard<std::mutex> guard(mutex);
+    open.insert(fd);
+  }
+  void remove(int fd) {
+    std::lock_guard<std::mutex> guard(mutex);
+    open.erase(fd);
+    close(fd);
+    if (open.empty())
+      closed.notify_all();
+  }
+  // Ends every connection after its current request and waits for them.
+  void close_all() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (int fd : open)
+      shutdown(fd, SHUT_RD);
+    closed.wait(lock, [&] { return open.empty(); });
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable closed;
+  std::unordered_set<int> open;
+};
+
+void serve_connection(int fd, const CompileHandler &handler,
+                      std::atomic<bool> &stopping) {
+  MessageType type;
+  std::string body;
+  while (!stopping && receive_frame(fd, type, body)) {
+    if (type == MessageType::Stop) {
+      stopping = true;
+      break;
+    }
+    CompileRequest request;
+    CompileReply reply;
+    if (type != MessageType::Compile || !decode(body, request))
+      break;
+    handler(request, reply);
+    if (!send_frame(fd, MessageType::Reply, encode(reply)))
+      break;
+  }
+}
+
+double percentile(const std::vector<double> &sorted, double fraction) {
+  size_t rank = static_cast<size_t>(fraction * sorted.size() + 0.999999);
+  return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+} // namespace
+
+int run_server(const std::string &path, const CompileHandler &handler) {
+  sockaddr_un address;
+  if (!socket_address(path, address)) {
+    fprintf(stderr, "ERROR: socket path %s is too long\n", path.c_str());
+    return 1;
+  }
+  // A socket file nobody answers on is left over from a server that did
+  // not exit cleanly.
+  int running = connect_to(path);
+  if (running >= 0) {
+    close(running);
+    fprintf(stderr, "ERROR: a server is already listening on %s\n",
+            path.c_str());
+    return 1;
+  }
+  unlink(path.c_str());
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 ||
+      bind(listener, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    fprintf(stderr, "ERROR: could not listen on %s: %s\n", path.c_str(),
+            strerror(errno));
+    if (listener >= 0)
+      close(listener);
+    return 1;
+  }
+  // A client that goes away mid-reply must not kill the server.
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, on_stop_signal);
+  signal(SIGTERM, on_stop_signal);
+  fprintf(stderr, "listening on %s\n", path.c_str());
+
+  std::atomic<bool> stopping{false};
+  Connections connections;
+  while (!stopping && !stop_signal) {
+    // Wakes up now and then to notice a stop request.
+    pollfd ready{listener, POLLIN, 0};
+    if (poll(&ready, 1, 200) <= 0)
+      continue;
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+    connections.add(fd);
+    std::thread([fd, &handler, &stopping, &connections] {
+      serve_connection(fd, handler, stopping);
+      connections.remove(fd);
+    }).detach();
+  }
+  close(listener);
+  unlink(path.c_str());
+  connections.close_all();
+  return 0;
+}
+
+int run_client(const std::string &path, const CompileRequest &request) {
+  int fd = connect_or_report(path);
+  if (fd < 0)
+    return 1;
+  CompileReply reply;
+  bool ok = round_trip(fd, encode(request), reply);
+  close(fd);
+  if (!ok) {
+    fprintf(stderr, "ERROR: the server at %s did not reply\n", path.c_str());
+    return 1;
+  }
+  fwrite(reply.output.data(), 1, reply.output.size(), stdout);
+  fwrite(reply.diagnostics.data(), 1, reply.diagnostics.size(), stderr);
+  return reply.failed == 0 ? 0 : 1;
+}
+
+int stop_server(const std::string &path) {
+  int fd = connect_or_report(path);
+  if (fd < 0)
+    return 1;
+  bool ok = send_frame(fd, MessageType::Stop, {});
+  close(fd);
+  return ok ? 0 : 1;
+}
+
+int run_server_bench(const std::string &path, const CompileRequest &request,
+                     size_t clients, size_t requests) {
+  std::string body = encode(request);
+  // Milliseconds per request, each client filling its own slice.
+  std::vector<double> latencies(clients * requests);
+  std::atomic<size_t> lost{0};
+  std::atomic<size_t> failed{0};
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t client = 0; client < clients; ++client) {
+    threads.emplace_back([&, client] {
+      int fd = connect_to(path);
+      for (size_t i = 0; i < requests; ++i) {
+        auto sent = std::chrono::steady_clock::now();
+        CompileReply reply;
+        if (fd < 0 || !round_trip(fd, body, reply)) {
+          lost += requests - i;
+          break;
+        }
+        failed += reply.failed != 0;
+        latencies[client * requests + i] =
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - sent)
+                .count();
+      }
+      if (fd >= 0)
+        close(fd);
+    });
+  }
+  for (std::thread &thread : threads)
+    thread.join();
+  double elapsed = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  if (lost != 0) {
+    fprintf(stderr, "ERROR: %zu of %zu requests to %s got no reply\n",
+            lost.load(), latencies.size(), path.c_str());
+    return 1;
+  }
+  if (latencies.empty())
+    return 0;
+  std::sort(latencies.begin(), latencies.end());
+  printf("%zu requests from %zu clients in %.1f ms, %.0f requests/s, %zu "
+         "failed\n"
+         "latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+         latencies.size(), clients, elapsed,
+         latencies.size() / (elapsed / 1000), failed.load(),
+         percentile(latencies, 0.50), percentile(latencies, 0.99),
+         latencies.back());
+  return 0;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Inputs to compile, as a client named them; relative ones are relative to
+// `cwd`, the client's working directory.
+struct CompileRequest {
+  std::string cwd;
+  std::vector<std::string> inputs;
+};
+
+struct CompileReply {
+  std::string output;
+  std::string diagnostics;
+  uint32_t failed = 0;
+};
+
+// Called from several threads at once, one per connected client.
+using CompileHandler =
+    std::function<void(const CompileRequest &, CompileReply &)>;
+
+// Listens on the Unix domain socket `path` and answers every compile
+// request a client sends with `handler`, until a client asks the server to
+// stop or the process gets SIGINT or SIGTERM. Messages are framed: an
+// 8-byte header with the body size and message type, then the body. A
+// client may send any number of requests over one connection.
+int run_server(const std::string &path, const CompileHandler &handler);
+
+// Sends one request to the server at `path` and prints its reply: output
+// on stdout, diagnostics on stderr. Returns 0 if every input compiled.
+int run_client(const std::string &path, const CompileRequest &request);
+
+// Asks the server at `path` to finish the requests it is serving and exit.
+int stop_server(const std::string &path);
+
+// Opens `clients` connections to the server at `path`, sends `request`
+// over each of them `requests` times, one at a time per connection, and
+// prints the throughput and the p50/p99 round-trip latency.
+int run_server_bench(const std::string &path, const CompileRequest &request,
+                     size_t clients, size_t requests);
@@ -0,0 +1,582 @@
+#include "constant_folder.h"
+#include "keywords.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+constexpr size_t max_arguments = 16;
+
+// Shortest text that reads back as the same float.
+std::string format_float(float value) {
+  char text[32];
+  for (int precision = 1; precision <= 9; ++precision) {
+    snprintf(text, sizeof text, "%.*g", precision, value);
+    if (std::strtof(text, nullptr) == value)
+      break;
+  }
+  return text;
+}
+
+bool is_all(const float *values, uint32_t width, float x) {
+  if (width == 0)
+    return false;
+  for (uint32_t i = 0; i < width; ++i) {
+    if (values[i] != x)
+      return false;
+  }
+  return true;
+}
+
+// Component `i` of a value that may be a scalar used as a vector.
+float at(const float *values, uint32_t width, uint32_t i) {
+  return values[width == 1 ? 0 : i];
+}
+
+float dot(const float *a, const float *b, uint32_t width) {
+  float sum = 0.0f;
+  for (uint32_t i = 0; i < width; ++i)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+} // namespace
+
+ConstantFolder::ConstantFolder(Ast &ast, const ShaderProgram &program,
+                               bool fast_math)
+    : ast(ast), program(program), fast_math(fast_math) {}
+
+size_t ConstantFolder::run() {
+  for (const AstRef &constant : program.constants) {
+    if (constant.ast != &ast)
+      continue;
+    Binding binding{ast[constant.id].value, false, {}};
+    binding.known = fold(ast.child(constant.id, 0), binding.value);
+    globals.push_back(binding);
+  }
+
+  // Overloads of one FunctionDef share its body.
+  std::vector<NodeId> folded;
+  for (uint32_t i = 0; i < program.overloads.size(); ++i) {
+    const AstRef &function = program.overloads[i].function;
+    if (function.ast != &ast || !program.is_emitted(i) ||
+        std::find(folded.begin(), folded.end(), function.id) != folded.end())
+      continue;
+    folded.push_back(function.id);
+    NodeRange children = ast.children(function.id);
+    NodeId params = children[children.size() - 2];
+    NodeId body = children[children.size() - 1];
+    for (NodeId param : ast.children(params))
+      scope.push_back({ast[param].value, false, {}});
+    Constant value;
+    fold(body, value);
+    scope.clear();
+  }
+
+  for (const AstRef &entry : program.entries) {
+    Constant value;
+    fold(ast.child(entry.id, 0), value);
+    scope.clear();
+  }
+  return rewrites;
+}
+
+bool ConstantFolder::fold(NodeId id, Constant &value) {
+  const ASTNode &node = ast[id];
+  switch (node.type) {
+  case NodeType::NumberLiteral:
+    value.width = 1;
+    value.values[0] = std::strtof(symbol_text(node.value).data(), nullptr);
+    return true;
+  case NodeType::Identifier:
+    return lookup(node.value, value);
+  case NodeType::UnaryOp:
+    if (!fold(ast.child(id, 0), value))
+      return false;
+    for (uint32_t i = 0; i < value.width; ++i)
+      value.values[i] = -value.values[i];
+    return replace(id, value);
+  case NodeType::FieldAccess:
+    return fold_member(id, ast.child(id, 0), node.value, value);
+  case NodeType::BinOp:
+    return fold_binary(id, value);
+  case NodeType::FunctionApplication:
+    return fold_call(id, value);
+  case NodeType::LetInExpr:
+    fold_lets(id);
+    return false;
+  default:
+    return false;
+  }
+}
+
+void ConstantFolder::fold_lets(NodeId id) {
+  // Bindings come into scope in the order backends hoist them.
+  for (uint32_t i = 0; i < ast[id].child_count; ++i) {
+    NodeId child = ast.child(id, i);
+    Constant value;
+    if (ast[child].type == NodeType::LetBinding) {
+      Binding binding{ast[child].value, false, {}};
+      binding.known = fold(ast.child(child, 0), binding.value);
+      scope.push_back(binding);
+    } else if (ast[child].type != NodeType::Input) {
+      fold(child, value);
+    }
+  }
+}
+
+bool ConstantFolder::lookup(Symbol name, Constant &value) const {
+  for (const std::vector<Binding> *bindings : {&scope, &globals}) {
+    for (auto it = bindings->rbegin(); it != bindings->rend(); ++it) {
+      if (it->name != name)
+        continue;
+      value = it->value;
+      return it->known;
+    }
+  }
+  return false;
+}
+
+bool ConstantFolder::fold_binary(NodeId id, Constant &value) {
+  std::string_view name = symbol_text(ast[id].value);
+  NodeId lhs = ast.child(id, 0);
+  NodeId rhs = ast.child(id, 1);
+  if (name == "Dot")
+    return fold_member(id, lhs, ast[rhs].value, value);
+
+  Constant l, r;
+  bool left = fold(lhs, l);
+  bool right = fold(rhs, r);
+  bool multiply = name == "Multiply", divide = name == "Divide";
+  bool plus = name == "Plus", minus = name == "Minus";
+  if (!multiply && !divide && !plus && !minus)
+    return false;
+
+  if (left && right) {
+    if (l.width != r.width && l.width != 1 && r.width != 1)
+      return false;
+    value.width = std::max(l.width, r.width);
+    for (uint32_t i = 0; i < value.width; ++i) {
+      float a = at(l.values, l.width, i), b = at(r.values, r.width, i);
+      value.values[i] = multiply ? a * b
+                        : divide ? a / b
+                        : plus   ? a + b
+                                 : a - b;
+    }
+    return replace(id, value);
+  }
+
+  // Identities only apply where the result has the kept operand's type,
+  // e.g. not to `s * vec3 1.0` with a float s.
+  Symbol type = program.checker.type_of(ast, id);
+  if (type == NoSymbol)
+    return false;
+  auto keeps = [&](NodeId operand) {
+    return program.checker.type_of(ast, operand) == type;
+  };
+  bool one_right = right && is_all(r.values, r.width, 1.0f);
+  bool zero_right = right && is_all(r.values, r.width, 0.0f);
+  bool one_left = left && is_all(l.values, l.width, 1.0f);
+  bool zero_left = left && is_all(l.values, l.width, 0.0f);
+
+  // GLSL does not keep the sign of zero, so x + 0 counts as exact.
+  if (((multiply || divide) && one_right) || ((plus || minus) && zero_right)) {
+    if (keeps(lhs)) {
+      replace(id, lhs);
+      return false;
+    }
+  }
+  if ((multiply && one_left) || (plus && zero_left)) {
+    if (keeps(rhs)) {
+      replace(id, rhs);
+      return false;
+    }
+  }
+
+  TypeShape shape = shape_of(symbol_text(type));
+  if (fast_math && shape.scalar == "float" &&
+      ((multiply && (zero_left || zero_right)) || (divide && zero_left))) {
+    value.width = shape.width;
+    std::fill(value.values, value.values + value.width, 0.0f);
+    return replace(id, value);
+  }
+
+  // x / c = x * (1 / c), which is exact when every 1 / c is a power of two.
+  if (divide && right) {
+    Constant reciprocal = r;
+    bool exact = true;
+    for (uint32_t i = 0; i < r.width; ++i) {
+      int exponent;
+      reciprocal.values[i] = 1.0f / r.values[i];
+      exact &= std::isnormal(reciprocal.values[i]) &&
+               std::frexp(reciprocal.values[i], &exponent) == 0.5f;
+    }
+    NodeId node = exact || fast_math ? materialize(rhs, reciprocal) : NoNode;
+    if (node != NoNode) {
+      replace(rhs, node);
+      ast[id].value = intern("Multiply");
+    }
+  }
+  return false;
+}
+
+bool ConstantFolder::fold_member(NodeId id, NodeId base, Symbol field,
+                                 Constant &value) {
+  Constant vector;
+  if (!fold(base, vector) || vector.width < 2)
+    return false;
+  std::string_view name = symbol_text(field);
+  if (name.empty() || name.size() > 4)
+    return false;
+  value.width = static_cast<uint32_t>(name.size());
+  for (size_t i = 0; i < name.size(); ++i) {
+    int index = swizzle_index(name[i]);
+    if (index < 0 || static_cast<uint32_t>(index) >= vector.width)
+      return false;
+    value.values[i] = vector.values[index];
+  }
+  return replace(id, value);
+}
+
+bool ConstantFolder::fold_call(NodeId id, Constant &value) {
+  NodeId args[max_arguments];
+  size_t count = 0;
+  NodeId head = id;
+  while (ast[head].type == NodeType::FunctionApplication &&
+         count < max_arguments) {
+    args[count++] = ast.child(head, 1);
+    head = ast.child(head, 0);
+  }
+  std::reverse(args, args + count);
+  Constant constants[max_arguments];
+  bool known = true;
+  for (size_t i = 0; i < count; ++i)
+    known &= fold(args[i], constants[i]);
+  if (ast[head].type != NodeType::Identifier || count == 0)
+    return false;
+  std::string_view name = symbol_text(ast[head].value);
+
+  TypeShape shape = shape_of(name);
+  if (shape.scalar == "float" && shape.width > 1 && is_builtin_type(name))
+    return fold_constructor(id, head, args, constants, count, known, value);
+
+  // A function the program defines hides the builtin of the same name.
+  const BuiltinFunction *builtin = find_builtin_function(name);
+  if (!builtin || program.types.count(ast[head].value) ||
+      program.function_overloads.count(ast[head].value))
+    return false;
+  if (known)
+    return evaluate(builtin->name, constants, count, value) &&
+           replace(id, value);
+
+  // pow with an exponent of 1 or 2 (which GLSL leaves undefined for a
+  // negative base) is cheaper as the base itself or a multiplication.
+  if (name == "pow" && count == 2 && constants[1].width == 1 &&
+      is_float_type(program.checker.type_of(ast, args[0]), 0) &&
+      program.checker.type_of(ast, args[0]) ==
+          program.checker.type_of(ast, id)) {
+    NodeId base = args[0];
+    if (constants[1].values[0] == 1.0f) {
+      replace(id, base);
+    } else if (constants[1].values[0] == 2.0f &&
+               ast[base].type == NodeType::Identifier) {
+      ast.set_location(ast.offset_of(id));
+      NodeId square = ast.add(NodeType::BinOp, "Multiply",
+                              {base, ast.add(NodeType::Identifier,
+                                             ast[base].value)});
+      replace(id, square);
+    }
+  }
+  return false;
+}
+
+bool ConstantFolder::fold_constructor(NodeId id, NodeId head,
+                                      const NodeId *args,
+                                      const Constant *constants, size_t count,
+                                      bool known, Constant &value) {
+  Symbol type = ast[head].value;
+  uint32_t width = shape_of(symbol_text(type)).width;
+  if (known) {
+    value.width = width;
+    if (count == 1 && constants[0].width == 1) {
+      std::fill(value.values, value.values + width, constants[0].values[0]);
+      return replace(id, value);
+    }
+    uint32_t filled = 0;
+    for (size_t i = 0; i < count; ++i) {
+      // Only the last argument may have components left over.
+      if (filled == width)
+        return false;
+      for (uint32_t c = 0; c < constants[i].width && filled < width; ++c)
+        value.values[filled++] = constants[i].values[c];
+    }
+    return filled == width && replace(id, value);
+  }
+
+  if (count == 1 && program.checker.type_of(ast, args[0]) == type) {
+    replace(id, args[0]);
+    return false;
+  }
+  // vec4 (vec3 x y z) w = vec4 x y z w
+  std::vector<NodeId> flat;
+  bool flattened = false;
+  for (size_t i = 0; i < count; ++i) {
+    NodeId inner[max_arguments];
+    size_t inner_count = 0;
+    NodeId inner_head = args[i];
+    while (ast[inner_head].type == NodeType::FunctionApplication &&
+           inner_count < max_arguments) {
+      inner[inner_count++] = ast.child(inner_head, 1);
+      inner_head = ast.child(inner_head, 0);
+    }
+    uint32_t inner_width = 0, components = 0;
+    if (inner_count != 0 && ast[inner_head].type == NodeType::Identifier &&
+        is_float_type(ast[inner_head].value, 0)) {
+      inner_width = shape_of(symbol_text(ast[inner_head].value)).width;
+      for (size_t j = 0; j < inner_count; ++j) {
+        uint32_t arg_width = float_width(inner[j]);
+        components = arg_width && components != UINT32_MAX
+                         ? components + arg_width
+                         : UINT32_MAX;
+      }
+    }
+    if (inner_width > 1 && components == inner_width) {
+      flat.insert(flat.end(), std::make_reverse_iterator(inner + inner_count),
+                  std::make_reverse_iterator(inner));
+      flattened = true;
+    } else {
+      flat.push_back(args[i]);
+    }
+  }
+  if (!flattened)
+    return false;
+  ast.set_location(ast.offset_of(id));
+  NodeId call = ast.add(NodeType::Identifier, type);
+  for (NodeId arg : flat)
+    call = ast.add(NodeType::FunctionApplication, "", {call, arg});
+  replace(id, call);
+  return false;
+}
+
+bool ConstantFolder::evaluate(std::string_view name, const Constant *args,
+                              size_t count, Constant &value) {
+  const BuiltinFunction *builtin = find_builtin_function(name);
+  // Float results take no broadcasting; the others follow one argument.
+  uint32_t width = 1;
+  if (builtin->result == BuiltinResult::FirstArg)
+    width = args[0].width;
+  else if (builtin->result == BuiltinResult::LastArg)
+    width = args[count - 1].width;
+  else if (builtin->result != BuiltinResult::Float)
+    return false;
+  for (size_t i = 0; i < count && builtin->result != BuiltinResult::Float;
+       ++i) {
+    if (args[i].width != width && args[i].width != 1)
+      return false;
+  }
+  value.width = width;
+  float *out = value.values;
+  const float *a = args[0].values;
+  const float *b = count > 1 ? args[1].values : nullptr;
+  const float *c = count > 2 ? args[2].values : nullptr;
+  uint32_t aw = args[0].width, bw = count > 1 ? args[1].width : 0,
+           cw = count > 2 ? args[2].width : 0;
+
+  if (name == "dot" || name == "length" || name == "distance") {
+    float difference[4];
+    if (name == "distance") {
+      if (count != 2 || aw != bw)
+        return false;
+      for (uint32_t i = 0; i < aw; ++i)
+        difference[i] = a[i] - b[i];
+      a = difference;
+    }
+    if (name == "dot") {
+      if (count != 2 || aw != bw)
+        return false;
+      out[0] = dot(a, b, aw);
+    } else {
+      if (count != (name == "distance" ? 2u : 1u))
+        return false;
+      out[0] = std::sqrt(dot(a, a, aw));
+    }
+    return true;
+  }
+  if (name == "normalize" || name == "cross" || name == "reflect") {
+    if (name == "normalize") {
+      float length = std::sqrt(dot(a, a, aw));
+      for (uint32_t i = 0; i < aw && count == 1; ++i)
+        out[i] = a[i] / length;
+      return count == 1;
+    }
+    if (count != 2 || aw != bw)
+      return false;
+    if (name == "cross") {
+      if (aw != 3)
+        return false;
+      out[0] = a[1] * b[2] - a[2] * b[1];
+      out[1] = a[2] * b[0] - a[0] * b[2];
+      out[2] = a[0] * b[1] - a[1] * b[0];
+      return true;
+    }
+    float d = dot(a, b, aw);
+    for (uint32_t i = 0; i < aw; ++i)
+      out[i] = a[i] - 2.0f * d * b[i];
+    return true;
+  }
+
+  for (uint32_t i = 0; i < width; ++i) {
+    float x = at(a, aw, i);
+    float y = b ? at(b, bw, i) : 0.0f;
+    float z = c ? at(c, cw, i) : 0.0f;
+    if (count == 1) {
+      if (name == "abs")
+        out[i] = std::fabs(x);
+      else if (name == "sign")
+        out[i] = x > 0.0f ? 1.0f : x < 0.0f ? -1.0f : 0.0f;
+      else if (name == "floor")
+        out[i] = std::floor(x);
+      else if (name == "ceil")
+        out[i] = std::ceil(x);
+      else if (name == "fract")
+        out[i] = x - std::floor(x);
+      else if (name == "sqrt")
+        out[i] = std::sqrt(x);
+      else if (name == "inversesqrt")
+        out[i] = 1.0f / std::sqrt(x);
+      else if (name == "exp")
+        out[i] = std::exp(x);
+      else if (name == "exp2")
+        out[i] = std::exp2(x);
+      else if (name == "log")
+        out[i] = std::log(x);
+      else if (name == "log2")
+        out[i] = std::log2(x);
+      else if (name == "sin")
+        out[i] = std::sin(x);
+      else if (name == "cos")
+        out[i] = std::cos(x);
+      else if (name == "tan")
+        out[i] = std::tan(x);
+      else if (name == "asin")
+        out[i] = std::asin(x);
+      else if (name == "acos")
+        out[i] = std::acos(x);
+      else if (name == "atan")
+        out[i] = std::atan(x);
+      else if (name == "radians")
+        out[i] = x * 0.017453292519943295f;
+      else if (name == "degrees")
+        out[i] = x * 57.295779513082323f;
+      else
+        return false;
+    } else if (count == 2) {
+      if (name == "pow") {
+        // Undefined in GLSL for these, so left to the driver.
+        if (x < 0.0f || (x == 0.0f && y <= 0.0f))
+          return false;
+        out[i] = std::pow(x, y);
+      } else if (name == "min") {
+        out[i] = std::min(x, y);
+      } else if (name == "max") {
+        out[i] = std::max(x, y);
+      } else if (name == "mod") {
+        out[i] = x - y * std::floor(x / y);
+      } else if (name == "step") {
+        out[i] = y < x ? 0.0f : 1.0f;
+      } else if (name == "atan") {
+        out[i] = std::atan2(x, y);
+      } else {
+        return false;
+      }
+    } else if (count == 3) {
+      if (name == "clamp") {
+        if (y > z)
+          return false;
+        out[i] = std::min(std::max(x, y), z);
+      } else if (name == "mix") {
+        out[i] = x * (1.0f - z) + y * z;
+      } else if (name == "smoothstep") {
+        if (x >= y)
+          return false;
+        float t = std::min(std::max((z - x) / (y - x), 0.0f), 1.0f);
+        out[i] = t * t * (3.0f - 2.0f * t);
+      } else {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t ConstantFolder::float_width(NodeId id) const {
+  // Literals made by this pass are not in the checker's tables.
+  if (ast[id].type == NodeType::NumberLiteral)
+    return 1;
+  Symbol type = program.checker.type_of(ast, id);
+  return is_float_type(type, 0) ? shape_of(symbol_text(type)).width : 0;
+}
+
+bool ConstantFolder::is_float_type(Symbol type, uint32_t width) const {
+  if (type == NoSymbol)
+    return false;
+  TypeShape shape = shape_of(symbol_text(type));
+  return shape.scalar == "float" && (width == 0 || shape.width == width);
+}
+
+bool ConstantFolder::is_literal(NodeId id) const {
+  if (ast[id].type == NodeType::NumberLiteral)
+    return true;
+  if (ast[id].type != NodeType::FunctionApplication)
+    return false;
+  while (ast[id].type == NodeType::FunctionApplication) {
+    if (ast[ast.child(id, 1)].type != NodeType::NumberLiteral)
+      return false;
+    id = ast.child(id, 0);
+  }
+  return ast[id].type == NodeType::Identifier &&
+         is_builtin_type(symbol_text(ast[id].value)) &&
+         is_float_type(ast[id].value, 0);
+}
+
+NodeId ConstantFolder::materialize(NodeId at, const Constant &value) {
+  if (value.width == 0)
+    return NoNode;
+  for (uint32_t i = 0; i < value.width; ++i) {
+    if (!std::isfinite(value.values[i]))
+      return NoNode;
+  }
+  ast.set_location(ast.offset_of(at));
+  auto literal = [&](float x) {
+    return ast.add(NodeType::NumberLiteral, format_float(x));
+  };
+  if (value.width == 1)
+    return literal(value.values[0]);
+  NodeId node =
+      ast.add(NodeType::Identifier, shaped_type("float", value.width));
+  bool splat = is_all(value.values, value.width, value.values[0]);
+  for (uint32_t i = 0; i < (splat ? 1 : value.width); ++i)
+    node = ast.add(NodeType::FunctionApplication, "",
+                   {node, literal(value.values[i])});
+  return node;
+}
+
+bool ConstantFolder::replace(NodeId id, const Constant &value) {
+  if (value.width != 0 && is_literal(id))
+    return true;
+  NodeId node = materialize(id, value);
+  if (node == NoNode)
+    return false;
+  replace(id, node);
+  return true;
+}
+
+void ConstantFolder::replace(NodeId id, NodeId with) {
+  ast[id] = ast[with];
+  rewrites++;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "ast_node.h"
+#include "shader_program.h"
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Rewrites expressions of the main file in place: arithmetic and builtin
+// calls on constant floats and float vectors become literals (or a vector
+// constructor of literals), constructors nested in vector constructors are
+// flattened, and exact identities such as x * 1 and x / 2 = x * 0.5 are
+// applied where the checker knows the result keeps the operand's type.
+// Top-level constants and let bindings with constant values propagate into
+// the expressions that use them.
+class ConstantFolder {
+public:
+  // `program` must have type-checked `ast`, including its entry points.
+  // With `fast_math`, identities that do not hold for NaN or infinity
+  // (x * 0 = 0) and inexact reciprocals are used as well.
+  ConstantFolder(Ast &ast, const ShaderProgram &program, bool fast_math);
+
+  // Returns the number of nodes rewritten.
+  size_t run();
+
+private:
+  struct Constant {
+    uint32_t width = 0;
+    float values[4] = {};
+  };
+
+  bool fold(NodeId id, Constant &value);
+  bool fold_binary(NodeId id, Constant &value);
+  bool fold_call(NodeId id, Constant &value);
+  bool fold_member(NodeId id, NodeId base, Symbol field, Constant &value);
+  bool fold_constructor(NodeId id, NodeId head, const NodeId *args,
+                        const Constant *constants, size_t count, bool known,
+                        Constant &value);
+  // Value of builtin `name` applied to constants, if GLSL defines it.
+  static bool evaluate(std::string_view name, const Constant *args,
+                       size_t count, Constant &value);
+  void fold_lets(NodeId id);
+  bool lookup(Symbol name, Constant &value) const;
+
+  // A new literal or constructor of literals for `value`, located at `at`;
+  // NoNode for values that are not finite.
+  NodeId materialize(NodeId at, const Constant &value);
+  // Makes `id` a literal or constructor for `value`, unless it already is
+  // one. Fails for values that are not finite.
+  bool replace(NodeId id, const Constant &value);
+  // Makes `id` a copy of node `with`.
+  void replace(NodeId id, NodeId with);
+  bool is_literal(NodeId id) const;
+  // Width of a float scalar or vector expression, 0 for other types.
+  uint32_t float_width(NodeId id) const;
+  // Float scalar or vector type, of any width if `width` is 0.
+  bool is_float_type(Symbol type, uint32_t width) const;
+
+  Ast &ast;
+  const ShaderProgram &program;
+  bool fast_math;
+  size_t rewrites = 0;
+
+  // Let bindings and parameters in scope, in hoisting order; `known` is
+  // false for ones without a constant value.
+  struct Binding {
+    Symbol name;
+    bool known;
+    Constant value;
+  };
+  std::vector<Binding> scope;
+  std::vector<Binding> globals;
+};
@@ -0,0 +1,157 @@
+#include "dead_code_eliminator.h"
+#include <algorithm>
+#include <vector>
+
+DeadCodeEliminator::DeadCodeEliminator(Ast &ast, NodeId root,
+                                       const ShaderProgram &program)
+    : ast(ast), root(root), program(program) {}
+
+size_t DeadCodeEliminator::run() {
+  // Overloads of one FunctionDef share its body.
+  std::vector<NodeId> done;
+  for (uint32_t i = 0; i < program.overloads.size(); ++i) {
+    const AstRef &function = program.overloads[i].function;
+    if (function.ast != &ast || !program.is_emitted(i) ||
+        std::find(done.begin(), done.end(), function.id) != done.end())
+      continue;
+    done.push_back(function.id);
+    NodeRange range = ast.children(function.id);
+    std::vector<NodeId> children(range.begin(), range.end());
+    NodeId body = remove_dead_lets(children.back());
+    if (body != children.back()) {
+      children.back() = body;
+      ast.set_children(function.id, children.data(), children.size());
+    }
+  }
+  for (const AstRef &entry : program.entries) {
+    NodeId body = ast.child(entry.id, 0);
+    // A vertex stage's position is written out, not read.
+    bool vertex = ast[entry.id].value == program.vertex;
+    NodeId live =
+        remove_dead_lets(body, vertex ? program.clip_position : NoSymbol);
+    if (live != body)
+      ast.set_children(entry.id, &live, 1);
+  }
+  if (program.entries.empty())
+    return removed;
+
+  StageUsage usage;
+  usage.overloads.assign(program.overloads.size(), false);
+  usage.constants.assign(program.constants.size(), false);
+  for (const AstRef &entry : program.entries) {
+    StageUsage stage = program.usage(entry);
+    for (size_t i = 0; i < stage.overloads.size(); ++i)
+      usage.overloads[i] = usage.overloads[i] || stage.overloads[i];
+    for (size_t i = 0; i < stage.constants.size(); ++i)
+      usage.constants[i] = usage.constants[i] || stage.constants[i];
+    usage.names.insert(stage.names.begin(), stage.names.end());
+  }
+
+  std::vector<NodeId> kept;
+  for (NodeId id : ast.children(root)) {
+    if (ast[id].type == NodeType::Input)
+      remove_unused_fields(id, usage.names);
+    if (is_used(id, usage))
+      kept.push_back(id);
+    else
+      removed++;
+  }
+  ast.set_children(root, kept.data(), kept.size());
+  return removed;
+}
+
+NodeId DeadCodeEliminator::remove_dead_lets(NodeId id, Symbol keep) {
+  NodeRange range = ast.children(id);
+  std::vector<NodeId> children(range.begin(), range.end());
+  bool changed = false;
+  for (NodeId &child : children) {
+    NodeId live = remove_dead_lets(child);
+    changed |= live != child;
+    child = live;
+  }
+
+  if (ast[id].type == NodeType::LetInExpr) {
+    // Dropping one binding can leave another unread, so repeat until
+    // every binding left is read by a sibling.
+    for (bool again = true; again;) {
+      again = false;
+      for (size_t i = 0; i + 1 < children.size(); ++i) {
+        if (ast[children[i]].type != NodeType::LetBinding ||
+            ast[children[i]].value == keep)
+          continue;
+        bool read = false;
+        for (size_t j = 0; j < children.size() && !read; ++j)
+          read = j != i &&
+                 count_reads(ast, children[j], ast[children[i]].value) != 0;
+        if (read)
+          continue;
+        children.erase(children.begin() + i);
+        removed++;
+        changed = again = true;
+        break;
+      }
+    }
+    if (children.size() == 1 && ast[children[0]].type != NodeType::Input)
+      return children[0];
+  }
+  if (changed) {
+    ast.set_children(id, children.data(), children.size());
+    if (ast[id].type == NodeType::LetInExpr)
+      ast[id].value = ast[children[0]].value;
+  }
+  return id;
+}
+
+void DeadCodeEliminator::remove_unused_fields(
+    NodeId input, const std::unordered_set<Symbol> &used) {
+  std::vector<NodeId> kept;
+  for (NodeId field : ast.children(input)) {
+    if (ast[field].type == NodeType::Uniform) {
+      std::vector<NodeId> uniforms;
+      for (NodeId uniform : ast.children(field)) {
+        if (used.count(ast[uniform].value))
+          uniforms.push_back(uniform);
+        else
+          removed++;
+      }
+      ast.set_children(field, uniforms.data(), uniforms.size());
+      if (!uniforms.empty())
+        kept.push_back(field);
+    } else if (ast[field].type == NodeType::Field &&
+               ast[field].child_count != 0 && !used.count(ast[field].value)) {
+      removed++;
+    } else {
+      kept.push_back(field);
+    }
+  }
+  ast.set_children(input, kept.data(), kept.size());
+}
+
+bool DeadCodeEliminator::is_used(NodeId declaration,
+                                 const StageUsage &usage) const {
+  const ASTNode &node = ast[declaration];
+  if (node.internal)
+    return true;
+  if (node.type == NodeType::Let) {
+    for (size_t i = 0; i < program.constants.size(); ++i) {
+      const AstRef &constant = program.constants[i];
+      if (constant.ast == &ast && constant.id == declaration)
+        return usage.constants[i];
+    }
+    return true;
+  }
+  if (node.type != NodeType::FunctionDef)
+    return true;
+  // Functions without a concrete signature are never emitted, and keep
+  // the warning that says so.
+  bool any = false;
+  for (uint32_t i = 0; i < program.overloads.size(); ++i) {
+    const AstRef &function = program.overloads[i].function;
+    if (function.ast != &ast || function.id != declaration)
+      continue;
+    if (usage.overloads[i] || !program.is_emitted(i))
+      return true;
+    any = true;
+  }
+  return !any;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "ast_node.h"
+#include "shader_program.h"
+#include <cstdint>
+#include <unordered_set>
+
+// Removes what the main file's entry points can do without: let bindings
+// whose value is never read, functions and top-level constants that no
+// stage reaches, and vertex attributes, uniforms and fragment inputs that
+// no stage reads. A file without entry points is a library and only loses
+// dead let bindings. Included modules are shared and left as they are; the
+// backends skip the declarations of theirs that a stage does not use.
+class DeadCodeEliminator {
+public:
+  // `program` must have type-checked `ast`, including its entry points.
+  DeadCodeEliminator(Ast &ast, NodeId root, const ShaderProgram &program);
+
+  // Returns the number of bindings and declarations removed.
+  size_t run();
+
+private:
+  // Returns the node to use in place of `id`: a let expression left with
+  // no bindings becomes its result. A binding of `id` named `keep` stays.
+  NodeId remove_dead_lets(NodeId id, Symbol keep = NoSymbol);
+  void remove_unused_fields(NodeId input,
+                            const std::unordered_set<Symbol> &used);
+  bool is_used(NodeId declaration, const StageUsage &usage) const;
+
+  Ast &ast;
+  NodeId root;
+  const ShaderProgram &program;
+  size_t removed = 0;
+};
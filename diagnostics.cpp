@@ -0,0 +1,106 @@
+#include "diagnostics.h"
+
+#include <cstdarg>
+
+namespace {
+const char *severity_name(Severity severity) {
+  switch (severity) {
+  case Severity::Error:
+    return "error";
+  case Severity::Warning:
+    return "warning";
+  case Severity::Note:
+    return "note";
+  }
+  return "error";
+}
+} // namespace
+
+SourceSpan locate(const char *source, uint32_t offset, uint32_t length) {
+  SourceSpan span{offset, length, 1, 1};
+  if (!source)
+    return SourceSpan{offset, length, 0, 0};
+  for (uint32_t i = 0; i < offset && source[i]; ++i) {
+    if (source[i] == '\n') {
+      span.line++;
+      span.column = 1;
+    } else {
+      span.column++;
+    }
+  }
+  return span;
+}
+
+void Diagnostics::report(Severity severity, SourceSpan span,
+                         const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vreport(severity, span, format, args);
+  va_end(args);
+}
+
+void Diagnostics::vreport(Severity severity, SourceSpan span,
+                          const char *format, va_list args) {
+  va_list measure;
+  va_copy(measure, args);
+  int length = vsnprintf(nullptr, 0, format, measure);
+  va_end(measure);
+  char *message = static_cast<char *>(text.allocate(length + 1, 1));
+  vsnprintf(message, length + 1, format, args);
+
+  entries.push_back(Diagnostic{severity, span, {message, size_t(length)}});
+  if (severity == Severity::Error)
+    errors++;
+}
+
+void Diagnostics::append(const Diagnostics &other) {
+  for (const Diagnostic &d : other.entries) {
+    report(d.severity, d.span, "%.*s", static_cast<int>(d.message.size()),
+           d.message.data());
+  }
+}
+
+void Diagnostics::clear() {
+  entries.clear();
+  errors = 0;
+  text.reset();
+}
+
+void Diagnostics::print(FILE *stream, const char *path,
+                        const char *source) const {
+  std::string out;
+  format(out, path, source);
+  fwrite(out.data(), 1, out.size(), stream);
+}
+
+void Diagnostics::format(std::string &out, const char *path,
+                         const char *source) const {
+  for (const Diagnostic &d : entries) {
+    char header[64];
+    int length = snprintf(header, sizeof(header), ":%u:%u: %s: ", d.span.line,
+                          d.span.column, severity_name(d.severity));
+    out += path;
+    out.append(header, length);
+    out += d.message;
+    out += '\n';
+    if (!source || d.span.line == 0)
+      continue;
+
+    const char *line = source + d.span.offset;
+    while (line > source && line[-1] != '\n')
+      line--;
+    const char *eol = line;
+    while (*eol && *eol != '\n' && *eol != '\r')
+      eol++;
+    out += "  ";
+    out.append(line, eol - line);
+    out += "\n  ";
+    for (const char *p = line; p < source + d.span.offset; ++p)
+      out += *p == '\t' ? '\t' : ' ';
+    uint32_t width = d.span.length ? d.span.length : 1;
+    out += '^';
+    for (uint32_t i = 1; i < width && source[d.span.offset + i] != '\n'; ++i)
+      out += '~';
+    out += '\n';
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "arena.h"
+#include "token.h"
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct SourceSpan {
+  uint32_t offset = 0;
+  uint32_t length = 0;
+  uint32_t line = 0;
+  uint32_t column = 0;
+};
+
+inline SourceSpan span_of(const Token &token) {
+  return SourceSpan{token.offset, token.length, token.line, token.column};
+}
+
+// Span of `length` bytes at `offset` in a NUL-terminated source, with the
+// line and column worked out by scanning from the start. Meant for the
+// error path of passes that only keep offsets.
+SourceSpan locate(const char *source, uint32_t offset, uint32_t length = 0);
+
+enum class Severity : uint8_t { Error, Warning, Note };
+
+struct Diagnostic {
+  Severity severity;
+  SourceSpan span;
+  std::string_view message;
+};
+
+// Problems found while compiling one source, in the order they were
+// reported. Message text is kept in an arena owned by the list.
+class Diagnostics {
+public:
+#if defined(__GNUC__) || defined(__clang__)
+  __attribute__((format(printf, 4, 5)))
+#endif
+  void report(Severity severity, SourceSpan span, const char *format, ...);
+  void vreport(Severity severity, SourceSpan span, const char *format,
+               va_list args);
+
+  // Copies every diagnostic of `other` to the end of this list.
+  void append(const Diagnostics &other);
+
+  const std::vector<Diagnostic> &all() const { return entries; }
+  size_t error_count() const { return errors; }
+  bool empty() const { return entries.empty(); }
+  void clear();
+
+  // Prints "path:line:column: error: message" followed by the offending
+  // source line and a caret under the span.
+  void print(FILE *stream, const char *path, const char *source) const;
+  // Same as print, appending to `out`.
+  void format(std::string &out, const char *path, const char *source) const;
+
+private:
+  std::vector<Diagnostic> entries;
+  size_t errors = 0;
+  Arena text{4096};
+};
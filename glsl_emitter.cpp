@@ -0,0 +1,433 @@
+#include "glsl_emitter.h"
+#include "keywords.h"
+#include <algorithm>
+
+namespace {
+
+const char *binary_operator(std::string_view name) {
+  if (name == "Plus")
+    return " + ";
+  if (name == "Minus")
+    return " - ";
+  if (name == "Multiply")
+    return " * ";
+  if (name == "Divide")
+    return " / ";
+  if (name == "Equality")
+    return " == ";
+  if (name == "LessThan")
+    return " < ";
+  if (name == "GreaterThan")
+    return " > ";
+  if (name == "LessOrEqualsThan")
+    return " <= ";
+  if (name == "GreaterOrEqualsThan")
+    return " >= ";
+  return nullptr;
+}
+
+constexpr size_t max_arguments = 16;
+
+} // namespace
+
+GlslEmitter::GlslEmitter(TextBuffer &out, Diagnostics &diagnostics,
+                         GlslOptions options)
+    : out(out), diagnostics(diagnostics), options(options) {}
+
+std::vector<EmittedShader>
+GlslEmitter::emit(ShaderProgram &shader_program,
+                  const std::vector<StageInfo> &stages,
+                  const VaryingLayout &linked) {
+  varyings = linked;
+  program = &shader_program;
+  std::vector<EmittedShader> shaders;
+  for (const StageInfo &info : stages) {
+    size_t begin = out.size();
+    emit_stage(info);
+    shaders.push_back({info.stage, begin, out.size()});
+  }
+  program = nullptr;
+  return shaders;
+}
+
+void GlslEmitter::emit_stage(const StageInfo &info) {
+  const Ast &ast = *info.entry.ast;
+  out << "#version " << options.version << (options.es ? " es\n" : " core\n");
+  if (options.es)
+    out << "precision highp float;\n";
+  out << '\n';
+  StageUsage usage;
+  if (options.strip_unused)
+    usage = program->usage(info.entry);
+  emit_prelude(options.strip_unused ? &usage : nullptr);
+
+  program->stage = info.stage;
+  VertexLayout attributes = layout_vertex(*program);
+  bool octahedral = false;
+  if (info.stage == program->vertex) {
+    for (const AttributeLayout &attribute : attributes.attributes) {
+      out << "layout(location = " << attribute.location << ") in "
+          << symbol_text(input_type(attribute)) << ' ';
+      if (attribute.format == AttributeFormat::Octahedral) {
+        octahedral = true;
+        out << "hgl_";
+      }
+      out << symbol_text(attribute.name) << ";\n";
+    }
+    const VaryingSlots *slots = varyings.find(info.varying);
+    if (slots && slots->packed) {
+      for (uint32_t k = 0; k < slots->count; ++k)
+        out << location(slots->location + k) << "out "
+            << symbol_text(shaped_type("float", slots->widths[k])) << ' '
+            << packed_name(slots->location + k) << ";\n";
+    } else if (info.varying != NoSymbol) {
+      out << location(slots ? slots->location : 0) << "out "
+          << symbol_text(info.result_type) << ' '
+          << symbol_text(info.varying) << ";\n";
+    }
+  } else {
+    // Varyings keep the locations the vertex stage gave them; other
+    // fragment inputs come after, as they do for SPIR-V.
+    uint32_t next = varyings.locations;
+    for (const ShaderVariable &input : program->fragment_inputs) {
+      const VaryingSlots *slots = varyings.find(input.name);
+      if (slots && slots->packed)
+        continue;
+      out << location(slots ? slots->location : next) << "in "
+          << symbol_text(input.type) << ' ' << symbol_text(input.name)
+          << ";\n";
+      if (!slots)
+        next += location_count(*program, input.type);
+    }
+    for (const VaryingSlots &slots : varyings.varyings) {
+      bool declared = false;
+      for (const ShaderVariable &other : program->fragment_inputs)
+        declared |= other.name == slots.name;
+      if (slots.packed) {
+        for (uint32_t k = 0; k < slots.count; ++k)
+          out << location(slots.location + k) << "in "
+              << symbol_text(shaped_type("float", slots.widths[k])) << ' '
+              << packed_name(slots.location + k) << ";\n";
+      } else if (!declared) {
+        out << location(slots.location) << "in " << symbol_text(slots.type)
+            << ' ' << symbol_text(slots.name) << ";\n";
+      }
+    }
+    out << "layout(location = 0) out vec4 out_color;\n";
+  }
+
+  if (octahedral)
+    out << "\nvec3 hgl_octahedral(vec2 e) {\n"
+           "    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+           "    float t = max(-n.z, 0.0);\n"
+           "    n.xy -= t * (step(vec2(0.0), n.xy) * 2.0 - 1.0);\n"
+           "    return normalize(n);\n"
+           "}\n";
+
+  out << "\nvoid main() {\n";
+  if (octahedral) {
+    // Decoded into a local of the attribute's name.
+    for (const AttributeLayout &attribute : attributes.attributes) {
+      if (attribute.format != AttributeFormat::Octahedral)
+        continue;
+      out.indent(1);
+      out << "vec3 " << symbol_text(attribute.name) << " = hgl_octahedral(hgl_"
+          << symbol_text(attribute.name) << ");\n";
+    }
+  }
+  const VaryingSlots *packed = nullptr;
+  if (info.stage == program->vertex) {
+    packed = varyings.find(info.varying);
+    if (packed && !packed->packed)
+      packed = nullptr;
+  } else {
+    for (const VaryingSlots &slots : varyings.varyings) {
+      if (slots.packed)
+        emit_unpack(slots);
+    }
+  }
+  // A packed varying is bound to a local and copied out afterwards.
+  varying_binding = packed ? NoSymbol : info.varying;
+  emit_bindings(ast, info.body, 1);
+  if (packed)
+    emit_pack(*packed);
+  TypeShape shape = shape_of(symbol_text(info.result_type));
+  if (info.stage == program->vertex && info.varying == NoSymbol) {
+    out << "    gl_Position = ";
+    emit_expr(ast, info.result);
+    out << ";\n";
+  } else if (info.stage == program->vertex) {
+    out << "    gl_Position = " << symbol_text(program->clip_position)
+        << ";\n";
+  } else if (info.stage == program->fragment) {
+    out << "    out_color = ";
+    if (shape.width == 4) {
+      emit_expr(ast, info.result);
+    } else if (shape.width == 3) {
+      out << "vec4(";
+      emit_expr(ast, info.result);
+      out << ", 1.0)";
+    } else {
+      out << "vec4(vec3(";
+      emit_expr(ast, info.result);
+      out << "), 1.0)";
+    }
+    out << ";\n";
+  }
+  out << "}\n";
+  program->locals.clear();
+  program->stage = NoSymbol;
+  varying_binding = NoSymbol;
+}
+
+std::string GlslEmitter::location(uint32_t location) const {
+  if (options.version < (options.es ? 310u : 410u))
+    return {};
+  return "layout(location = " + std::to_string(location) + ") ";
+}
+
+void GlslEmitter::emit_pack(const VaryingSlots &slots) {
+  std::vector<ShaderVariable> fields = struct_fields(*program, slots.type);
+  for (uint32_t k = 0; k < slots.count; ++k) {
+    std::vector<const VaryingLeaf *> parts;
+    for (const VaryingLeaf &leaf : slots.leaves) {
+      if (leaf.slot == k)
+        parts.push_back(&leaf);
+    }
+    std::sort(parts.begin(), parts.end(),
+              [](const VaryingLeaf *a, const VaryingLeaf *b) {
+                return a->component < b->component;
+              });
+    out.indent(1);
+    out << packed_name(slots.location + k) << " = ";
+    if (parts.size() > 1)
+      out << symbol_text(shaped_type("float", slots.widths[k])) << '(';
+    for (size_t i = 0; i < parts.size(); ++i) {
+      if (i)
+        out << ", ";
+      out << symbol_text(slots.name) << '.'
+          << symbol_text(fields[parts[i]->member].name);
+    }
+    if (parts.size() > 1)
+      out << ')';
+    out << ";\n";
+  }
+}
+
+void GlslEmitter::emit_unpack(const VaryingSlots &slots) {
+  static const char components[] = "xyzw";
+  out.indent(1);
+  out << symbol_text(slots.type) << ' ' << symbol_text(slots.name) << " = "
+      << symbol_text(slots.type) << '(';
+  for (size_t i = 0; i < slots.leaves.size(); ++i) {
+    const VaryingLeaf &leaf = slots.leaves[i];
+    if (i)
+      out << ", ";
+    out << packed_name(slots.location + leaf.slot);
+    if (leaf.width < slots.widths[leaf.slot])
+      out << '.'
+          << std::string_view(components + leaf.component, leaf.width);
+  }
+  out << ");\n";
+  program->locals.push_back({slots.name, slots.type});
+}
+
+void GlslEmitter::emit_prelude(const StageUsage *usage) {
+  for (const AstRef &type : program->structs)
+    emit_struct(type);
+  if (options.uniform_block && !program->uniforms.empty()) {
+    // Every stage declares the whole block, so their layouts agree.
+    BlockLayout layout = layout_block(*program, program->uniforms,
+                                      options.layout, options.reorder_uniforms);
+    // OpenGL only lays out buffer blocks by std430.
+    if (options.layout == LayoutRules::Std430)
+      out << "layout(std430) readonly buffer Uniforms {\n";
+    else
+      out << "layout(std140) uniform Uniforms {\n";
+    for (const MemberLayout &member : layout.members) {
+      out.indent(1);
+      out << symbol_text(member.type) << ' ' << symbol_text(member.name)
+          << ";\n";
+    }
+    out << "};\n\n";
+  } else {
+    // Loose uniforms link by name, so each stage declares only its own.
+    bool any_uniform = false;
+    for (const ShaderVariable &uniform : program->uniforms) {
+      if (usage && !usage->names.count(uniform.name))
+        continue;
+      any_uniform = true;
+      out << "uniform " << symbol_text(uniform.type) << ' '
+          << symbol_text(uniform.name) << ";\n";
+    }
+    if (any_uniform)
+      out << '\n';
+  }
+
+  bool any_constant = false;
+  for (size_t i = 0; i < program->constants.size(); ++i) {
+    if (usage && !usage->constants[i])
+      continue;
+    any_constant = true;
+    const AstRef &constant = program->constants[i];
+    const ShaderVariable &global = program->globals[i];
+    out << "const " << symbol_text(global.type) << ' '
+        << symbol_text(global.name) << " = ";
+    emit_expr(*constant.ast, constant.ast->child(constant.id, 0));
+    out << ";\n";
+  }
+  if (any_constant)
+    out << '\n';
+
+  // Prototypes first, so functions may call each other in any order.
+  std::vector<const Overload *> emitted;
+  for (uint32_t i = 0; i < program->overloads.size(); ++i) {
+    if (program->is_emitted(i) && (!usage || usage->overloads[i]))
+      emitted.push_back(&program->overloads[i]);
+  }
+  for (const Overload *overload : emitted)
+    emit_function(*overload, true);
+  if (!emitted.empty())
+    out << '\n';
+  for (const Overload *overload : emitted)
+    emit_function(*overload, false);
+}
+
+void GlslEmitter::emit_struct(const AstRef &type) {
+  const Ast &ast = *type.ast;
+  out << "struct " << symbol_text(ast[type.id].value) << " {\n";
+  for (NodeId field : ast.children(type.id)) {
+    NodeId field_type = ast.child(field, ast[field].child_count - 1);
+    out.indent(1);
+    out << symbol_text(ast[field_type].value) << ' '
+        << symbol_text(ast[field].value) << ";\n";
+  }
+  out << "};\n\n";
+}
+
+void GlslEmitter::emit_function(const Overload &overload,
+                                bool prototype_only) {
+  const Ast &ast = *overload.function.ast;
+  NodeRange children = ast.children(overload.function.id);
+  NodeId params = children[children.size() - 2];
+  NodeId body = children[children.size() - 1];
+  std::string_view name = symbol_text(ast[overload.function.id].value);
+  std::vector<ShaderVariable> &locals = program->locals;
+  NodeRange types = ast.children(overload.signature);
+
+  Symbol return_type = ast[types[types.size() - 1]].value;
+  out << symbol_text(return_type) << ' ' << name << '(';
+  locals.clear();
+  for (uint32_t i = 0; i < ast[params].child_count; ++i) {
+    Symbol param = ast[ast.child(params, i)].value;
+    Symbol type = ast[types[i]].value;
+    if (i)
+      out << ", ";
+    out << symbol_text(type) << ' ' << symbol_text(param);
+    locals.push_back({param, type});
+  }
+  if (prototype_only) {
+    out << ");\n";
+  } else {
+    out << ") {\n";
+    emit_bindings(ast, body, 1);
+    out << "    return ";
+    emit_expr(ast, body);
+    out << ";\n}\n\n";
+  }
+  locals.clear();
+}
+
+void GlslEmitter::emit_bindings(const Ast &ast, NodeId id, int depth) {
+  if (ast[id].type != NodeType::LetInExpr) {
+    for (NodeId child : ast.children(id))
+      emit_bindings(ast, child, depth);
+    return;
+  }
+  for (NodeId child : ast.children(id)) {
+    if (ast[child].type != NodeType::LetBinding) {
+      emit_bindings(ast, child, depth);
+      continue;
+    }
+    NodeId value = ast.child(child, 0);
+    emit_bindings(ast, value, depth);
+    Symbol type = program->infer(ast, value);
+    Symbol name = ast[child].value;
+    out.indent(depth);
+    if (name != varying_binding)
+      out << symbol_text(type) << ' ';
+    out << symbol_text(name) << " = ";
+    emit_expr(ast, value);
+    out << ";\n";
+    program->locals.push_back({name, type});
+  }
+}
+
+void GlslEmitter::emit_expr(const Ast &ast, NodeId id) {
+  const ASTNode &node = ast[id];
+  switch (node.type) {
+  case NodeType::NumberLiteral: {
+    std::string_view text = symbol_text(node.value);
+    out << text;
+    if (text.find_first_of(".eE") == std::string_view::npos)
+      out << ".0";
+  } break;
+  case NodeType::Identifier:
+    out << symbol_text(node.value);
+    break;
+  case NodeType::UnaryOp:
+    out << "(-";
+    emit_expr(ast, ast.child(id, 0));
+    out << ')';
+    break;
+  case NodeType::FieldAccess:
+    emit_member(ast, ast.child(id, 0), node.value);
+    break;
+  case NodeType::BinOp: {
+    std::string_view name = symbol_text(node.value);
+    if (name == "Dot") {
+      emit_member(ast, ast.child(id, 0), ast[ast.child(id, 1)].value);
+      break;
+    }
+    out << '(';
+    emit_expr(ast, ast.child(id, 0));
+    out << binary_operator(name);
+    emit_expr(ast, ast.child(id, 1));
+    out << ')';
+  } break;
+  case NodeType::FunctionApplication:
+    emit_call(ast, id);
+    break;
+  case NodeType::LetInExpr:
+  case NodeType::Input:
+    emit_expr(ast, program->result_of(ast, id));
+    break;
+  default:
+    break;
+  }
+}
+
+void GlslEmitter::emit_call(const Ast &ast, NodeId id) {
+  NodeId args[max_arguments];
+  size_t count = 0;
+  NodeId head = id;
+  while (ast[head].type == NodeType::FunctionApplication &&
+         count < max_arguments) {
+    args[count++] = ast.child(head, 1);
+    head = ast.child(head, 0);
+  }
+  out << symbol_text(ast[head].value) << '(';
+  for (size_t i = count; i-- > 0;) {
+    emit_expr(ast, args[i]);
+    if (i)
+      out << ", ";
+  }
+  out << ')';
+}
+
+void GlslEmitter::emit_member(const Ast &ast, NodeId base, Symbol field) {
+  emit_expr(ast, base);
+  out << '.'
+      << symbol_text(program->field_name(program->infer(ast, base), field));
+}
+
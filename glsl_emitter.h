@@ -0,0 +1,78 @@
+#pragma once
+#include "ast_node.h"
+#include "diagnostics.h"
+#include "shader_program.h"
+#include "text_buffer.h"
+#include "uniform_layout.h"
+#include "varying_layout.h"
+#include "vertex_layout.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct GlslOptions {
+  uint32_t version = 450;
+  bool es = false;
+  // Leave out functions, constants and uniforms the stage does not use.
+  bool strip_unused = false;
+  // Declare uniforms in one block laid out by `layout`, as SPIR-V does,
+  // rather than loose. A std430 block is a read-only buffer block, which
+  // needs GLSL 430 or ES 310.
+  bool uniform_block = false;
+  LayoutRules layout = LayoutRules::Std140;
+  // Order the block's members to waste the least padding.
+  bool reorder_uniforms = false;
+};
+
+// One emitted shader; its text is the buffer's view(begin, end).
+struct EmittedShader {
+  Symbol stage = NoSymbol;
+  size_t begin = 0;
+  size_t end = 0;
+};
+
+// Writes a GLSL shader for every `@main` entry point of a program into one
+// TextBuffer. Non-internal data types become structs, `@in` fields become
+// stage inputs and uniforms, top-level lets become constants and functions
+// with a type signature become GLSL functions. `@internal` types and
+// functions stand for GLSL builtins and are not emitted. Let bindings are
+// hoisted into locals; a vertex `@in fragment x` result becomes a varying.
+class GlslEmitter {
+public:
+  GlslEmitter(TextBuffer &out, Diagnostics &diagnostics,
+              GlslOptions options = {});
+
+  // `stages` are what ShaderProgram::analyze() gave for a program without
+  // errors, and `varyings` what link_varyings() made of it.
+  std::vector<EmittedShader> emit(ShaderProgram &program,
+                                  const std::vector<StageInfo> &stages,
+                                  const VaryingLayout &varyings);
+
+private:
+  void emit_stage(const StageInfo &info);
+  // "layout(location = N) " for a varying, or nothing for versions that
+  // only match varyings by name (before 410, or ES 300).
+  std::string location(uint32_t location) const;
+  // `usage` is null to write every declaration.
+  void emit_prelude(const StageUsage *usage);
+  void emit_struct(const AstRef &type);
+  // Writes the vertex stage's packed varying into its slots, or reads the
+  // fragment stage's back out of them.
+  void emit_pack(const VaryingSlots &slots);
+  void emit_unpack(const VaryingSlots &slots);
+  void emit_function(const Overload &overload, bool prototype_only);
+  void emit_bindings(const Ast &ast, NodeId id, int depth);
+  void emit_expr(const Ast &ast, NodeId id);
+  void emit_call(const Ast &ast, NodeId id);
+  void emit_member(const Ast &ast, NodeId base, Symbol field);
+
+  TextBuffer &out;
+  Diagnostics &diagnostics;
+  GlslOptions options;
+
+  // The program being emitted, only set during emit().
+  ShaderProgram *program = nullptr;
+  VaryingLayout varyings;
+  // Let binding written straight into the varying of the same name.
+  Symbol varying_binding = NoSymbol;
+};
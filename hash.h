@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// Fast non-cryptographic 64-bit hashing for content keys (module and
+// compile caches, structural hashing of expressions). Not stable across
+// endianness.
+
+inline uint64_t hash_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+inline uint64_t hash_combine(uint64_t seed, uint64_t value) {
+  return hash_mix(seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) +
+                          (seed >> 2)));
+}
+
+inline uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  uint64_t h = seed ^ (size * 0x9e3779b97f4a7c15ull);
+  while (size >= 8) {
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    h = (h ^ hash_mix(word)) * 0x9e3779b97f4a7c15ull;
+    h = (h << 31) | (h >> 33);
+    p += 8;
+    size -= 8;
+  }
+  uint64_t tail = 0;
+  std::memcpy(&tail, p, size);
+  h ^= hash_mix(tail ^ size);
+  return hash_mix(h);
+}
+
+inline uint64_t hash_string(std::string_view text, uint64_t seed = 0) {
+  return hash_bytes(text.data(), text.size(), seed);
+}
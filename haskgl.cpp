@@ -3,14 +3,44 @@
 #define FLAG_IMPLEMENTATION
 #include "Lexer.h"
 #include "ast_node.h"
+#include "bench.h"
+#include "compile_cache.h"
+#include "compile_server.h"
+#include "diagnostics.h"
 #include "flag.h"
+#include "hash.h"
+#include "glsl_emitter.h"
+#include "module.h"
+#include "optimizer.h"
+#include "parallel_parse.h"
 #include "parser.h"
+#include "source_file.h"
+#include "spirv_emitter.h"
+#include "text_buffer.h"
+#include "thread_pool.h"
+#include "uniform_layout.h"
+#include "variants.h"
+#include "vertex_layout.h"
 
-#include <fstream>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cinttypes>
+#include <filesystem>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef HGL_VERSION
+#define HGL_VERSION "1.0"
+#endif
 
 void usage(void) {
-  fprintf(stderr, "Usage: %s [OPTIONS]\n", flag_program_name());
+  fprintf(stderr, "Usage: %s [OPTIONS] [--] <input.hgl>...\n",
+          flag_program_name());
   flag_print_options(stderr);
 }
 
@@ -68,40 +98,729 @@ constexpr const char *type_to_string(NodeType type) {
     return "LetBinding";
   case NodeType::LetInExpr:
     return "LetInExpr";
+  case NodeType::Tuple:
+    return "Tuple";
+  case NodeType::Output:
+    return "Output";
+  case NodeType::Uniform:
+    return "Uniform";
+  case NodeType::OperatorOverload:
+    return "OperatorOverload";
+  case NodeType::Let:
+    return "Let";
+  case NodeType::UnaryOp:
+    return "UnaryOp";
+  case NodeType::Error:
+    return "Error";
+  case NodeType::AttributeFormat:
+    return "AttributeFormat";
+  case NodeType::Variant:
+    return "Variant";
   }
+  return "Unknown";
 }
 
-void printAST(const ASTNode *node, int indent = 0) {
-  if (!node)
+void printAST(std::ostream &out, const Ast &ast, NodeId id, int indent = 0) {
+  if (id == NoNode)
     return;
 
+  const ASTNode &node = ast[id];
   std::string pad(indent * 2, ' ');
-  std::cout << pad << "- " << type_to_string(node->type);
+  out << pad << "- " << type_to_string(node.type);
 
-  if (!node->value.empty()) {
-    std::cout << " (" << node->value << ")";
+  if (node.value != 0) {
+    out << " (" << symbol_text(node.value) << ")";
   }
 
-  std::cout << " Internal: " << node->internal << "\n";
+  out << " Internal: " << node.internal << "\n";
 
-  for (const ASTNode *child : node->children) {
-    printAST(child, indent + 1);
+  for (NodeId child : ast.children(id)) {
+    printAST(out, ast, child, indent + 1);
   }
 }
 
-int main(int argc, char **argv) {
-  std::ifstream stream("assets/tests/bool_expr.hgl");
-  std::stringstream buffer;
-  buffer << stream.rdbuf();
+// Appends every non-empty line of the list file at `path` to `inputs`.
+bool read_input_list(const char *path, std::vector<std::string> &inputs) {
+  SourceFile list;
+  if (!list.open(path))
+    return false;
+  const char *line = list.data();
+  const char *end = list.data() + list.size();
+  while (line < end) {
+    const char *eol = line;
+    while (eol < end && *eol != '\n')
+      eol++;
+    const char *last = eol;
+    while (last > line && (last[-1] == '\r' || last[-1] == ' '))
+      last--;
+    if (last > line)
+      inputs.emplace_back(line, last - line);
+    line = eol + 1;
+  }
+  return true;
+}
+
+// Adds `path` to `inputs`, or every .hgl file below it (sorted, so runs are
+// reproducible) when it is a directory.
+void add_input(const std::string &path, std::vector<std::string> &inputs) {
+  std::error_code ec;
+  if (!std::filesystem::is_directory(path, ec)) {
+    inputs.push_back(path);
+    return;
+  }
+  std::vector<std::string> found;
+  for (auto it = std::filesystem::recursive_directory_iterator(path, ec);
+       !ec && it != std::filesystem::recursive_directory_iterator();
+       it.increment(ec)) {
+    if (it->is_regular_file(ec) && it->path().extension() == ".hgl")
+      found.push_back(it->path().string());
+  }
+  std::sort(found.begin(), found.end());
+  inputs.insert(inputs.end(), found.begin(), found.end());
+}
+
+struct Options {
+  bool dump_ast = false;
+  bool glsl = false;
+  GlslOptions glsl_options;
+  bool spirv = false;
+  SpirvOptions spirv_options;
+  // Write the uniform block's layout as a C++ header for the host.
+  bool reflect = false;
+  // Compile every combination of the @variant flag values.
+  bool variants = false;
+  bool optimize = true;
+  OptimizerOptions optimizer;
+  // Locations the varyings may take.
+  uint32_t max_varyings = 16;
+  // Shaders are written here as <input stem>.vert/.frag (.vert.spv/.frag.spv
+  // for SPIR-V); stdout if empty.
+  std::string output_dir;
+  // Set when the pool is not busy with other inputs, so one large file can
+  // have its declarations parsed in parallel.
+  ThreadPool *parse_pool = nullptr;
+  // Results of earlier runs, if -cache is given.
+  CompileCache *cache = nullptr;
+};
 
-  std::string strbf = buffer.str();
-  const char *source = strbf.c_str();
-  stream.close();
+// What compiling one input produced. Kept until every input is done so the
+// output order does not depend on scheduling.
+struct CompileResult {
+  std::string output;
+  std::string diagnostics;
+  // Written to the output directory once the input is compiled.
+  std::vector<OutputFile> files;
+  bool failed = false;
+};
+
+// State one worker thread reuses from file to file.
+struct WorkerState {
+  Ast ast;
+  // Copy of `ast` specialised for one variant.
+  Ast variant;
+  Diagnostics diagnostics;
+  TextBuffer code{256 * 1024};
+  std::vector<uint32_t> words;
+};
+
+const char *stage_extension(std::string_view stage) {
+  return stage == "vertex" ? ".vert" : ".frag";
+}
+
+// `stem` with every character that cannot be in a C++ identifier replaced.
+std::string identifier_of(std::string_view stem) {
+  std::string name;
+  for (char c : stem)
+    name += isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  if (name.empty() || isdigit(static_cast<unsigned char>(name[0])))
+    name.insert(name.begin(), '_');
+  return name;
+}
+
+bool write_file(const std::string &path, std::string_view contents) {
+  FILE *file = fopen(path.c_str(), "wb");
+  if (!file)
+    return false;
+  bool ok = fwrite(contents.data(), 1, contents.size(), file) ==
+            contents.size();
+  return fclose(file) == 0 && ok;
+}
+
+void write_files(const Options &options, CompileResult &result) {
+  for (const OutputFile &file : result.files) {
+    std::string target =
+        (std::filesystem::path(options.output_dir) / file.name).string();
+    if (!write_file(target, file.contents))
+      result.diagnostics += "ERROR: could not write " + target + "\n";
+  }
+}
 
-  Lexer lexer{source};
+// One shader or header compiled from an input.
+struct Artifact {
+  // Stage or header name, e.g. "vertex" or "uniforms".
+  std::string kind;
+  // Appended to the input stem to name its file, e.g. ".vert.spv".
+  std::string extension;
+  std::string contents;
+  // Shown on stdout instead of binary contents.
+  std::string summary;
+};
 
-  Parser parser{lexer};
-  ASTNode *root = parser.parse();
-  printAST(root);
+// The GLSL, SPIR-V and headers `options` asks for, in that order. Stops at
+// the first backend that reports errors to `diagnostics`.
+std::vector<Artifact>
+emit_artifacts(const Ast &ast, NodeId root, const char *source,
+               const std::vector<std::shared_ptr<const Module>> &imports,
+               const std::string &stem, const Options &options,
+               WorkerState &state, Diagnostics &diagnostics) {
+  std::vector<Artifact> artifacts;
+  ShaderProgram program{diagnostics};
+  std::vector<StageInfo> stages;
+  if (!program.analyze(ast, root, source, imports, stages))
+    return artifacts;
+  // Packing is an optimization: at -O0 each varying keeps its own type.
+  VaryingLayout varyings = link_varyings(program, options.optimize);
+  if (varyings.locations > options.max_varyings) {
+    diagnostics.report(Severity::Error, SourceSpan{},
+                       "the varyings take %u locations, more than the %u "
+                       "available",
+                       varyings.locations, options.max_varyings);
+    return artifacts;
+  }
+
+  if (options.glsl && diagnostics.error_count() == 0) {
+    state.code.clear();
+    GlslEmitter emitter{state.code, diagnostics, options.glsl_options};
+    for (const EmittedShader &shader :
+         emitter.emit(program, stages, varyings)) {
+      std::string_view stage = symbol_text(shader.stage);
+      artifacts.push_back({std::string(stage), stage_extension(stage),
+                           std::string(state.code.view(shader.begin,
+                                                       shader.end)),
+                           {}});
+    }
+  }
+  if (options.spirv && diagnostics.error_count() == 0) {
+    state.words.clear();
+    SpirvEmitter emitter{state.words, diagnostics, options.spirv_options};
+    for (const SpirvShader &shader :
+         emitter.emit(program, stages, varyings)) {
+      std::string_view stage = symbol_text(shader.stage);
+      size_t count = shader.end - shader.begin;
+      std::string bytes(
+          reinterpret_cast<const char *>(state.words.data() + shader.begin),
+          count * sizeof(uint32_t));
+      // Binary modules only go to files; stdout gets a summary.
+      artifacts.push_back(
+          {std::string(stage),
+           std::string(stage_extension(stage)) + ".spv", std::move(bytes),
+           "SPIR-V 1.0, " + std::to_string(count) + " words, id bound " +
+               std::to_string(state.words[shader.begin + 3])});
+    }
+  }
+  if (options.reflect && diagnostics.error_count() == 0) {
+    BlockLayout layout =
+        layout_block(program, program.uniforms, options.spirv_options.layout,
+                     options.spirv_options.reorder_uniforms);
+    artifacts.push_back({"uniforms", ".uniforms.h",
+                         reflection_header(identifier_of(stem), layout,
+                                           options.spirv_options.layout),
+                         {}});
+    if (!program.vertex_inputs.empty())
+      artifacts.push_back(
+          {"vertex", ".vertex.h",
+           vertex_header(identifier_of(stem), layout_vertex(program)), {}});
+  }
+  return artifacts;
+}
+
+// Compiles every combination of the values of `flags`. The tree in
+// `state.ast` is parsed, type-checked and (with inlining) optimized once;
+// each variant only redoes the passes its constants change and the
+// backends. Artifacts are written once per distinct contents, named by
+// their hash, and <stem>.variants lists the files of every variant.
+void compile_variants(const std::string &path, const char *source,
+                      const std::vector<VariantFlag> &flags, NodeId root,
+                      const std::vector<std::shared_ptr<const Module>> &imports,
+                      const Options &options, WorkerState &state,
+                      CompileResult &result) {
+  const Ast &shared = state.ast;
+  Diagnostics &diagnostics = state.diagnostics;
+  {
+    ShaderProgram program{diagnostics};
+    bool ok = program.collect(shared, root, source, imports);
+    for (const AstRef &entry : program.entries) {
+      StageInfo info;
+      ok = ok && program.analyze_stage(entry, info);
+    }
+    if (!ok)
+      return;
+  }
+  if (options.optimize)
+    optimize_shared(state.ast, root, source, imports, options.optimizer);
+
+  std::string stem = std::filesystem::path(path).stem().string();
+  std::unordered_map<uint64_t, std::string> written;
+  std::string manifest;
+  for (const Variant &variant : variant_matrix(flags)) {
+    std::string name = variant_name(flags, variant);
+    Ast &ast = state.variant;
+    ast.assign(shared.node_data(), shared.offset_data(), shared.size(),
+               shared.child_data(), shared.child_index_count());
+    specialize(ast, flags, variant);
+    if (options.optimize)
+      optimize_specialized(ast, root, source, imports, options.optimizer);
+
+    // Every variant type-checks like the shared tree; what is left to
+    // fail are backend limits, reported once for the first variant.
+    Diagnostics variant_diagnostics;
+    std::vector<Artifact> artifacts = emit_artifacts(
+        ast, root, source, imports, stem, options, state, variant_diagnostics);
+    if (variant_diagnostics.error_count() != 0) {
+      diagnostics.append(variant_diagnostics);
+      return;
+    }
+
+    manifest += name + ':';
+    for (Artifact &artifact : artifacts) {
+      uint64_t hash = hash_bytes(artifact.contents.data(),
+                                 artifact.contents.size());
+      hash = hash_combine(hash, std::hash<std::string>{}(artifact.extension));
+      char hex[17];
+      snprintf(hex, sizeof hex, "%016llx",
+               static_cast<unsigned long long>(hash));
+      auto [first, inserted] = written.try_emplace(hash, name);
+      std::string file = stem + '.' + hex + artifact.extension;
+      manifest += ' ' + file;
+      if (!options.output_dir.empty()) {
+        if (inserted)
+          result.files.push_back({file, std::move(artifact.contents)});
+        continue;
+      }
+      result.output += "// " + path + " [" + name + "]: " + artifact.kind;
+      if (!inserted)
+        result.output += ", same as [" + first->second + "]\n";
+      else if (!artifact.summary.empty())
+        result.output += ": " + artifact.summary + "\n";
+      else
+        result.output += "\n" + artifact.contents;
+    }
+    manifest += '\n';
+  }
+  if (!options.output_dir.empty())
+    result.files.push_back({stem + ".variants", std::move(manifest)});
+}
+
+void compile_file(const std::string &path, const Options &options,
+                  ModuleCache &modules, WorkerState &state,
+                  CompileResult &result) {
+  SourceFile source;
+  if (!source.open(path.c_str())) {
+    result.diagnostics = "ERROR: could not read " + path + "\n";
+    result.failed = true;
+    return;
+  }
+  uint64_t key = 0;
+  if (options.cache) {
+    key = options.cache->key(path, {source.data(), source.size()});
+    CachedCompile cached;
+    if (options.cache->lookup(key, cached)) {
+      result.output = std::move(cached.output);
+      result.diagnostics = std::move(cached.diagnostics);
+      result.files = std::move(cached.files);
+      write_files(options, result);
+      return;
+    }
+  }
+
+  Ast &ast = state.ast;
+  Diagnostics &diagnostics = state.diagnostics;
+  ast.clear();
+  diagnostics.clear();
+  NodeId root;
+  if (options.parse_pool) {
+    root = parse_parallel(source.data(), source.size(), ast, diagnostics,
+                          *options.parse_pool);
+  } else {
+    Lexer lexer{source.data()};
+    Parser parser{lexer, ast, diagnostics};
+    root = parser.parse();
+  }
+  std::string dir = std::filesystem::path(path).parent_path().string();
+  auto imports =
+      modules.resolve_includes(ast, root, source.data(), dir, diagnostics);
+  if (options.dump_ast) {
+    std::ostringstream out;
+    printAST(out, ast, root);
+    result.output = out.str();
+  }
+  std::vector<VariantFlag> flags = variant_flags(ast, root);
+  specialize(ast, flags, {});
+  bool emits = options.glsl || options.spirv || options.reflect;
+  if (options.variants && !flags.empty() && emits &&
+      diagnostics.error_count() == 0) {
+    compile_variants(path, source.data(), flags, root, imports, options, state,
+                     result);
+  } else if (emits && diagnostics.error_count() == 0) {
+    if (options.optimize)
+      optimize(ast, root, source.data(), imports, options.optimizer);
+    std::string stem = std::filesystem::path(path).stem().string();
+    for (Artifact &artifact :
+         emit_artifacts(ast, root, source.data(), imports, stem, options,
+                        state, diagnostics)) {
+      if (options.output_dir.empty()) {
+        result.output += "// " + path + ": " + artifact.kind;
+        result.output += artifact.summary.empty()
+                             ? "\n" + artifact.contents
+                             : ": " + artifact.summary + "\n";
+        continue;
+      }
+      result.files.push_back(
+          {stem + artifact.extension, std::move(artifact.contents)});
+    }
+  }
+  diagnostics.format(result.diagnostics, path.c_str(), source.data());
+  result.failed = diagnostics.error_count() != 0;
+  // Failures are not cached, so they are reported again until fixed.
+  if (options.cache && !result.failed)
+    options.cache->store(key, imports,
+                         {result.output, result.diagnostics, result.files});
+  write_files(options, result);
+}
+
+// Stands for the compiler and every option that changes what it produces,
+// so cached results are only replayed by a run that would produce the same.
+uint64_t cache_salt(const Options &options, const char *std_dir,
+                    const char *program) {
+  uint64_t salt = hash_string(HGL_VERSION);
+  // Rebuilding the compiler must not replay the old one's output.
+  SourceFile self;
+  if (self.open("/proc/self/exe") || self.open(program))
+    salt = hash_combine(salt, hash_bytes(self.data(), self.size()));
+  const GlslOptions &glsl = options.glsl_options;
+  const OptimizerOptions &optimizer = options.optimizer;
+  std::ostringstream fingerprint;
+  fingerprint << options.dump_ast << options.glsl << glsl.version << glsl.es
+              << glsl.uniform_block << options.spirv << options.reflect
+              << options.variants << options.optimize << optimizer.fast_math
+              << ' ' << optimizer.inline_size
+              << optimizer.eliminate_dead_code
+              << optimizer.merge_subexpressions << glsl.reorder_uniforms
+              << static_cast<int>(glsl.layout) << ' ' << options.max_varyings
+              << ' ' << !options.output_dir.empty() << std_dir;
+  return hash_combine(salt, hash_string(fingerprint.str()));
+}
+
+// Answers server requests with the options the server was started with.
+// The module cache, interned names and worker buffers stay warm from one
+// request to the next.
+int serve(const std::string &path, const Options &options,
+          ModuleCache &modules) {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<WorkerState>> idle;
+  return run_server(path, [&](const CompileRequest &request,
+                              CompileReply &reply) {
+    std::unique_ptr<WorkerState> state;
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      if (!idle.empty()) {
+        state = std::move(idle.back());
+        idle.pop_back();
+      }
+    }
+    if (!state)
+      state = std::make_unique<WorkerState>();
+
+    std::vector<std::string> inputs;
+    for (const std::string &input : request.inputs)
+      add_input((std::filesystem::path(request.cwd) / input).string(),
+                inputs);
+    if (inputs.empty()) {
+      reply.diagnostics = "ERROR: no inputs\n";
+      reply.failed = 1;
+    }
+    for (const std::string &input : inputs) {
+      CompileResult result;
+      compile_file(input, options, modules, *state, result);
+      reply.output += result.output;
+      reply.diagnostics += result.diagnostics;
+      if (result.failed)
+        reply.failed++;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    idle.push_back(std::move(state));
+  });
+}
+
+int print_cache_stats(const CompileCache &cache, uint64_t limit) {
+  CompileCache::DiskStats disk = cache.disk_stats();
+  uint64_t lookups = disk.hits + disk.misses;
+  printf("%zu entries, %.1f of %.1f MiB\n"
+         "%" PRIu64 " hits, %" PRIu64 " misses, %.1f%% hit rate\n",
+         disk.entries, disk.bytes / 1048576.0, limit / 1048576.0, disk.hits,
+         disk.misses, lookups ? 100.0 * disk.hits / lookups : 0.0);
   return 0;
 }
+
+int main(int argc, char **argv) {
+  bool *help = flag_bool("help", false, "Print this help and exit");
+  bool *dump_ast = flag_bool("ast", false, "Print the AST of every input");
+  char **list = flag_str("list", NULL, "File with one input path per line");
+  uint64_t *jobs = flag_uint64("j", 0,
+                               "Worker threads, 0 for one per hardware thread");
+  bool *glsl = flag_bool("glsl", false, "Generate GLSL for every entry point");
+  uint64_t *glsl_version =
+      flag_uint64("glsl-version", 0,
+                  "GLSL #version to target; 0 for 450, or 310 with -glsl-es");
+  bool *glsl_es = flag_bool("glsl-es", false, "Target GLSL ES");
+  bool *spirv = flag_bool("spirv", false,
+                          "Generate a SPIR-V module for every entry point");
+  uint64_t *opt_level =
+      flag_uint64("O", 1, "Optimization level, 0 to emit code as written");
+  bool *fast_math = flag_bool("fast-math", false,
+                              "Allow optimizations that assume no NaN or "
+                              "infinity, such as x * 0 = 0");
+  uint64_t *inline_size =
+      flag_uint64("inline-size", 12,
+                  "Largest function body, in AST nodes, inlined at every "
+                  "call; 0 turns inlining off");
+  bool *no_dce = flag_bool("no-dce", false,
+                           "Keep bindings, functions, attributes and "
+                           "uniforms that no stage uses");
+  bool *no_cse = flag_bool("no-cse", false,
+                           "Keep repeated expressions instead of computing "
+                           "them once");
+  char **uniform_layout = flag_str("uniform-layout", "std140",
+                                   "Uniform block layout, std140 or std430");
+  bool *reorder_uniforms =
+      flag_bool("reorder-uniforms", false,
+                "Order uniform block members to waste the least padding");
+  bool *uniform_block = flag_bool(
+      "uniform-block", false,
+      "Declare GLSL uniforms in one block, laid out as for SPIR-V");
+  bool *reflect =
+      flag_bool("reflect", false,
+                "Write the uniform block's offsets and the vertex layout "
+                "as C++ headers (<input stem>.uniforms.h, .vertex.h)");
+  bool *variants =
+      flag_bool("variants", false,
+                "Compile every combination of @variant flag values; files "
+                "are named by content hash and listed in <stem>.variants");
+  uint64_t *max_varyings =
+      flag_uint64("max-varyings", 16,
+                  "Locations (vec4 slots) the varyings may take; more is an "
+                  "error");
+  char **output_dir = flag_str("o", NULL,
+                               "Directory to write generated shaders to");
+  bool *stats = flag_bool("stats", false,
+                          "Print file, thread and module cache counts");
+  size_t *bench = flag_size("bench", 0,
+                            "Lex this many bytes of generated source with "
+                            "each scanner and report tokens/second");
+  char **std_dir = flag_str("std", "assets/std",
+                            "Directory searched for @include modules");
+  char **module_cache = flag_str("module-cache", NULL,
+                                 "Directory for precompiled modules (.hglc)");
+  char **cache_dir = flag_str("cache", NULL,
+                              "Directory for compile results; an unchanged "
+                              "input is not compiled again");
+  size_t *cache_size = flag_size("cache-size", 256 * 1024 * 1024,
+                                 "Size the -cache directory is trimmed to, "
+                                 "least recently used entries first");
+  bool *cache_stats = flag_bool("cache-stats", false,
+                                "Print the -cache directory's size and hit "
+                                "rate and exit");
+  char **server = flag_str("server", NULL,
+                           "Serve compile requests on this Unix domain "
+                           "socket, with the options given here, until "
+                           "stopped");
+  char **client = flag_str("client", NULL,
+                           "Have the server on this socket compile the "
+                           "inputs; compile options are the server's");
+  bool *stop = flag_bool("stop", false,
+                         "With -client, ask the server to exit");
+  uint64_t *server_bench =
+      flag_uint64("server-bench", 0,
+                  "With -client, send the inputs this many times over each "
+                  "of -clients connections and report p50/p99 latency");
+  uint64_t *clients =
+      flag_uint64("clients", 8, "Concurrent connections for -server-bench");
+
+  if (!flag_parse(argc, argv)) {
+    usage();
+    flag_print_error(stderr);
+    return 1;
+  }
+  if (*help) {
+    usage();
+    return 0;
+  }
+  if (*bench) {
+    return run_lexer_bench(*bench);
+  }
+  if (*cache_stats) {
+    if (!*cache_dir) {
+      fprintf(stderr, "ERROR: -cache-stats needs -cache\n");
+      return 1;
+    }
+    return print_cache_stats(CompileCache{*cache_dir, *cache_size, 0},
+                             *cache_size);
+  }
+
+  std::vector<std::string> listed;
+  if (*list && !read_input_list(*list, listed)) {
+    fprintf(stderr, "ERROR: could not read input list %s\n", *list);
+    return 1;
+  }
+  int rest_argc = flag_rest_argc();
+  char **rest_argv = flag_rest_argv();
+  for (int i = 0; i < rest_argc; ++i) {
+    listed.emplace_back(rest_argv[i]);
+  }
+  if (*client) {
+    std::error_code ec;
+    CompileRequest request{std::filesystem::current_path(ec).string(),
+                           listed};
+    if (*stop)
+      return stop_server(*client);
+    if (listed.empty()) {
+      usage();
+      return 1;
+    }
+    if (*server_bench)
+      return run_server_bench(*client, request, *clients, *server_bench);
+    return run_client(*client, request);
+  }
+  std::vector<std::string> inputs;
+  for (const std::string &path : listed) {
+    add_input(path, inputs);
+  }
+  if (inputs.empty() && !*server) {
+    usage();
+    return 1;
+  }
+
+  Options options;
+  options.dump_ast = *dump_ast;
+  options.glsl = *glsl;
+  options.glsl_options.version = static_cast<uint32_t>(*glsl_version);
+  options.glsl_options.es = *glsl_es;
+  if (*glsl_version == 0)
+    options.glsl_options.version = *glsl_es ? 310 : 450;
+  // The shaders use in/out interface variables, which ES 1.00 lacks.
+  if (*glsl_es && options.glsl_options.version != 300 &&
+      options.glsl_options.version != 310 &&
+      options.glsl_options.version != 320) {
+    fprintf(stderr, "ERROR: GLSL ES %u does not exist or is not supported; "
+                    "use 300, 310 or 320\n",
+            options.glsl_options.version);
+    return 1;
+  }
+  // Attribute and color output locations, and the core profile, need 330.
+  uint32_t version = options.glsl_options.version;
+  if (!*glsl_es && version != 330 &&
+      (version < 400 || version > 460 || version % 10 != 0)) {
+    fprintf(stderr, "ERROR: GLSL %u does not exist or is not supported; "
+                    "use 330 or 400 to 460\n",
+            version);
+    return 1;
+  }
+  options.spirv = *spirv;
+  LayoutRules rules;
+  if (!parse_rules(*uniform_layout, rules)) {
+    fprintf(stderr, "ERROR: unknown uniform layout %s\n", *uniform_layout);
+    return 1;
+  }
+  // OpenGL lays out only buffer blocks by std430.
+  if (*glsl && *uniform_block && rules == LayoutRules::Std430 &&
+      options.glsl_options.version < (*glsl_es ? 310u : 430u)) {
+    fprintf(stderr, "ERROR: a std430 uniform block is a buffer block, which "
+                    "needs GLSL 430 or ES 310\n");
+    return 1;
+  }
+  options.glsl_options.uniform_block = *uniform_block;
+  options.glsl_options.layout = rules;
+  options.glsl_options.reorder_uniforms = *reorder_uniforms;
+  options.spirv_options.layout = rules;
+  options.spirv_options.reorder_uniforms = *reorder_uniforms;
+  options.reflect = *reflect;
+  options.variants = *variants;
+  options.optimize = *opt_level != 0;
+  options.glsl_options.strip_unused = options.optimize;
+  options.spirv_options.strip_unused = options.optimize;
+  options.max_varyings = static_cast<uint32_t>(*max_varyings);
+  options.optimizer.fast_math = *fast_math;
+  options.optimizer.inline_size = static_cast<uint32_t>(*inline_size);
+  options.optimizer.eliminate_dead_code = !*no_dce;
+  options.optimizer.merge_subexpressions = !*no_cse;
+  if (*output_dir) {
+    options.output_dir = *output_dir;
+    std::error_code ec;
+    std::filesystem::create_directories(options.output_dir, ec);
+    // Clients of a server run in other directories.
+    if (*server)
+      options.output_dir =
+          std::filesystem::absolute(options.output_dir, ec).string();
+  }
+  ModuleCache modules{{*std_dir}, *module_cache ? *module_cache : ""};
+  std::unique_ptr<CompileCache> cache;
+  if (*cache_dir) {
+    cache = std::make_unique<CompileCache>(
+        *cache_dir, *cache_size, cache_salt(options, *std_dir, argv[0]));
+    options.cache = cache.get();
+  }
+  if (*server) {
+    int status = serve(*server, options, modules);
+    if (cache) {
+      cache->trim();
+      cache->save_totals();
+    }
+    return status;
+  }
+  ThreadPool pool{*jobs};
+  std::vector<WorkerState> states(pool.size());
+  std::vector<CompileResult> results(inputs.size());
+
+  auto start = std::chrono::steady_clock::now();
+  if (inputs.size() == 1) {
+    options.parse_pool = &pool;
+    compile_file(inputs[0], options, modules, states[0], results[0]);
+  } else {
+    pool.parallel_for(inputs.size(), [&](size_t index, size_t worker) {
+      compile_file(inputs[index], options, modules, states[worker],
+                   results[index]);
+    });
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  if (cache) {
+    cache->trim();
+    cache->save_totals();
+  }
+
+  size_t failed = 0;
+  for (const CompileResult &result : results) {
+    fwrite(result.output.data(), 1, result.output.size(), stdout);
+    fwrite(result.diagnostics.data(), 1, result.diagnostics.size(), stderr);
+    if (result.failed)
+      failed++;
+  }
+  if (*stats) {
+    ModuleCache::Stats cache = modules.stats();
+    fprintf(stderr,
+            "%zu files, %zu failed, %zu threads, %.1f ms\n"
+            "modules: %zu parsed, %zu precompiled, %zu cached\n",
+            inputs.size(), failed, pool.size(),
+            std::chrono::duration<double, std::milli>(elapsed).count(),
+            cache.parsed, cache.precompiled_hits, cache.memory_hits);
+    if (options.cache) {
+      CompileCache::Stats compiles = options.cache->stats();
+      fprintf(stderr,
+              "compile cache: %zu hits, %zu misses, %zu stored, %zu "
+              "evicted\n",
+              compiles.hits, compiles.misses, compiles.stored,
+              compiles.evicted);
+    }
+  }
+  return failed == 0 ? 0 : 1;
+}
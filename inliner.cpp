@@ -0,0 +1,244 @@
+#include "inliner.h"
+#include <algorithm>
+#include <string>
+
+namespace {
+
+uint32_t subtree_size(const Ast &ast, NodeId id) {
+  uint32_t size = 1;
+  for (uint32_t i = 0; i < ast[id].child_count; ++i)
+    size += subtree_size(ast, ast.child(id, i));
+  return size;
+}
+
+} // namespace
+
+Inliner::Inliner(Ast &ast, const ShaderProgram &program, uint32_t max_size)
+    : ast(ast), program(program), max_size(max_size) {}
+
+size_t Inliner::run() {
+  calls.assign(program.overloads.size(), 0);
+  sizes.assign(program.overloads.size(), 0);
+  std::vector<NodeId> counted;
+  for (uint32_t i = 0; i < program.overloads.size(); ++i) {
+    const AstRef &function = program.overloads[i].function;
+    const Ast &from = *function.ast;
+    NodeRange children = from.children(function.id);
+    NodeId body = children[children.size() - 1];
+    sizes[i] = subtree_size(from, body);
+    collect_names(from, function.id);
+    if (!program.is_emitted(i) ||
+        std::find(counted.begin(), counted.end(), body) != counted.end())
+      continue;
+    counted.push_back(body);
+    count_calls(from, body);
+  }
+  for (const AstRef &entry : program.entries) {
+    collect_names(ast, entry.id);
+    count_calls(ast, entry.id);
+  }
+  for (const AstRef &constant : program.constants)
+    names.insert((*constant.ast)[constant.id].value);
+
+  std::vector<NodeId> done;
+  for (uint32_t i = 0; i < program.overloads.size(); ++i) {
+    const AstRef &function = program.overloads[i].function;
+    if (function.ast != &ast || !program.is_emitted(i) ||
+        std::find(done.begin(), done.end(), function.id) != done.end())
+      continue;
+    done.push_back(function.id);
+    caller_locals.clear();
+    collect_locals(function.id);
+    expanding.assign(1, i);
+    inline_calls(ast.child(function.id, ast[function.id].child_count - 1));
+  }
+  for (const AstRef &entry : program.entries) {
+    caller_locals.clear();
+    collect_locals(entry.id);
+    expanding.clear();
+    inline_calls(ast.child(entry.id, 0));
+  }
+  return inlined;
+}
+
+void Inliner::count_calls(const Ast &from, NodeId id) {
+  int target = program.checker.call_target(from, id);
+  if (target >= 0)
+    calls[target]++;
+  for (uint32_t i = 0; i < from[id].child_count; ++i)
+    count_calls(from, from.child(id, i));
+}
+
+void Inliner::collect_names(const Ast &from, NodeId id) {
+  if (from[id].value != NoSymbol)
+    names.insert(from[id].value);
+  for (uint32_t i = 0; i < from[id].child_count; ++i)
+    collect_names(from, from.child(id, i));
+}
+
+void Inliner::collect_locals(NodeId id) {
+  const ASTNode &node = ast[id];
+  if (node.type == NodeType::LetBinding)
+    caller_locals.insert(node.value);
+  if (node.type == NodeType::FunctionParams) {
+    for (uint32_t i = 0; i < node.child_count; ++i)
+      caller_locals.insert(ast[ast.child(id, i)].value);
+    return;
+  }
+  for (uint32_t i = 0; i < node.child_count; ++i)
+    collect_locals(ast.child(id, i));
+}
+
+int Inliner::call_target(NodeId id) const {
+  auto it = copied_targets.find(id);
+  if (it != copied_targets.end())
+    return it->second;
+  return program.checker.call_target(ast, id);
+}
+
+bool Inliner::should_inline(int overload) const {
+  if (overload < 0 || !program.is_emitted(static_cast<uint32_t>(overload)) ||
+      std::find(expanding.begin(), expanding.end(),
+                static_cast<uint32_t>(overload)) != expanding.end())
+    return false;
+  uint32_t size = sizes[overload];
+  return size <= max_size || (calls[overload] == 1 && size <= 4 * max_size);
+}
+
+void Inliner::inline_calls(NodeId id) {
+  // Arguments first, so what is substituted is already inlined.
+  for (uint32_t i = 0; i < ast[id].child_count; ++i)
+    inline_calls(ast.child(id, i));
+  if (ast[id].type != NodeType::FunctionApplication)
+    return;
+  int target = call_target(id);
+  if (!should_inline(target))
+    return;
+  NodeId expanded = expand(id, static_cast<uint32_t>(target));
+  if (expanded == NoNode)
+    return;
+  ast[id] = ast[expanded];
+  // The checker still has the call it was.
+  copied_targets[id] = -1;
+  inlined++;
+
+  // Calls the callee made are now calls in this function.
+  expanding.push_back(static_cast<uint32_t>(target));
+  inline_calls(id);
+  expanding.pop_back();
+}
+
+NodeId Inliner::expand(NodeId call, uint32_t overload) {
+  const AstRef &function = program.overloads[overload].function;
+  const Ast &from = *function.ast;
+  NodeId params = from.child(function.id, from[function.id].child_count - 2);
+  NodeId body = from.child(function.id, from[function.id].child_count - 1);
+  Symbol callee = from[function.id].value;
+
+  std::vector<NodeId> args;
+  for (NodeId head = call; ast[head].type == NodeType::FunctionApplication;
+       head = ast.child(head, 0))
+    args.push_back(ast.child(head, 1));
+  std::reverse(args.begin(), args.end());
+  if (args.size() != from[params].child_count)
+    return NoNode;
+
+  // The callee's globals must not be hidden by the caller's locals.
+  std::vector<Substitution> substitutions;
+  std::vector<NodeId> lets;
+  std::vector<NodeId> pending{body};
+  while (!pending.empty()) {
+    NodeId id = pending.back();
+    pending.pop_back();
+    const ASTNode &node = from[id];
+    if (node.type == NodeType::LetBinding)
+      substitutions.push_back(
+          {node.value, NoNode, fresh_name(callee, node.value)});
+    for (uint32_t i = 0; i < node.child_count; ++i)
+      pending.push_back(from.child(id, i));
+  }
+  for (uint32_t i = 0; i < from[params].child_count; ++i)
+    substitutions.push_back({from[from.child(params, i)].value, NoNode,
+                             NoSymbol});
+  for (Symbol local : caller_locals) {
+    bool bound = false;
+    for (const Substitution &s : substitutions)
+      bound |= s.name == local;
+    if (!bound && count_reads(from, body, local) != 0)
+      return NoNode;
+  }
+
+  ast.set_location(ast.offset_of(call));
+  size_t first_param = substitutions.size() - args.size();
+  for (size_t i = 0; i < args.size(); ++i) {
+    Substitution &param = substitutions[first_param + i];
+    NodeType type = ast[args[i]].type;
+    if (type == NodeType::Identifier || type == NodeType::NumberLiteral ||
+        count_reads(from, body, param.name) <= 1) {
+      param.node = args[i];
+      continue;
+    }
+    param.renamed = fresh_name(callee, param.name);
+    NodeId binding = ast.add(NodeType::LetBinding, param.renamed);
+    ast.set_children(binding, &args[i], 1);
+    lets.push_back(binding);
+  }
+
+  NodeId result = copy(from, body, substitutions);
+  if (lets.empty())
+    return result;
+  lets.push_back(result);
+  NodeId let = ast.add(NodeType::LetInExpr, ast[lets[0]].value);
+  ast.set_children(let, lets.data(), lets.size());
+  return let;
+}
+
+NodeId Inliner::copy(const Ast &from, NodeId id,
+                     const std::vector<Substitution> &substitutions) {
+  ASTNode node = from[id];
+  if (node.type == NodeType::Identifier) {
+    for (auto it = substitutions.rbegin(); it != substitutions.rend(); ++it) {
+      if (it->name != node.value)
+        continue;
+      if (it->node != NoNode)
+        return copy(ast, it->node, {});
+      return ast.add(NodeType::Identifier, it->renamed);
+    }
+    return ast.add(NodeType::Identifier, node.value);
+  }
+
+  Symbol value = node.value;
+  if (node.type == NodeType::LetBinding) {
+    for (const Substitution &s : substitutions) {
+      if (s.name == value && s.node == NoNode && s.renamed != NoSymbol)
+        value = s.renamed;
+    }
+  }
+  std::vector<NodeId> children;
+  for (uint32_t i = 0; i < node.child_count; ++i) {
+    NodeId child = from.child(id, i);
+    children.push_back(is_name_operand(from, id, i)
+                           ? ast.add(NodeType::Identifier, from[child].value)
+                           : copy(from, child, substitutions));
+  }
+  NodeId result = ast.add(node.type, value);
+  ast.set_children(result, children.data(), children.size());
+  ast[result].internal = node.internal;
+
+  int target = &from == &ast ? call_target(id)
+                             : program.checker.call_target(from, id);
+  if (target >= 0)
+    copied_targets[result] = target;
+  return result;
+}
+
+Symbol Inliner::fresh_name(Symbol function, Symbol name) {
+  std::string base = std::string(symbol_text(function)) + '_' +
+                     std::string(symbol_text(name)) + '_';
+  Symbol fresh;
+  do
+    fresh = intern(base + std::to_string(++next_name));
+  while (names.count(fresh));
+  names.insert(fresh);
+  return fresh;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "ast_node.h"
+#include "shader_program.h"
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Replaces calls to small functions in the main file's entry points and
+// functions with the callee's body, so later passes see straight-line code.
+// A function is inlined at every call if its body has at most `max_size`
+// nodes, and at its only call if it has at most four times that. Arguments
+// used more than once, unless they are a name or a literal, are bound to a
+// let first so they are still computed once; the callee's parameters and
+// lets get fresh names, as let bindings are hoisted into the caller.
+// `@internal` functions stand for GLSL builtins and are never inlined.
+class Inliner {
+public:
+  // `program` must have type-checked `ast`, including its entry points.
+  Inliner(Ast &ast, const ShaderProgram &program, uint32_t max_size);
+
+  // Returns the number of calls inlined.
+  size_t run();
+
+private:
+  struct Substitution {
+    Symbol name;
+    // Node the parameter stands for; NoNode for a renamed let.
+    NodeId node;
+    Symbol renamed;
+  };
+
+  void count_calls(const Ast &ast, NodeId id);
+  void inline_calls(NodeId id);
+  bool should_inline(int overload) const;
+  NodeId expand(NodeId call, uint32_t overload);
+  NodeId copy(const Ast &from, NodeId id,
+              const std::vector<Substitution> &substitutions);
+  int call_target(NodeId id) const;
+  Symbol fresh_name(Symbol function, Symbol name);
+  void collect_names(const Ast &from, NodeId id);
+  void collect_locals(NodeId id);
+
+  Ast &ast;
+  const ShaderProgram &program;
+  uint32_t max_size;
+  size_t inlined = 0;
+
+  std::vector<uint32_t> calls;
+  std::vector<uint32_t> sizes;
+  // Call targets of nodes this pass made or replaced, which the checker
+  // does not know.
+  std::unordered_map<NodeId, int> copied_targets;
+  // Every name in the program, so fresh names cannot collide.
+  std::unordered_set<Symbol> names;
+  // Lets and parameters of the function being inlined into; a callee
+  // that uses a global of the same name would see the local instead.
+  std::unordered_set<Symbol> caller_locals;
+  // Overloads being expanded, to stop at recursion.
+  std::vector<uint32_t> expanding;
+  uint32_t next_name = 0;
+};
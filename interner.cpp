@@ -0,0 +1,65 @@
+#include "interner.h"
+
+#include <cassert>
+#include <cstring>
+#include <functional>
+#include <mutex>
+
+Interner &Interner::global() {
+  static Interner interner;
+  return interner;
+}
+
+Interner::Interner() {
+  for (auto &chunk : chunks)
+    chunk.store(nullptr, std::memory_order_relaxed);
+  Symbol empty = next_symbol.fetch_add(1);
+  chunk_for(empty)[empty & (chunk_size - 1)] = std::string_view("", 0);
+}
+
+std::string_view *Interner::chunk_for(Symbol symbol) {
+  size_t index = symbol >> chunk_bits;
+  assert(index < max_chunks && "interner is full");
+  std::string_view *chunk = chunks[index].load(std::memory_order_acquire);
+  if (chunk)
+    return chunk;
+  // Several shards may race to create the same chunk; one of them wins.
+  std::string_view *fresh = new std::string_view[chunk_size];
+  if (chunks[index].compare_exchange_strong(chunk, fresh,
+                                            std::memory_order_acq_rel))
+    return fresh;
+  delete[] fresh;
+  return chunk;
+}
+
+Symbol Interner::intern(std::string_view text) {
+  if (text.empty())
+    return NoSymbol;
+  size_t hash = std::hash<std::string_view>{}(text);
+  Shard &shard = shards[hash % shard_count];
+  {
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.symbols.find(text);
+    if (it != shard.symbols.end())
+      return it->second;
+  }
+
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.symbols.find(text);
+  if (it != shard.symbols.end())
+    return it->second;
+  char *copy = shard.text.allocate_array<char>(text.size() + 1);
+  std::memcpy(copy, text.data(), text.size());
+  copy[text.size()] = '\0';
+  std::string_view stored(copy, text.size());
+  Symbol symbol = next_symbol.fetch_add(1, std::memory_order_relaxed);
+  chunk_for(symbol)[symbol & (chunk_size - 1)] = stored;
+  shard.symbols.emplace(stored, symbol);
+  return symbol;
+}
+
+std::string_view Interner::text(Symbol symbol) const {
+  std::string_view *chunk =
+      chunks[symbol >> chunk_bits].load(std::memory_order_acquire);
+  return chunk[symbol & (chunk_size - 1)];
+}
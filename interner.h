@@ -0,0 +1,57 @@
+#pragma once
+#include "arena.h"
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+
+using Symbol = uint32_t;
+// The empty string is always symbol 0.
+constexpr Symbol NoSymbol = 0;
+
+// Process-wide string interning table. Every distinct name is assigned a
+// 32-bit Symbol once; afterwards names compare and hash as integers.
+// intern() and text() may be called from any thread. Interned text lives
+// until the process exits and is NUL-terminated, so text(s).data() can be
+// passed to printf-style functions directly.
+class Interner {
+public:
+  static Interner &global();
+
+  Symbol intern(std::string_view text);
+  std::string_view text(Symbol symbol) const;
+  size_t size() const { return next_symbol.load(std::memory_order_relaxed); }
+
+private:
+  Interner();
+  Interner(const Interner &) = delete;
+  Interner &operator=(const Interner &) = delete;
+
+  static constexpr size_t shard_count = 16;
+  static constexpr size_t chunk_bits = 12;
+  static constexpr size_t chunk_size = size_t(1) << chunk_bits;
+  static constexpr size_t max_chunks = 16384;
+
+  struct Shard {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string_view, Symbol> symbols;
+    Arena text{16 * 1024};
+  };
+
+  std::string_view *chunk_for(Symbol symbol);
+
+  Shard shards[shard_count];
+  // Symbol -> text, in fixed-size chunks so that entries never move and
+  // readers need no lock.
+  std::atomic<std::string_view *> chunks[max_chunks];
+  std::atomic<Symbol> next_symbol{0};
+};
+
+inline Symbol intern(std::string_view text) {
+  return Interner::global().intern(text);
+}
+
+inline std::string_view symbol_text(Symbol symbol) {
+  return Interner::global().text(symbol);
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include "token.h"
+#include <cstdint>
+#include <string_view>
+
+struct Keyword {
+  std::string_view text;
+  TokenType type;
+};
+
+// Every reserved word the lexer recognises. Adding an entry here is all it
+// takes; the lookup table below is rebuilt at compile time.
+inline constexpr Keyword keywords[] = {
+    {"vertex", TokenType::Identifier},
+    {"fragment", TokenType::Identifier},
+    {"let", TokenType::Let},
+    {"data", TokenType::Data},
+    {"@internal", TokenType::Internal},
+    {"@main", TokenType::Main},
+    {"@include", TokenType::Include},
+    {"@uniform", TokenType::Uniforms},
+    {"@in", TokenType::Input},
+    {"@out", TokenType::Output},
+    {"@variant", TokenType::Variant},
+    // builtin types
+    {"bool", TokenType::Type},
+    {"int", TokenType::Type},
+    {"uint", TokenType::Type},
+    {"float", TokenType::Type},
+    {"vec2", TokenType::Type},
+    {"vec3", TokenType::Type},
+    {"vec4", TokenType::Type},
+    {"ivec2", TokenType::Type},
+    {"ivec3", TokenType::Type},
+    {"ivec4", TokenType::Type},
+    {"uvec2", TokenType::Type},
+    {"uvec3", TokenType::Type},
+    {"uvec4", TokenType::Type},
+    {"bvec2", TokenType::Type},
+    {"bvec3", TokenType::Type},
+    {"bvec4", TokenType::Type},
+    {"mat2", TokenType::Type},
+    {"mat3", TokenType::Type},
+    {"mat4", TokenType::Type},
+    {"sampler1D", TokenType::Type},
+    {"sampler2D", TokenType::Type},
+    {"sampler3D", TokenType::Type},
+    {"samplerCube", TokenType::Type},
+    {"sampler2DArray", TokenType::Type},
+    {"sampler2DShadow", TokenType::Type},
+};
+
+namespace keyword_detail {
+constexpr size_t keyword_count = sizeof(keywords) / sizeof(keywords[0]);
+constexpr unsigned table_bits = 7;
+constexpr size_t table_size = size_t(1) << table_bits;
+static_assert(keyword_count < table_size, "grow table_bits");
+
+// The key packs the length with the first and the last two characters.
+// First and last alone cannot tell sampler1D from sampler2D.
+constexpr uint32_t key(std::string_view text) {
+  uint32_t size = static_cast<uint32_t>(text.size());
+  uint32_t first = static_cast<unsigned char>(text[0]);
+  uint32_t last = static_cast<unsigned char>(text[size - 1]);
+  uint32_t before_last =
+      size > 1 ? static_cast<unsigned char>(text[size - 2]) : 0;
+  return (size & 0xFF) | first << 8 | last << 16 | before_last << 24;
+}
+
+constexpr uint32_t slot(uint32_t key, uint32_t seed) {
+  return (key * seed) >> (32 - table_bits);
+}
+
+struct Table {
+  uint32_t seed = 0;
+  uint8_t slots[table_size] = {}; // keyword index + 1, 0 when empty
+};
+
+constexpr Table build() {
+  for (uint32_t seed = 0x9E3779B1u;; seed += 2) {
+    Table table;
+    table.seed = seed;
+    bool collision = false;
+    for (size_t i = 0; i < keyword_count && !collision; ++i) {
+      uint32_t s = slot(key(keywords[i].text), seed);
+      collision = table.slots[s] != 0;
+      table.slots[s] = static_cast<uint8_t>(i + 1);
+    }
+    if (!collision)
+      return table;
+  }
+}
+
+constexpr size_t max_length() {
+  size_t length = 0;
+  for (const Keyword &keyword : keywords)
+    length = keyword.text.size() > length ? keyword.text.size() : length;
+  return length;
+}
+
+inline constexpr Table table = build();
+} // namespace keyword_detail
+
+// Perfect-hash lookup: one multiply, one table load and one comparison.
+constexpr const Keyword *find_keyword(std::string_view text) {
+  using namespace keyword_detail;
+  if (text.empty() || text.size() > max_length())
+    return nullptr;
+  uint8_t index = table.slots[slot(key(text), table.seed)];
+  if (index == 0 || keywords[index - 1].text != text)
+    return nullptr;
+  return &keywords[index - 1];
+}
+
+// Names of the types GLSL provides, which need no definition anywhere.
+constexpr bool is_builtin_type(std::string_view text) {
+  const Keyword *keyword = find_keyword(text);
+  return keyword && keyword->type == TokenType::Type;
+}
+
+static_assert(find_keyword("sampler2D")->type == TokenType::Type);
+static_assert(find_keyword("@main")->type == TokenType::Main);
+static_assert(find_keyword("vec5") == nullptr);
@@ -0,0 +1,214 @@
+#include "lexer_scan.h"
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define HGL_SCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define HGL_SCAN_X86 0
+#endif
+
+namespace {
+template <uint8_t Classes> const char *scan_scalar(const char *p) {
+  while (is_char_class(*p, Classes))
+    p++;
+  return p;
+}
+
+constexpr ScanFunctions scalar_functions = {
+    scan_scalar<CharWhitespace>,
+    scan_scalar<CharAlpha | CharDigit | CharUnderscore>,
+    scan_scalar<CharDigit>,
+};
+
+#if HGL_SCAN_X86
+
+inline unsigned count_trailing_zeros(uint32_t mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+// The vector scanners only issue aligned loads. An aligned load never
+// crosses a page boundary, so reading the whole block that holds the NUL
+// sentinel is safe even when the source ends right at a mapping's edge.
+// Bytes before `p` in the first block are masked out.
+
+inline __m128i whitespace_sse2(__m128i v) {
+  __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+  __m128i tab = _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'));
+  __m128i cr = _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'));
+  return _mm_or_si128(space, _mm_or_si128(tab, cr));
+}
+
+inline __m128i digits_sse2(__m128i v) {
+  // Bytes >= 0x80 compare as negative and fall outside every range.
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+}
+
+inline __m128i identifier_sse2(__m128i v) {
+  __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+  __m128i underscore = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+  return _mm_or_si128(_mm_or_si128(alpha, digits_sse2(v)), underscore);
+}
+
+template <uint8_t Classes, __m128i (*Class)(__m128i)>
+const char *scan_sse2(const char *p) {
+  // Most runs are short; settle those with the lookup table before paying
+  // for a vector load.
+  for (int i = 0; i < 4; ++i, ++p) {
+    if (!is_char_class(*p, Classes))
+      return p;
+  }
+  size_t misalign = reinterpret_cast<uintptr_t>(p) & 15;
+  const char *block = p - misalign;
+  __m128i v = _mm_load_si128(reinterpret_cast<const __m128i *>(block));
+  uint32_t stop = ~static_cast<uint32_t>(_mm_movemask_epi8(Class(v))) &
+                  (0xFFFFu << misalign) & 0xFFFFu;
+  while (stop == 0) {
+    block += 16;
+    v = _mm_load_si128(reinterpret_cast<const __m128i *>(block));
+    stop = ~static_cast<uint32_t>(_mm_movemask_epi8(Class(v))) & 0xFFFFu;
+  }
+  return block + count_trailing_zeros(stop);
+}
+
+constexpr ScanFunctions sse2_functions = {
+    scan_sse2<CharWhitespace, whitespace_sse2>,
+    scan_sse2<CharAlpha | CharDigit | CharUnderscore, identifier_sse2>,
+    scan_sse2<CharDigit, digits_sse2>,
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HGL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define HGL_TARGET_AVX2
+#endif
+
+HGL_TARGET_AVX2 inline __m256i whitespace_avx2(__m256i v) {
+  __m256i space = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+  __m256i tab = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'));
+  __m256i cr = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'));
+  return _mm256_or_si256(space, _mm256_or_si256(tab, cr));
+}
+
+HGL_TARGET_AVX2 inline __m256i digits_avx2(__m256i v) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+}
+
+HGL_TARGET_AVX2 inline __m256i identifier_avx2(__m256i v) {
+  __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+  __m256i alpha =
+      _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                       _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+  __m256i underscore = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+  return _mm256_or_si256(_mm256_or_si256(alpha, digits_avx2(v)), underscore);
+}
+
+template <uint8_t Classes, __m256i (*Class)(__m256i)>
+HGL_TARGET_AVX2 const char *scan_avx2(const char *p) {
+  for (int i = 0; i < 4; ++i, ++p) {
+    if (!is_char_class(*p, Classes))
+      return p;
+  }
+  size_t misalign = reinterpret_cast<uintptr_t>(p) & 31;
+  const char *block = p - misalign;
+  __m256i v = _mm256_load_si256(reinterpret_cast<const __m256i *>(block));
+  uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(Class(v))) &
+                  (0xFFFFFFFFu << misalign);
+  while (stop == 0) {
+    block += 32;
+    v = _mm256_load_si256(reinterpret_cast<const __m256i *>(block));
+    stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(Class(v)));
+  }
+  return block + count_trailing_zeros(stop);
+}
+
+constexpr ScanFunctions avx2_functions = {
+    scan_avx2<CharWhitespace, whitespace_avx2>,
+    scan_avx2<CharAlpha | CharDigit | CharUnderscore, identifier_avx2>,
+    scan_avx2<CharDigit, digits_avx2>,
+};
+
+bool cpu_has_avx2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // HGL_SCAN_X86
+
+ScanImpl best_impl() {
+#if HGL_SCAN_X86
+  return cpu_has_avx2() ? ScanImpl::AVX2 : ScanImpl::SSE2;
+#else
+  return ScanImpl::Scalar;
+#endif
+}
+
+const ScanFunctions &functions_for(ScanImpl impl) {
+#if HGL_SCAN_X86
+  if (impl == ScanImpl::AVX2)
+    return avx2_functions;
+  if (impl == ScanImpl::SSE2)
+    return sse2_functions;
+#endif
+  return scalar_functions;
+}
+
+ScanImpl &selected_impl() {
+  static ScanImpl impl = best_impl();
+  return impl;
+}
+} // namespace
+
+const ScanFunctions &scan_functions() { return functions_for(selected_impl()); }
+
+ScanImpl scan_impl() { return selected_impl(); }
+
+bool scan_supported(ScanImpl impl) {
+  return static_cast<int>(impl) <= static_cast<int>(best_impl());
+}
+
+bool scan_select(ScanImpl impl) {
+  if (!scan_supported(impl))
+    return false;
+  selected_impl() = impl;
+  return true;
+}
+
+const char *scan_impl_name(ScanImpl impl) {
+  switch (impl) {
+  case ScanImpl::Scalar:
+    return "scalar";
+  case ScanImpl::SSE2:
+    return "sse2";
+  case ScanImpl::AVX2:
+    return "avx2";
+  }
+  return "unknown";
+}
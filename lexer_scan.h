@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+
+// Character-class scanners used by the Lexer. Each function returns a
+// pointer to the first byte at or after `p` that is not in its class. The
+// input must be NUL terminated; NUL is not a member of any class.
+struct ScanFunctions {
+  const char *(*whitespace)(const char *p); // ' ', '\t', '\r'
+  const char *(*identifier)(const char *p); // [A-Za-z0-9_]
+  const char *(*digits)(const char *p);     // [0-9]
+};
+
+enum class ScanImpl { Scalar = 0, SSE2 = 1, AVX2 = 2 };
+
+// The implementation picked for this CPU on first use.
+const ScanFunctions &scan_functions();
+ScanImpl scan_impl();
+bool scan_supported(ScanImpl impl);
+// Overrides the runtime choice, e.g. for benchmarking. Lexers constructed
+// afterwards use the new implementation.
+bool scan_select(ScanImpl impl);
+const char *scan_impl_name(ScanImpl impl);
+
+enum CharClass : uint8_t {
+  CharWhitespace = 1,
+  CharAlpha = 2,
+  CharDigit = 4,
+  CharUnderscore = 8,
+};
+
+struct CharClassTable {
+  uint8_t classes[256];
+  constexpr CharClassTable() : classes{} {
+    classes[static_cast<unsigned char>(' ')] = CharWhitespace;
+    classes[static_cast<unsigned char>('\t')] = CharWhitespace;
+    classes[static_cast<unsigned char>('\r')] = CharWhitespace;
+    for (int c = 'a'; c <= 'z'; ++c)
+      classes[c] = CharAlpha;
+    for (int c = 'A'; c <= 'Z'; ++c)
+      classes[c] = CharAlpha;
+    for (int c = '0'; c <= '9'; ++c)
+      classes[c] = CharDigit;
+    classes[static_cast<unsigned char>('_')] = CharUnderscore;
+  }
+};
+
+inline constexpr CharClassTable char_classes{};
+
+inline bool is_char_class(char c, uint8_t classes) {
+  return (char_classes.classes[static_cast<unsigned char>(c)] & classes) != 0;
+}
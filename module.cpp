@@ -0,0 +1,438 @@
+#include "module.h"
+#include "hash.h"
+#include "interner.h"
+#include "keywords.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source_file.h"
+#include "trace.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr char precompiled_magic[4] = {'H', 'G', 'L', 'C'};
+// Bump whenever NodeType or the layout below changes.
+constexpr uint32_t precompiled_version = 2;
+
+struct PrecompiledHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t content_hash;
+  uint32_t node_count;
+  uint32_t child_count;
+  uint32_t string_count;
+  uint32_t string_bytes;
+  uint32_t root;
+  uint32_t reserved;
+};
+
+// ASTNode with its value replaced by a string table index and explicit
+// padding, so files are byte-for-byte reproducible.
+struct PrecompiledNode {
+  uint8_t type;
+  uint8_t internal;
+  uint16_t reserved;
+  uint32_t value;
+  uint32_t first_child;
+  uint32_t child_count;
+};
+
+static_assert(sizeof(PrecompiledHeader) == 40, "PrecompiledHeader layout");
+static_assert(sizeof(PrecompiledNode) == 16, "PrecompiledNode layout");
+
+void collect_exports(Module &module) {
+  for (NodeId id : module.ast.children(module.root)) {
+    const ASTNode &node = module.ast[id];
+    switch (node.type) {
+    case NodeType::TypeDef:
+    case NodeType::FunctionDef:
+    case NodeType::OperatorOverload:
+    case NodeType::Let:
+      module.exports.emplace(node.value, id);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+std::string format_error(const std::string &path, const Diagnostic &d) {
+  char location[32] = "";
+  if (d.span.line != 0)
+    snprintf(location, sizeof(location), "%u:%u: ", d.span.line,
+             d.span.column);
+  return path + ":" + location + std::string(d.message);
+}
+
+} // namespace
+
+ModuleCache::ModuleCache(std::vector<std::string> search_paths,
+                         std::string precompiled_dir)
+    : search_paths(std::move(search_paths)),
+      precompiled_dir(std::move(precompiled_dir)) {}
+
+std::vector<std::shared_ptr<const Module>>
+ModuleCache::resolve_includes(const Ast &ast, NodeId root, const char *source,
+                              const std::string &from_dir,
+                              Diagnostics &diagnostics) {
+  std::vector<std::shared_ptr<const Module>> imports;
+  std::vector<std::string> loading;
+  resolve(ast, root, source, from_dir, diagnostics, loading, imports);
+  return imports;
+}
+
+ModuleCache::Stats ModuleCache::stats() const {
+  std::lock_guard<std::mutex> guard(mutex);
+  return counters;
+}
+
+void ModuleCache::resolve(const Ast &ast, NodeId root, const char *source,
+                          const std::string &from_dir,
+                          Diagnostics &diagnostics,
+                          std::vector<std::string> &loading,
+                          std::vector<std::shared_ptr<const Module>> &imports) {
+  if (root == NoNode)
+    return;
+  for (NodeId include : ast.children(root)) {
+    if (ast[include].type != NodeType::Include ||
+        ast[include].child_count != 2)
+      continue;
+    NodeId names = ast.child(include, 0);
+    NodeId target = ast.child(include, 1);
+    std::string_view name = ast.value(target);
+    SourceSpan span = locate(source, ast.offset_of(target),
+                             static_cast<uint32_t>(name.size()));
+
+    std::string module_name(name);
+    std::string path = find_module(module_name, from_dir);
+    if (path.empty()) {
+      diagnostics.report(Severity::Error, span, "cannot find module '%s'",
+                         module_name.c_str());
+      continue;
+    }
+
+    std::string error;
+    std::shared_ptr<const Module> module =
+        load(module_name, path, loading, error);
+    if (!module) {
+      diagnostics.report(Severity::Error, span, "%s", error.c_str());
+      continue;
+    }
+    if (module->error_count != 0) {
+      diagnostics.report(Severity::Error, span, "module '%s' has errors: %s",
+                         module_name.c_str(), module->first_error.c_str());
+      continue;
+    }
+
+    for (NodeId imported : ast.children(names)) {
+      Symbol symbol = ast[imported].value;
+      std::string_view text = ast.value(imported);
+      if (module->find(symbol) != NoNode || is_builtin_type(text))
+        continue;
+      diagnostics.report(Severity::Error,
+                         locate(source, ast.offset_of(imported),
+                                static_cast<uint32_t>(text.size())),
+                         "module '%s' has no definition named '%.*s'",
+                         module_name.c_str(), static_cast<int>(text.size()),
+                         text.data());
+    }
+    if (std::find(imports.begin(), imports.end(), module) == imports.end())
+      imports.push_back(std::move(module));
+  }
+}
+
+std::string ModuleCache::find_module(const std::string &name,
+                                     const std::string &from_dir) const {
+  std::error_code ec;
+  auto candidate = [&](const std::string &dir) -> std::string {
+    fs::path path = fs::path(dir) / (name + ".hgl");
+    if (!fs::is_regular_file(path, ec))
+      return {};
+    fs::path canonical = fs::weakly_canonical(path, ec);
+    return ec ? path.string() : canonical.string();
+  };
+
+  std::string path = candidate(from_dir.empty() ? "." : from_dir);
+  for (size_t i = 0; path.empty() && i < search_paths.size(); ++i)
+    path = candidate(search_paths[i]);
+  return path;
+}
+
+std::shared_ptr<const Module>
+ModuleCache::load(const std::string &name, const std::string &path,
+                  std::vector<std::string> &loading, std::string &error) {
+  if (std::find(loading.begin(), loading.end(), path) != loading.end()) {
+    error = "include cycle:";
+    for (const std::string &p : loading)
+      error += " " + fs::path(p).stem().string() + " ->";
+    error += " " + name;
+    return nullptr;
+  }
+
+  std::error_code ec;
+  uintmax_t file_size = fs::file_size(path, ec);
+  fs::file_time_type write_time = fs::last_write_time(path, ec);
+  if (ec) {
+    error = "could not read module '" + name + "' at " + path;
+    return nullptr;
+  }
+
+  auto cached = [&]() -> std::shared_ptr<const Module> {
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = entries.find(path);
+    if (it == entries.end() || it->second.file_size != file_size ||
+        it->second.write_time != write_time ||
+        !imports_current(*it->second.module))
+      return nullptr;
+    counters.memory_hits++;
+    return it->second.module;
+  };
+  if (auto module = cached())
+    return module;
+
+  // Only the outermost load takes the lock; nested loads already hold it.
+  std::unique_lock<std::mutex> load_guard(load_mutex, std::defer_lock);
+  if (loading.empty()) {
+    load_guard.lock();
+    if (auto module = cached())
+      return module;
+  }
+
+  SourceFile source;
+  if (!source.open(path.c_str())) {
+    error = "could not read module '" + name + "' at " + path;
+    return nullptr;
+  }
+  uint64_t hash = hash_bytes(source.data(), source.size());
+
+  {
+    // Touched but unchanged: keep the parsed module.
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = entries.find(path);
+    if (it != entries.end() && it->second.module->content_hash == hash &&
+        imports_current(*it->second.module)) {
+      it->second.file_size = file_size;
+      it->second.write_time = write_time;
+      counters.memory_hits++;
+      return it->second.module;
+    }
+  }
+
+  auto module = std::make_shared<Module>();
+  module->name = name;
+  module->path = path;
+  module->content_hash = hash;
+
+  Diagnostics diagnostics;
+  std::string cache_file;
+  if (!precompiled_dir.empty()) {
+    cache_file = precompiled_path(name, hash);
+    module->from_precompiled =
+        read_precompiled_module(cache_file, hash, *module);
+  }
+  // A precompiled module no longer has its source at hand; it was error
+  // free when written, so only a changed include can fail below.
+  const char *text = module->from_precompiled ? nullptr : source.data();
+  if (!module->from_precompiled) {
+    TRACE_INFO("Parsing module %s", path.c_str());
+    Lexer lexer{source.data()};
+    Parser parser{lexer, module->ast, diagnostics};
+    module->root = parser.parse();
+  }
+  collect_exports(*module);
+
+  loading.push_back(path);
+  resolve(module->ast, module->root, text,
+          fs::path(path).parent_path().string(), diagnostics, loading,
+          module->imports);
+  loading.pop_back();
+
+  module->error_count = diagnostics.error_count();
+  for (const Diagnostic &d : diagnostics.all()) {
+    if (d.severity == Severity::Error) {
+      module->first_error = format_error(path, d);
+      break;
+    }
+  }
+  if (!cache_file.empty() && !module->from_precompiled &&
+      module->error_count == 0)
+    write_precompiled_module(*module, cache_file);
+
+  std::lock_guard<std::mutex> guard(mutex);
+  if (module->from_precompiled)
+    counters.precompiled_hits++;
+  else
+    counters.parsed++;
+  Entry &entry = entries[path];
+  entry.module = module;
+  entry.file_size = file_size;
+  entry.write_time = write_time;
+  return module;
+}
+
+bool ModuleCache::is_current(const Module &module) const {
+  // A module another load has since replaced is stale too.
+  auto it = entries.find(module.path);
+  if (it == entries.end() || it->second.module.get() != &module)
+    return false;
+  std::error_code ec;
+  uintmax_t file_size = fs::file_size(module.path, ec);
+  if (ec || file_size != it->second.file_size)
+    return false;
+  fs::file_time_type write_time = fs::last_write_time(module.path, ec);
+  if (ec || write_time != it->second.write_time)
+    return false;
+  return imports_current(module);
+}
+
+bool ModuleCache::imports_current(const Module &module) const {
+  for (const std::shared_ptr<const Module> &import : module.imports) {
+    if (!is_current(*import))
+      return false;
+  }
+  return true;
+}
+
+std::string ModuleCache::precompiled_path(const std::string &name,
+                                          uint64_t hash) const {
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "-%016" PRIx64 ".hglc", hash);
+  return (fs::path(precompiled_dir) / (name + suffix)).string();
+}
+
+bool write_precompiled_module(const Module &module, const std::string &path) {
+  const Ast &ast = module.ast;
+
+  // String table: index 0 is the empty string, shared by NoSymbol.
+  std::unordered_map<Symbol, uint32_t> indices{{NoSymbol, 0}};
+  std::vector<uint32_t> string_offsets{0, 0};
+  std::string strings;
+  std::vector<PrecompiledNode> nodes(ast.size());
+  for (size_t i = 0; i < ast.size(); ++i) {
+    const ASTNode &node = ast.node_data()[i];
+    auto [it, inserted] = indices.emplace(
+        node.value, static_cast<uint32_t>(string_offsets.size() - 1));
+    if (inserted) {
+      strings += symbol_text(node.value);
+      string_offsets.push_back(static_cast<uint32_t>(strings.size()));
+    }
+    nodes[i] = PrecompiledNode{static_cast<uint8_t>(node.type),
+                               static_cast<uint8_t>(node.internal), 0,
+                               it->second, node.first_child,
+                               node.child_count};
+  }
+  strings.resize((strings.size() + 3) & ~size_t(3), '\0');
+
+  PrecompiledHeader header{};
+  std::memcpy(header.magic, precompiled_magic, sizeof(header.magic));
+  header.version = precompiled_version;
+  header.content_hash = module.content_hash;
+  header.node_count = static_cast<uint32_t>(ast.size());
+  header.child_count = static_cast<uint32_t>(ast.child_index_count());
+  header.string_count = static_cast<uint32_t>(string_offsets.size() - 1);
+  header.string_bytes = static_cast<uint32_t>(strings.size());
+  header.root = module.root;
+
+  std::error_code ec;
+  fs::create_directories(fs::path(path).parent_path(), ec);
+  // Write next to the target and rename, so concurrent readers see either
+  // no file or a complete one.
+  std::string temp =
+      path + ".tmp" +
+      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  FILE *file = fopen(temp.c_str(), "wb");
+  if (!file)
+    return false;
+  bool ok =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      fwrite(nodes.data(), sizeof(PrecompiledNode), nodes.size(), file) ==
+          nodes.size() &&
+      fwrite(ast.offset_data(), sizeof(uint32_t), ast.size(), file) ==
+          ast.size() &&
+      fwrite(ast.child_data(), sizeof(NodeId), ast.child_index_count(),
+             file) == ast.child_index_count() &&
+      fwrite(string_offsets.data(), sizeof(uint32_t), string_offsets.size(),
+             file) == string_offsets.size() &&
+      fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+  ok = fclose(file) == 0 && ok;
+  if (ok)
+    fs::rename(temp, path, ec);
+  if (!ok || ec) {
+    fs::remove(temp, ec);
+    return false;
+  }
+  return true;
+}
+
+bool read_precompiled_module(const std::string &path, uint64_t content_hash,
+                             Module &module) {
+  SourceFile file;
+  if (!file.open(path.c_str()) || file.size() < sizeof(PrecompiledHeader))
+    return false;
+
+  PrecompiledHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, precompiled_magic, sizeof(header.magic)) != 0 ||
+      header.version != precompiled_version ||
+      header.content_hash != content_hash)
+    return false;
+
+  uint64_t expected = sizeof(header) +
+                      uint64_t(header.node_count) * sizeof(PrecompiledNode) +
+                      uint64_t(header.node_count) * sizeof(uint32_t) +
+                      uint64_t(header.child_count) * sizeof(NodeId) +
+                      (uint64_t(header.string_count) + 1) * sizeof(uint32_t) +
+                      header.string_bytes;
+  if (file.size() != expected || header.root >= header.node_count)
+    return false;
+
+  // The mapping is page aligned and every section is a multiple of four
+  // bytes, so the arrays can be read in place.
+  const char *cursor = file.data() + sizeof(header);
+  auto *nodes = reinterpret_cast<const PrecompiledNode *>(cursor);
+  cursor += header.node_count * sizeof(PrecompiledNode);
+  auto *offsets = reinterpret_cast<const uint32_t *>(cursor);
+  cursor += header.node_count * sizeof(uint32_t);
+  auto *children = reinterpret_cast<const NodeId *>(cursor);
+  cursor += header.child_count * sizeof(NodeId);
+  auto *string_offsets = reinterpret_cast<const uint32_t *>(cursor);
+  cursor += (header.string_count + 1) * sizeof(uint32_t);
+  const char *strings = cursor;
+
+  std::vector<Symbol> symbols(header.string_count);
+  for (uint32_t i = 0; i < header.string_count; ++i) {
+    uint32_t begin = string_offsets[i], end = string_offsets[i + 1];
+    if (begin > end || end > header.string_bytes)
+      return false;
+    symbols[i] = intern(std::string_view(strings + begin, end - begin));
+  }
+
+  std::vector<ASTNode> converted(header.node_count);
+  for (uint32_t i = 0; i < header.node_count; ++i) {
+    const PrecompiledNode &node = nodes[i];
+    if (node.type > static_cast<uint8_t>(NodeType::Variant) ||
+        node.value >= header.string_count ||
+        uint64_t(node.first_child) + node.child_count > header.child_count)
+      return false;
+    converted[i].type = static_cast<NodeType>(node.type);
+    converted[i].internal = node.internal != 0;
+    converted[i].value = symbols[node.value];
+    converted[i].first_child = node.first_child;
+    converted[i].child_count = node.child_count;
+  }
+  for (uint32_t i = 0; i < header.child_count; ++i) {
+    if (children[i] >= header.node_count)
+      return false;
+  }
+
+  module.ast.assign(converted.data(), offsets, converted.size(), children,
+                    header.child_count);
+  module.root = header.root;
+  return true;
+}
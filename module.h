@@ -0,0 +1,105 @@
+#pragma once
+#include "ast_node.h"
+#include "diagnostics.h"
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A parsed .hgl file that other files reach through
+// `@include (names...) -> module`. Modules are immutable once loaded and
+// may be shared between compilations and threads.
+struct Module {
+  std::string name;
+  std::string path;
+  uint64_t content_hash = 0;
+  Ast ast;
+  NodeId root = NoNode;
+  // Top-level data types, functions, operators and lets by name.
+  // Operators are keyed by their BinOp name, e.g. "Plus".
+  std::unordered_map<Symbol, NodeId> exports;
+  // Modules this one includes, already loaded.
+  std::vector<std::shared_ptr<const Module>> imports;
+  bool from_precompiled = false;
+  size_t error_count = 0;
+  // First problem found while loading, formatted as "path:line:col: msg".
+  std::string first_error;
+
+  NodeId find(Symbol name) const {
+    auto it = exports.find(name);
+    return it != exports.end() ? it->second : NoNode;
+  }
+};
+
+// Loads and caches modules by resolved path and content hash, so each
+// module is lexed and parsed at most once per process no matter how many
+// files include it. Optionally backed by an on-disk directory of
+// precompiled modules (.hglc) that are memory-mapped and used without
+// parsing. Thread-safe.
+class ModuleCache {
+public:
+  explicit ModuleCache(std::vector<std::string> search_paths,
+                       std::string precompiled_dir = {});
+
+  // Loads every module included by `root` (and what those include) and
+  // checks that each imported name exists. Problems are reported to
+  // `diagnostics` at the @include that caused them; `source` is the text
+  // `ast` was parsed from and is only read to locate those.
+  std::vector<std::shared_ptr<const Module>>
+  resolve_includes(const Ast &ast, NodeId root, const char *source,
+                   const std::string &from_dir, Diagnostics &diagnostics);
+
+  struct Stats {
+    size_t parsed = 0;
+    size_t precompiled_hits = 0;
+    size_t memory_hits = 0;
+  };
+  Stats stats() const;
+
+private:
+  struct Entry {
+    std::shared_ptr<const Module> module;
+    uintmax_t file_size = 0;
+    std::filesystem::file_time_type write_time;
+  };
+
+  // Loads the includes of `root` into `imports`, reporting problems to
+  // `diagnostics`. Shared by top-level files and modules.
+  void resolve(const Ast &ast, NodeId root, const char *source,
+               const std::string &from_dir, Diagnostics &diagnostics,
+               std::vector<std::string> &loading,
+               std::vector<std::shared_ptr<const Module>> &imports);
+  std::string find_module(const std::string &name,
+                          const std::string &from_dir) const;
+  std::shared_ptr<const Module> load(const std::string &name,
+                                     const std::string &path,
+                                     std::vector<std::string> &loading,
+                                     std::string &error);
+  std::string precompiled_path(const std::string &name, uint64_t hash) const;
+  // Whether the cached `module` and everything it includes still match
+  // their files. Called with `mutex` held.
+  bool is_current(const Module &module) const;
+  bool imports_current(const Module &module) const;
+
+  std::vector<std::string> search_paths;
+  std::string precompiled_dir;
+  // Guards `entries` and `counters`.
+  mutable std::mutex mutex;
+  // Held by the outermost load that misses the cache, so a module is parsed
+  // once even when several threads include it at the same time.
+  std::mutex load_mutex;
+  std::unordered_map<std::string, Entry> entries;
+  Stats counters;
+};
+
+// Precompiled module format: a header followed by the flat node and child
+// arrays, node source offsets and a string table for node values. Symbols are
+// process-local, so node values are stored as string table indices and
+// re-interned on load. Written in native byte order; a cache directory is
+// not meant to move between machines of different endianness.
+bool write_precompiled_module(const Module &module, const std::string &path);
+bool read_precompiled_module(const std::string &path, uint64_t content_hash,
+                             Module &module);
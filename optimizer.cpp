@@ -0,0 +1,71 @@
+#include "optimizer.h"
+#include "constant_folder.h"
+#include "dead_code_eliminator.h"
+#include "inliner.h"
+#include "shader_program.h"
+#include "subexpression_merger.h"
+
+namespace {
+
+// Type-checks the program as it is now, or returns null if it has errors.
+std::unique_ptr<ShaderProgram>
+check(const Ast &ast, NodeId root, const char *source,
+      const std::vector<std::shared_ptr<const Module>> &imports,
+      Diagnostics &diagnostics) {
+  auto program = std::make_unique<ShaderProgram>(diagnostics);
+  if (!program->collect(ast, root, source, imports))
+    return nullptr;
+  for (const AstRef &entry : program->entries) {
+    StageInfo info;
+    if (!program->analyze_stage(entry, info))
+      return nullptr;
+  }
+  return program;
+}
+
+} // namespace
+
+void optimize(Ast &ast, NodeId root, const char *source,
+              const std::vector<std::shared_ptr<const Module>> &imports,
+              const OptimizerOptions &options) {
+  optimize_shared(ast, root, source, imports, options);
+  optimize_specialized(ast, root, source, imports, options);
+}
+
+void optimize_shared(Ast &ast, NodeId root, const char *source,
+                     const std::vector<std::shared_ptr<const Module>> &imports,
+                     const OptimizerOptions &options) {
+  if (options.inline_size == 0)
+    return;
+  // Passes need every node typed; errors are the backend's to report.
+  Diagnostics ignored;
+  auto program = check(ast, root, source, imports, ignored);
+  if (program)
+    Inliner(ast, *program, options.inline_size).run();
+}
+
+void optimize_specialized(
+    Ast &ast, NodeId root, const char *source,
+    const std::vector<std::shared_ptr<const Module>> &imports,
+    const OptimizerOptions &options) {
+  Diagnostics ignored;
+  auto program = check(ast, root, source, imports, ignored);
+  if (!program)
+    return;
+
+  // Each pass that changes the tree is followed by a fresh check, so the
+  // next one sees types for the nodes it made.
+  if (ConstantFolder(ast, *program, options.fast_math).run() != 0) {
+    program = check(ast, root, source, imports, ignored);
+    if (!program)
+      return;
+  }
+  if (options.eliminate_dead_code &&
+      DeadCodeEliminator(ast, root, *program).run() != 0) {
+    program = check(ast, root, source, imports, ignored);
+    if (!program)
+      return;
+  }
+  if (options.merge_subexpressions)
+    SubexpressionMerger(ast, *program).run();
+}
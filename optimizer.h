@@ -0,0 +1,38 @@
+#pragma once
+#include "ast_node.h"
+#include "module.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct OptimizerOptions {
+  // Allow rewrites that do not hold for NaN and infinity, e.g. x * 0 = 0.
+  bool fast_math = false;
+  // Largest function body, in AST nodes, inlined at every call; 0 turns
+  // inlining off.
+  uint32_t inline_size = 12;
+  // Remove let bindings, functions, constants, attributes and uniforms
+  // that no stage uses.
+  bool eliminate_dead_code = true;
+  // Compute repeated expressions once, in a let binding.
+  bool merge_subexpressions = true;
+};
+
+// Rewrites the functions, constants and entry points of `ast` in place
+// before a backend emits it; imported modules are left as they are. A
+// program that does not type-check is left untouched, for the backend to
+// report. `source` is the text `ast` was parsed from.
+void optimize(Ast &ast, NodeId root, const char *source,
+              const std::vector<std::shared_ptr<const Module>> &imports,
+              const OptimizerOptions &options);
+
+// optimize() in two halves. The first (inlining) does not depend on the
+// values of constants, so variants of one program can run it once and
+// share the result; the second folds and cleans up after it.
+void optimize_shared(Ast &ast, NodeId root, const char *source,
+                     const std::vector<std::shared_ptr<const Module>> &imports,
+                     const OptimizerOptions &options);
+void optimize_specialized(
+    Ast &ast, NodeId root, const char *source,
+    const std::vector<std::shared_ptr<const Module>> &imports,
+    const OptimizerOptions &options);
@@ -0,0 +1,134 @@
+#include "parallel_parse.h"
+#include "lexer.h"
+#include "lexer_scan.h"
+#include "parser.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+bool starts_top_level(char c) {
+  return is_char_class(c, CharAlpha) || c == '@' || c == '(';
+}
+
+bool is_blank(const char *begin, const char *end) {
+  for (const char *p = begin; p < end; ++p) {
+    if (*p != ' ' && *p != '\t' && *p != '\r')
+      return false;
+  }
+  return true;
+}
+
+struct ChunkResult {
+  explicit ChunkResult(size_t bytes) : ast(bytes) {}
+  Ast ast;
+  Diagnostics diagnostics;
+  NodeId root = NoNode;
+  std::unordered_map<Symbol, std::vector<NodeId>> pending;
+};
+
+// Gives `def` the signatures that reached it from earlier chunks. They go
+// after the ones from its own chunk and before the parameters and body,
+// where a single Parser would have put them.
+void attach_signatures(Ast &ast, NodeId def,
+                       const std::vector<NodeId> &signatures) {
+  NodeRange children = ast.children(def);
+  std::vector<NodeId> joined(children.begin(), children.end() - 2);
+  joined.insert(joined.end(), signatures.rbegin(), signatures.rend());
+  for (NodeId signature : signatures)
+    ast[def].internal |= ast[signature].internal;
+  joined.insert(joined.end(), children.end() - 2, children.end());
+  ast.set_children(def, joined.data(), joined.size());
+}
+
+} // namespace
+
+std::vector<SourceChunk> split_top_level(const char *source, size_t size,
+                                         size_t target_bytes) {
+  std::vector<SourceChunk> chunks;
+  SourceChunk current;
+  uint32_t line = 1;
+  bool blank_before = false;
+  size_t begin = 0;
+  while (begin < size) {
+    const void *newline = std::memchr(source + begin, '\n', size - begin);
+    size_t end =
+        newline ? static_cast<const char *>(newline) - source : size;
+    if (blank_before && begin - current.begin >= target_bytes &&
+        starts_top_level(source[begin])) {
+      current.end = static_cast<uint32_t>(begin);
+      chunks.push_back(current);
+      current = SourceChunk{static_cast<uint32_t>(begin), 0, line};
+    }
+    blank_before = is_blank(source + begin, source + end);
+    begin = end + 1;
+    line++;
+  }
+  current.end = static_cast<uint32_t>(size);
+  chunks.push_back(current);
+  return chunks;
+}
+
+NodeId parse_parallel(const char *source, size_t size, Ast &ast,
+                      Diagnostics &diagnostics, ThreadPool &pool) {
+  std::vector<SourceChunk> chunks;
+  if (size >= parallel_parse_min_bytes && pool.size() > 1) {
+    // A few chunks per worker, so stealing can even out declarations of
+    // very different sizes.
+    size_t target = std::max<size_t>(size / (pool.size() * 4), 16 * 1024);
+    chunks = split_top_level(source, size, target);
+  }
+  if (chunks.size() < 2) {
+    Lexer lexer{source};
+    Parser parser{lexer, ast, diagnostics};
+    return parser.parse();
+  }
+
+  std::vector<std::unique_ptr<ChunkResult>> results(chunks.size());
+  pool.parallel_for(chunks.size(), [&](size_t index, size_t) {
+    const SourceChunk &chunk = chunks[index];
+    auto result = std::make_unique<ChunkResult>(chunk.end - chunk.begin);
+    Lexer lexer{source, chunk.begin, chunk.end, chunk.line};
+    Parser parser{lexer, result->ast, result->diagnostics};
+    result->root = parser.parse();
+    result->pending = parser.take_pending_signatures();
+    results[index] = std::move(result);
+  });
+
+  // Merge in source order. Signatures left over by one chunk belong to the
+  // first FunctionDef of that name in a later chunk.
+  std::unordered_map<Symbol, std::vector<NodeId>> pending;
+  std::unordered_set<Symbol> defined;
+  std::vector<NodeId> declarations;
+  for (const std::unique_ptr<ChunkResult> &result : results) {
+    NodeId base = ast.append(result->ast);
+    defined.clear();
+    for (NodeId child : result->ast.children(result->root)) {
+      NodeId id = child + base;
+      declarations.push_back(id);
+      if (pending.empty() || ast[id].type != NodeType::FunctionDef ||
+          !defined.insert(ast[id].value).second)
+        continue;
+      auto it = pending.find(ast[id].value);
+      if (it != pending.end()) {
+        attach_signatures(ast, id, it->second);
+        pending.erase(it);
+      }
+    }
+    for (auto &[name, signatures] : result->pending) {
+      std::vector<NodeId> &merged = pending[name];
+      for (NodeId signature : signatures)
+        merged.push_back(signature + base);
+    }
+    diagnostics.append(result->diagnostics);
+  }
+
+  NodeId program = ast.add(NodeType::Program);
+  ast.set_children(program, declarations.data(), declarations.size());
+  ast.root = program;
+  return program;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "ast_node.h"
+#include "diagnostics.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Files smaller than this are parsed on the calling thread; below it the
+// pre-scan and merge cost more than they save.
+constexpr size_t parallel_parse_min_bytes = 256 * 1024;
+
+struct SourceChunk {
+  uint32_t begin = 0;
+  uint32_t end = 0;
+  uint32_t line = 1;
+};
+
+// Splits `source` into runs of whole top-level declarations of roughly
+// `target_bytes` each. A chunk may only start on a line that follows a
+// blank line and begins in the first column, where no declaration can
+// continue.
+std::vector<SourceChunk> split_top_level(const char *source, size_t size,
+                                         size_t target_bytes);
+
+// Parses `source` into `ast` like Parser::parse, with the top-level chunks
+// parsed concurrently on `pool` into their own trees and merged in source
+// order. Type signatures are joined to FunctionDefs across chunks, and
+// diagnostics come out in source order. Falls back to a plain parse for
+// small files or a single-threaded pool.
+NodeId parse_parallel(const char *source, size_t size, Ast &ast,
+                      Diagnostics &diagnostics, ThreadPool &pool);
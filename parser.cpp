@@ -1,7 +1,9 @@
 #include "parser.h"
 #include "ast_node.h"
 #include "token.h"
-#include <iostream>
+#include "trace.h"
+#include <cstdarg>
+#include <string>
 #include <vector>
 
 int Parser::get_precedence(TokenType type) const {
@@ -90,10 +92,28 @@ constexpr const char *token_to_string(TokenType type) {
     return "List";
   case TokenType::Internal:
     return "Internal";
+  case TokenType::Variant:
+    return "Variant";
   case TokenType::GreaterThan:
     return "GreaterThan";
   case TokenType::LessThan:
     return "LessThan";
+  case TokenType::GreaterOrEqualsThan:
+    return "GreaterOrEqualsThan";
+  case TokenType::LessOrEqualsThan:
+    return "LessOrEqualsThan";
+  case TokenType::Dot:
+    return "Dot";
+  case TokenType::Equality:
+    return "Equality";
+  case TokenType::Main:
+    return "Main";
+  case TokenType::Let:
+    return "Let";
+  case TokenType::Vertex:
+    return "Vertex";
+  case TokenType::Fragment:
+    return "Fragment";
   default:
     return "Unknown TokenType";
   }
@@ -101,9 +121,7 @@ constexpr const char *token_to_string(TokenType type) {
 
 #define NOT_IMPLEMENTED(str)                                                   \
   do {                                                                         \
-    std::cerr << "[NOT IMPLEMENTED] " << __FUNCTION__ << " at " << __FILE__    \
-              << ":" << __LINE__ << " : " << str << std::endl;                 \
-    std::exit(1);                                                              \
+    error_here("not implemented in %s: %s", __FUNCTION__, str);               \
   } while (0)
 
 bool Parser::is_primary(TokenType kind) {
@@ -116,12 +134,32 @@ bool Parser::is_binary(TokenType kind) {
          kind == TokenType::Multiply || kind == TokenType::Divide;
 }
 
-void Parser::advance() { current_token = lexer.next(); }
+void Parser::advance() {
+  // Nodes are added once their tokens are consumed, so they are located at
+  // the last token consumed.
+  ast.set_location(current_token.offset);
+  current_token = lexer.next();
+}
+
+void Parser::error_here(const char *format, ...) {
+  // Only the first error of a cascade is worth reporting; the rest are
+  // swallowed until the parser resynchronizes.
+  if (!panicking) {
+    va_list args;
+    va_start(args, format);
+    diagnostics.vreport(Severity::Error, span_of(current_token), format, args);
+    va_end(args);
+  }
+  panicking = true;
+}
 
 Token Parser::consume(TokenType expected) {
   if (current_token.type != expected) {
-    throw std::runtime_error("Unexpected Token: '" + current_token.data +
-                             "', expected: " + token_to_string(expected));
+    std::string_view text = lexer.text(current_token);
+    error_here("unexpected %s '%.*s', expected %s",
+               token_to_string(current_token.type), (int)text.size(),
+               text.data(), token_to_string(expected));
+    return current_token;
   }
 
   Token consumed = current_token;
@@ -129,269 +167,293 @@ Token Parser::consume(TokenType expected) {
   return consumed;
 }
 
-ASTNode *Parser::parse_list() {
-  auto root = new ASTNode();
-  root->type = NodeType::List;
-  root->value = "List";
+// Names of types may be builtin (lexed as Type) or user-defined.
+Token Parser::consume_name() {
+  if (current_token.type == TokenType::Type)
+    return consume(TokenType::Type);
+  return consume(TokenType::Identifier);
+}
+
+bool Parser::until(TokenType terminator) const {
+  return current_token.type != terminator &&
+         current_token.type != TokenType::End && !panicking;
+}
+
+void Parser::recover_line(TokenType closing) {
+  if (!panicking)
+    return;
+  while (current_token.type != TokenType::NewLine &&
+         current_token.type != closing &&
+         current_token.type != TokenType::End) {
+    advance();
+  }
+  panicking = false;
+}
+
+static bool starts_declaration(TokenType type) {
+  switch (type) {
+  case TokenType::Data:
+  case TokenType::Input:
+  case TokenType::Output:
+  case TokenType::Include:
+  case TokenType::Main:
+  case TokenType::Internal:
+  case TokenType::Let:
+  case TokenType::Variant:
+  case TokenType::Identifier:
+  case TokenType::LeftParen:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void Parser::synchronize() {
+  // Skip to the start of the next top-level declaration: a line that begins
+  // in the first column with a declaration keyword or name. A closing brace
+  // in the first column ends the broken block and is skipped with it.
+  while (current_token.type != TokenType::End) {
+    if (current_token.type == TokenType::NewLine) {
+      Token next = lexer.peek();
+      if (next.column == 1 && starts_declaration(next.type)) {
+        advance();
+        break;
+      }
+    } else if (current_token.type == TokenType::RightBrace &&
+               current_token.column == 1) {
+      advance();
+      break;
+    }
+    advance();
+  }
+  panicking = false;
+}
+
+NodeId Parser::error_node() { return ast.add(NodeType::Error); }
+
+NodeId Parser::parse_list() {
+  NodeId root = ast.add(NodeType::List, "List");
+  size_t mark = ast.mark();
   consume(TokenType::LeftParen);
-  while (current_token.type != TokenType::RightParen) {
-    Token identifier = consume(TokenType::Identifier);
+  while (until(TokenType::RightParen)) {
+    Token identifier = consume_name();
     if (current_token.type == TokenType::Comma) {
-      printf("parse_list : Comma\n");
+      TRACE_DEBUG("parse_list : Comma");
       consume(TokenType::Comma);
     }
-    auto import = new ASTNode();
-    import->type = NodeType::Identifier;
-    import->value = identifier.data;
-    root->children.emplace_back(import);
+    ast.push(ast.add(NodeType::Identifier, lexer.text(identifier)));
   }
   consume(TokenType::RightParen);
+  ast.set_children(root, mark);
   return root;
 }
 
-ASTNode *Parser::parse_let_binding() {
+NodeId Parser::parse_let_binding() {
   Token name = consume(TokenType::Identifier);
   consume(TokenType::Equals);
-  ASTNode *expr = parse_expression(0);
+  NodeId expr = parse_expression(0);
 
-  auto binding = new ASTNode{NodeType::LetBinding, name.data};
-  binding->children.push_back(expr);
-  return binding;
+  return ast.add(NodeType::LetBinding, lexer.text(name), {expr});
 }
 
-ASTNode *Parser::parse_let_in_expr() {
-  auto root = new ASTNode{};
-  root->type = NodeType::LetInExpr;
+NodeId Parser::parse_let_in_expr() {
+  size_t mark = ast.mark();
   consume(TokenType::Let);
-  Token identifier = consume(TokenType::Identifier);
-  root->value = identifier.data;
-  consume(TokenType::Equals);
+  Token identifier = current_token;
+  NodeId root = ast.add(NodeType::LetInExpr, lexer.text(identifier));
 
-  auto binding = new ASTNode{NodeType::LetBinding, identifier.data};
-  binding->children.push_back(parse_expression(0));
+  ast.push(parse_let_binding());
+  recover_line(TokenType::Input);
   consume(TokenType::NewLine);
 
-  root->children.push_back(binding);
-
-  while (current_token.type != TokenType::Input) {
-    if (current_token.type == TokenType::NewLine)
-      consume(TokenType::NewLine);
-    Token identifier = consume(TokenType::Identifier);
-    consume(TokenType::Equals);
-    auto expr = parse_expression(0);
-    auto binding = new ASTNode{NodeType::LetBinding, identifier.data};
-    binding->children.push_back(expr);
-    root->children.emplace_back(binding);
-    if (current_token.type == TokenType::NewLine)
+  while (until(TokenType::Input)) {
+    if (current_token.type == TokenType::NewLine) {
       consume(TokenType::NewLine);
+      continue;
+    }
+    ast.push(parse_let_binding());
+    // A broken binding only costs that line.
+    recover_line(TokenType::Input);
   }
 
-  auto in = new ASTNode{};
-  in->type = NodeType::Input;
   consume(TokenType::Input);
   Token a = consume(TokenType::Identifier);
   Token b = consume(TokenType::Identifier);
-  in->children.push_back(new ASTNode{NodeType::Identifier, a.data});
-  in->children.push_back(new ASTNode{NodeType::Identifier, b.data});
-  root->children.push_back(in);
+  NodeId in = ast.add(NodeType::Input, {},
+                      {ast.add(NodeType::Identifier, lexer.text(a)),
+                       ast.add(NodeType::Identifier, lexer.text(b))});
+  ast.push(in);
 
+  ast.set_children(root, mark);
   return root;
 }
 
-ASTNode *Parser::parse_main_function() {
-  auto root = new ASTNode{};
+NodeId Parser::parse_main_function() {
   consume(TokenType::Main);
-  root->type = NodeType::EntryPoint;
   Token t = consume(TokenType::Identifier);
-  root->value = t.data;
+  NodeId root = ast.add(NodeType::EntryPoint, lexer.text(t));
   consume(TokenType::Equals);
   if (current_token.type == TokenType::NewLine)
     consume(TokenType::NewLine);
-  if (current_token.type == TokenType::Let) {
-    root->children.emplace_back(parse_let_in_expr());
-  }
+  NodeId body = current_token.type == TokenType::Let ? parse_let_in_expr()
+                                                      : parse_expression(0);
+  ast.set_children(root, &body, 1);
 
   return root;
 }
 
-ASTNode *Parser::parse_input() {
+NodeId Parser::parse_field_type() {
+  if (current_token.type == TokenType::Type ||
+      current_token.type == TokenType::Identifier) {
+    Token type = consume_name();
+    return ast.add(NodeType::FieldType, lexer.text(type));
+  }
+  error_here("expected a type, found %s", token_to_string(current_token.type));
+  return error_node();
+}
+
+NodeId Parser::parse_input() {
   consume(TokenType::Input);
-  auto root = new ASTNode{};
-  root->type = NodeType::Input;
+  size_t mark = ast.mark();
   auto identifier = consume(TokenType::Identifier);
+  NodeId root = ast.add(NodeType::Input, lexer.text(identifier));
   consume(TokenType::DoubleColon);
   consume(TokenType::LeftBrace);
   consume(TokenType::NewLine);
-  root->value = identifier.data;
-  while (current_token.type != TokenType::RightBrace) {
+  while (until(TokenType::RightBrace)) {
     if (current_token.type == TokenType::Uniforms) {
       consume(TokenType::Uniforms);
       consume(TokenType::DoubleColon);
       consume(TokenType::LeftBrace);
       consume(TokenType::NewLine);
-      auto uniforms = new ASTNode{};
-      uniforms->type = NodeType::Uniform;
-      uniforms->value = "Uniforms";
-      while (current_token.type != TokenType::RightBrace) {
-        auto sub_type = new ASTNode{};
-        sub_type->type = NodeType::Field;
+      NodeId uniforms = ast.add(NodeType::Uniform, "Uniforms");
+      size_t uniforms_mark = ast.mark();
+      while (until(TokenType::RightBrace)) {
         Token sub_ident = consume(TokenType::Identifier);
-        sub_type->value = sub_ident.data;
+        NodeId sub_type = ast.add(NodeType::Field, lexer.text(sub_ident));
         consume(TokenType::DoubleColon);
-        // complex type
-        if (current_token.type == TokenType::Identifier) {
-          Token field_type = consume(TokenType::Identifier);
-          auto sub = new ASTNode{};
-          sub->value = field_type.data;
-          sub->type = NodeType::FieldType;
-          sub_type->children.emplace_back(sub);
-        }
-        if (current_token.type == TokenType::Type) {
-          Token field_type = consume(TokenType::Type);
-          auto sub = new ASTNode{};
-          sub->value = field_type.data;
-          sub->type = NodeType::FieldType;
-          sub_type->children.emplace_back(sub);
-        }
+        NodeId field_type = parse_field_type();
+        ast.set_children(sub_type, &field_type, 1);
         if (current_token.type == TokenType::Comma) {
           consume(TokenType::Comma);
         }
-        uniforms->children.emplace_back(sub_type);
+        ast.push(sub_type);
         consume(TokenType::NewLine);
+        recover_line(TokenType::RightBrace);
+        if (current_token.type == TokenType::NewLine)
+          advance();
       }
       consume(TokenType::RightBrace);
       consume(TokenType::Comma);
-      root->children.emplace_back(uniforms);
-    }
-    if (current_token.type == TokenType::Identifier) {
+      ast.set_children(uniforms, uniforms_mark);
+      ast.push(uniforms);
+    } else if (current_token.type == TokenType::Identifier) {
       Token ident = consume(TokenType::Identifier);
       consume(TokenType::DoubleColon);
-      // complex type
-      auto field = new ASTNode{};
-      field->value = ident.data;
-      field->type = NodeType::Field;
-      if (current_token.type == TokenType::Type) {
-        Token type = consume(TokenType::Type);
-        auto field_type = new ASTNode{};
-        field_type->value = type.data;
-        field_type->type = NodeType::FieldType;
-        field->children.emplace_back(field_type);
-      }
-      // complex type
-      if (current_token.type == TokenType::Identifier) {
-        Token type = consume(TokenType::Identifier);
-        auto field_type = new ASTNode{};
-        field_type->value = type.data;
-        field_type->type = NodeType::FieldType;
-        field->children.emplace_back(field_type);
+      NodeId field = ast.add(NodeType::Field, lexer.text(ident));
+      NodeId field_type = parse_field_type();
+      // `normal :: vec3 @octahedral` names the format the attribute is
+      // stored in; the type stays the last child.
+      std::string_view format = lexer.text(current_token);
+      if (current_token.type == TokenType::Identifier &&
+          format.front() == '@') {
+        advance();
+        NodeId children[2] = {
+            ast.add(NodeType::AttributeFormat, format.substr(1)),
+            field_type};
+        ast.set_children(field, children, 2);
+      } else {
+        ast.set_children(field, &field_type, 1);
       }
-      root->children.emplace_back(field);
+      ast.push(field);
+    } else if (current_token.type != TokenType::NewLine) {
+      error_here("unexpected %s in input block",
+                 token_to_string(current_token.type));
     }
     if (current_token.type == TokenType::Comma) {
       consume(TokenType::Comma);
     }
     consume(TokenType::NewLine);
+    recover_line(TokenType::RightBrace);
+    if (current_token.type == TokenType::NewLine)
+      advance();
   }
   consume(TokenType::RightBrace);
+  ast.set_children(root, mark);
   return root;
 }
 
-ASTNode *Parser::parse_includes() {
+NodeId Parser::parse_includes() {
   consume(TokenType::Include);
-  auto root = new ASTNode{};
-  root->type = NodeType::Include;
-  root->value = "Include";
-  root->children.emplace_back(parse_list());
+  NodeId list = parse_list();
   consume(TokenType::RightArrow);
   Token path = consume(TokenType::Identifier);
-  auto path_node = new ASTNode{};
-  path_node->type = NodeType::Identifier;
-  path_node->value = path.data;
-  root->children.emplace_back(path_node);
-  consume(TokenType::NewLine);
+  NodeId path_node = ast.add(NodeType::Identifier, lexer.text(path));
+  NodeId root = ast.add(NodeType::Include, "Include", {list, path_node});
   return root;
 }
 
-ASTNode *Parser::parse_field_access(ASTNode *base) {
-  while (current_token.type == TokenType::Dot) {
+NodeId Parser::parse_field_access(NodeId base) {
+  while (current_token.type == TokenType::Dot && !panicking) {
     consume(TokenType::Dot);
     Token field = consume(TokenType::Identifier);
 
-    ASTNode *access = new ASTNode{NodeType::FieldAccess, field.data};
-    access->children.push_back(base);
-    base = access;
+    base = ast.add(NodeType::FieldAccess, lexer.text(field), {base});
   }
   return base;
 }
 
-ASTNode *Parser::parse_grouped_expression() {
+NodeId Parser::parse_grouped_expression() {
   consume(TokenType::LeftParen);
   auto expr = parse_expression(0);
   consume(TokenType::RightParen);
   return parse_field_access(expr);
 }
 
-ASTNode *Parser::parse_primary() {
-  ASTNode *node = new ASTNode();
+NodeId Parser::parse_primary() {
   if (current_token.type == TokenType::Number) {
-    node->type = NodeType::NumberLiteral;
-    node->value = current_token.data;
-    consume(TokenType::Number);
-
-    return node;
+    Token number = consume(TokenType::Number);
+    return ast.add(NodeType::NumberLiteral, lexer.text(number));
   }
   if (current_token.type == TokenType::Type) {
-    node->type = NodeType::Identifier;
-    node->value = current_token.data;
-    consume(TokenType::Identifier);
-
-    return node;
+    Token type = consume(TokenType::Type);
+    return ast.add(NodeType::Identifier, lexer.text(type));
   }
   if (current_token.type == TokenType::LeftParen) {
     return parse_grouped_expression();
   }
   if (current_token.type == TokenType::Identifier) {
-    ASTNode *node = new ASTNode();
-    node->type = NodeType::Identifier;
-    node->value = current_token.data;
-    consume(TokenType::Identifier);
-
-    return node;
-  }
-
-  // Handle function application chaining
-  while (is_primary(current_token.type)) {
-    ASTNode *arg = parse_primary();
-    ASTNode *call = new ASTNode{NodeType::FunctionApplication};
-    call->children.push_back(node); // function
-    call->children.push_back(arg);  // argument
-    node = call;
+    Token identifier = consume(TokenType::Identifier);
+    return ast.add(NodeType::Identifier, lexer.text(identifier));
   }
-  if (node != nullptr) {
-    return parse_field_access(node);
+  if (current_token.type == TokenType::Minus) {
+    consume(TokenType::Minus);
+    NodeId operand = parse_primary();
+    return ast.add(NodeType::UnaryOp, token_to_string(TokenType::Minus),
+                   {operand});
   }
 
-  // Add support for literals, parentheses, etc. here
-  std::cerr << "Unexpected token in primary expression: " << current_token.data
-            << "\n";
-  return nullptr;
+  [[maybe_unused]] std::string_view text = lexer.text(current_token);
+  TRACE_ERROR("Unexpected token in primary expression: %.*s", (int)text.size(),
+              text.data());
+  NodeId node = error_node();
+  error_here("expected an expression, found %s",
+             token_to_string(current_token.type));
+  return node;
 }
 
-ASTNode *Parser::parse_expression(int min_prec) {
-  ASTNode *lhs = parse_primary();
+NodeId Parser::parse_expression(int min_prec) {
+  NodeId lhs = parse_primary();
 
   // 🔁 Handle function application (left-associative, tighter than any
   // operator)
-  while (is_primary(current_token.type)) {
-    ASTNode *rhs = parse_primary();
-    ASTNode *app = new ASTNode{NodeType::FunctionApplication, ""};
-    app->children.push_back(lhs);
-    app->children.push_back(rhs);
-    lhs = app;
+  while (is_primary(current_token.type) && !panicking) {
+    NodeId rhs = parse_primary();
+    lhs = ast.add(NodeType::FunctionApplication, "", {lhs, rhs});
   }
 
   // 🧠 Then handle binary operators
-  while (true) {
+  while (!panicking) {
     int prec = get_precedence(current_token.type);
     if (prec < min_prec)
       break;
@@ -399,97 +461,90 @@ ASTNode *Parser::parse_expression(int min_prec) {
     TokenType op = current_token.type;
     consume(op);
 
-    ASTNode *rhs = parse_expression(prec + 1);
-
-    ASTNode *bin = new ASTNode{NodeType::BinOp, token_to_string(op)};
-    bin->children.push_back(lhs);
-    bin->children.push_back(rhs);
+    NodeId rhs = parse_expression(prec + 1);
 
-    lhs = bin;
+    lhs = ast.add(NodeType::BinOp, token_to_string(op), {lhs, rhs});
   }
 
   return lhs;
 }
 
-ASTNode *Parser::parse_array() {
-  fprintf(stdout, "Parsing Array.\n");
-  auto base = new ASTNode{};
-  base->type = NodeType::List;
-  base->value = "List";
+NodeId Parser::parse_array() {
+  TRACE_DEBUG("Parsing Array.");
+  NodeId base = ast.add(NodeType::List, "List");
+  size_t mark = ast.mark();
   consume(TokenType::LeftBracket);
   // consume aliases/identifiers
-  while (current_token.type != TokenType::RightBracket) {
+  while (until(TokenType::RightBracket)) {
     Token identifier = consume(TokenType::Identifier);
-    auto child = new ASTNode{};
-    child->type = NodeType::Identifier;
-    child->value = identifier.data;
+    NodeId child = ast.add(NodeType::Identifier, lexer.text(identifier));
     if (current_token.type == TokenType::Comma) {
-      printf("Comma parse_array\n");
+      TRACE_DEBUG("Comma parse_array");
       consume(TokenType::Comma);
     }
-    base->children.emplace_back(child);
+    ast.push(child);
   }
   consume(TokenType::RightBracket);
+  ast.set_children(base, mark);
   return base;
 }
 
-ASTNode *Parser::parse_data_definition() {
-  fprintf(stdout, "Parsing data definition.\n");
-  Token data = consume(TokenType::Data);
-  ASTNode *node = new ASTNode{};
-  node->type = NodeType::TypeDef;
-  Token identifier = consume(TokenType::Identifier);
+NodeId Parser::parse_data_definition() {
+  TRACE_DEBUG("Parsing data definition.");
+  consume(TokenType::Data);
+  size_t mark = ast.mark();
+  Token identifier = consume_name();
+  NodeId node = ast.add(NodeType::TypeDef, lexer.text(identifier));
   consume(TokenType::DoubleColon);
   consume(TokenType::LeftBrace);
   consume(TokenType::NewLine);
-  Token next_token = current_token;
-  while (current_token.type != TokenType::RightBrace) {
+  while (until(TokenType::RightBrace)) {
     Token field_ident = consume(TokenType::Identifier);
-    auto field = new ASTNode{};
-    field->type = NodeType::Field;
-    field->value = field_ident.data;
+    NodeId field = ast.add(NodeType::Field, lexer.text(field_ident));
+    size_t field_mark = ast.mark();
     if (current_token.type == TokenType::RightArrow) {
       consume(TokenType::RightArrow);
-      auto aliases = parse_array();
-      aliases->type = NodeType::AliasList;
-      if (!aliases->children.empty())
-        field->children.emplace_back(aliases);
+      NodeId aliases = parse_array();
+      ast[aliases].type = NodeType::AliasList;
+      if (ast[aliases].child_count != 0)
+        ast.push(aliases);
     }
     if (current_token.type == TokenType::DoubleColon) {
       consume(TokenType::DoubleColon);
     }
 
-    Token type_name = consume(TokenType::Type);
-    auto type = new ASTNode{};
-    type->type = NodeType::Identifier;
-    type->value = type_name.data;
-    field->children.emplace_back(type);
-    node->children.emplace_back(field);
-    printf("Parse data def : Comma\n");
+    Token type_name = consume_name();
+    ast.push(ast.add(NodeType::Identifier, lexer.text(type_name)));
+    ast.set_children(field, field_mark);
+    ast.push(field);
+    TRACE_DEBUG("Parse data def : Comma");
     consume(TokenType::Comma);
     consume(TokenType::NewLine);
+    // A broken field only costs that line.
+    recover_line(TokenType::RightBrace);
+    if (current_token.type == TokenType::NewLine)
+      advance();
   }
   consume(TokenType::RightBrace);
+  ast.set_children(node, mark);
   return node;
 }
 
-ASTNode *Parser::parse_type_signature(const Token &identifier) {
+NodeId Parser::parse_type_signature(const Token &identifier) {
   consume(TokenType::DoubleColon);
-  auto root = new ASTNode{};
-  root->value = identifier.data;
-  root->type = NodeType::TypeSignature;
+  NodeId root = ast.add(NodeType::TypeSignature, lexer.text(identifier));
+  size_t mark = ast.mark();
 
   // consume params and return type
   std::vector<Token> params;
-  auto return_type = new ASTNode{};
-  return_type->type = NodeType::ReturnType;
-  while (current_token.type != TokenType::NewLine) {
-    if (current_token.type == TokenType::Type) {
-      Token type = consume(TokenType::Type);
-      params.emplace_back(type);
-    } else if (current_token.type == TokenType::Identifier) {
-      Token type = consume(TokenType::Identifier);
-      params.emplace_back(type);
+  while (until(TokenType::NewLine)) {
+    if (current_token.type == TokenType::Type ||
+        current_token.type == TokenType::Identifier) {
+      params.emplace_back(consume_name());
+    } else {
+      error_here("expected a type in signature, found %s",
+                 token_to_string(current_token.type));
+      break;
     }
 
     if (current_token.type == TokenType::RightArrow) {
@@ -497,140 +552,196 @@ ASTNode *Parser::parse_type_signature(const Token &identifier) {
     }
   }
 
-  if (params.size() == 1) {
-    return_type->value = params[0].data;
-    root->children.emplace_back(return_type);
-  } else {
-    for (int i = 0; i < params.size() - 1; ++i) {
-      Token current = params[i];
-      auto sig_param = new ASTNode{};
-      sig_param->type = NodeType::ParamType;
-      sig_param->value = current.data;
-      root->children.emplace_back(sig_param);
+  if (!params.empty()) {
+    for (size_t i = 0; i + 1 < params.size(); ++i) {
+      ast.push(ast.add(NodeType::ParamType, lexer.text(params[i])));
     }
-    return_type->value = params[params.size() - 1].data;
-    root->children.emplace_back(return_type);
+    ast.push(ast.add(NodeType::ReturnType, lexer.text(params.back())));
   }
+  ast.set_children(root, mark);
 
-  pending_signatures[identifier.data].push_back(root);
+  pending_signatures[ast[root].value].push_back(root);
 
   return root;
 }
 
-ASTNode *Parser::parse_function_def(const Token &identifier) {
-  auto root = new ASTNode{};
-  root->value = identifier.data;
-  root->type = NodeType::FunctionDef;
+NodeId Parser::parse_function_def(const Token &identifier) {
+  NodeId root = ast.add(NodeType::FunctionDef, lexer.text(identifier));
+  size_t mark = ast.mark();
 
-  std::vector<Token> params;
-  while (current_token.type != TokenType::Equals) {
-    params.emplace_back(consume(TokenType::Identifier));
+  NodeId params = ast.add(NodeType::FunctionParams);
+  size_t params_mark = ast.mark();
+  while (until(TokenType::Equals)) {
+    Token param = consume(TokenType::Identifier);
+    ast.push(ast.add(NodeType::Identifier, lexer.text(param)));
   }
+  ast.set_children(params, params_mark);
   consume(TokenType::Equals);
 
-  auto expr = parse_expression(1);
-  root->children.emplace_back(expr);
+  NodeId expr = parse_expression(1);
 
   // Attach all pending signatures (support overloads)
-  auto it = pending_signatures.find(identifier.data);
+  auto it = pending_signatures.find(ast[root].value);
   if (it != pending_signatures.end()) {
-    for (ASTNode *sig : it->second) {
-      root->children.insert(root->children.begin(), sig);
+    for (auto sig = it->second.rbegin(); sig != it->second.rend(); ++sig) {
+      ast.push(*sig);
     }
     pending_signatures.erase(it);
   }
+  ast.push(params);
+  ast.push(expr);
+  ast.set_children(root, mark);
   return root;
 }
 
-ASTNode *Parser::parse_let() {
+NodeId Parser::parse_let() {
   consume(TokenType::Let);
   Token identifier = consume(TokenType::Identifier);
-  auto root = new ASTNode{};
-  root->type = NodeType::Let;
-  root->value = identifier.data;
+  consume(TokenType::Equals);
 
-  auto expr = parse_expression(20);
-  root->children.emplace_back(expr);
-  return root;
+  NodeId expr = parse_expression(0);
+  return ast.add(NodeType::Let, lexer.text(identifier), {expr});
 }
 
-Token Parser::peek_next() {
-  size_t old = lexer.cursor;
-  Token token = lexer.next();
-  lexer.cursor = old;
-  return token;
+// @variant shadows = [0, 1, 2]
+NodeId Parser::parse_variant() {
+  consume(TokenType::Variant);
+  Token identifier = consume(TokenType::Identifier);
+  NodeId variant = ast.add(NodeType::Variant, lexer.text(identifier));
+  consume(TokenType::Equals);
+  consume(TokenType::LeftBracket);
+  size_t mark = ast.mark();
+  while (until(TokenType::RightBracket)) {
+    bool negative = current_token.type == TokenType::Minus;
+    if (negative)
+      consume(TokenType::Minus);
+    Token number = consume(TokenType::Number);
+    std::string text(lexer.text(number));
+    ast.push(ast.add(NodeType::NumberLiteral, negative ? '-' + text : text));
+    if (current_token.type != TokenType::Comma)
+      break;
+    consume(TokenType::Comma);
+  }
+  consume(TokenType::RightBracket);
+  ast.set_children(variant, mark);
+  if (ast[variant].child_count == 0)
+    error_here("variant flag '%.*s' has no values",
+               static_cast<int>(lexer.text(identifier).size()),
+               lexer.text(identifier).data());
+  return variant;
 }
 
-ASTNode *Parser::parse_operator_overload(const Token &token) {
-  auto root = new ASTNode{};
-  root->type = NodeType::OperatorOverload;
-  root->value = token.data;
-  auto params = new ASTNode{};
-  params->type = NodeType::FunctionParams;
-  while (current_token.type != TokenType::DoubleColon) {
-    params->children.emplace_back(
-        new ASTNode{NodeType::ParamType, consume(TokenType::Identifier).data});
+Token Parser::peek_next(size_t distance) { return lexer.peek(distance); }
+
+// (+) a b = expr
+NodeId Parser::parse_operator_overload() {
+  consume(TokenType::LeftParen);
+  TokenType op = current_token.type;
+  if (get_precedence(op) < 0 || op == TokenType::Dot) {
+    error_here("expected an operator, found %s", token_to_string(op));
+    return error_node();
   }
-  root->children.emplace_back(params);
-  consume(TokenType::DoubleColon);
-  auto expr = parse_expression(0);
-  root->children.emplace_back(expr);
+  consume(op);
+  consume(TokenType::RightParen);
 
-  return root;
+  NodeId params = ast.add(NodeType::FunctionParams);
+  size_t mark = ast.mark();
+  while (until(TokenType::Equals)) {
+    Token param = consume(TokenType::Identifier);
+    ast.push(ast.add(NodeType::Identifier, lexer.text(param)));
+  }
+  ast.set_children(params, mark);
+  consume(TokenType::Equals);
+  NodeId expr = parse_expression(0);
+
+  return ast.add(NodeType::OperatorOverload, token_to_string(op),
+                 {params, expr});
 }
 
-ASTNode *Parser::parse() {
+NodeId Parser::parse() {
   advance();
-  ASTNode *program = new ASTNode();
-  program->type = NodeType::Program;
+  NodeId program = ast.add(NodeType::Program);
+  size_t mark = ast.mark();
   while (current_token.type != TokenType::End) {
+    if (current_token.type == TokenType::NewLine) {
+      advance();
+      continue;
+    }
     bool internal = false;
     if (current_token.type == TokenType::Internal) {
       consume(TokenType::Internal);
       consume(TokenType::NewLine);
       internal = true;
     }
+    [[maybe_unused]] const uint32_t start = current_token.offset;
     switch (current_token.type) {
-    // possible operator overloading
     case TokenType::LeftParen: {
+      NodeId overload = parse_operator_overload();
+      ast[overload].internal = internal;
+      ast.push(overload);
     } break;
     case TokenType::Let: {
-      break;
-    }
+      ast.push(parse_let());
+    } break;
+    case TokenType::Variant: {
+      ast.push(parse_variant());
+    } break;
     case TokenType::Input: {
-      auto seq = lexer.get_sequence();
-      fprintf(stdout, "%s\n", seq);
-      program->children.emplace_back(parse_input());
+      ast.push(parse_input());
+      TRACE_INFO("Parsed input:\n%.*s", (int)(current_token.offset - start),
+                 lexer.source + start);
     } break;
     case TokenType::Include: {
-      auto seq = lexer.get_sequence();
-      program->children.emplace_back(parse_includes());
-      fprintf(stderr, "%s\n", seq);
+      ast.push(parse_includes());
+      TRACE_INFO("Parsed include:\n%.*s", (int)(current_token.offset - start),
+                 lexer.source + start);
     } break;
     case TokenType::Main: {
-      program->children.emplace_back(parse_main_function());
-      auto seq = lexer.get_sequence();
-      fprintf(stderr, "%s\n", seq);
+      ast.push(parse_main_function());
+      TRACE_INFO("Parsed entry point:\n%.*s",
+                 (int)(current_token.offset - start), lexer.source + start);
     } break;
     case TokenType::Identifier: {
       Token identifier = consume(TokenType::Identifier);
       // function signature
       if (current_token.type == TokenType::DoubleColon) {
-        auto sig = parse_type_signature(identifier);
-        sig->internal = internal;
+        NodeId sig = parse_type_signature(identifier);
+        ast[sig].internal = internal;
       } else {
-        auto function_def_node = parse_function_def(identifier);
-        function_def_node->internal = internal;
-        program->children.emplace_back(function_def_node);
+        NodeId function_def_node = parse_function_def(identifier);
+        // `@internal` usually sits on the signature line.
+        for (NodeId child : ast.children(function_def_node)) {
+          internal |= ast[child].type == NodeType::TypeSignature &&
+                      ast[child].internal;
+        }
+        ast[function_def_node].internal = internal;
+        ast.push(function_def_node);
       }
     } break;
     case TokenType::Data: {
-      auto data = parse_data_definition();
-      program->children.emplace_back();
+      NodeId data = parse_data_definition();
+      ast[data].internal = internal;
+      ast.push(data);
+    } break;
+    default: {
+      std::string_view text = lexer.text(current_token);
+      error_here("unexpected %s '%.*s' at top level",
+                 token_to_string(current_token.type), (int)text.size(),
+                 text.data());
     } break;
     }
-    internal = false;
-    advance();
+
+    if (current_token.type != TokenType::NewLine &&
+        current_token.type != TokenType::End) {
+      std::string_view text = lexer.text(current_token);
+      error_here("unexpected %s '%.*s' after declaration",
+                 token_to_string(current_token.type), (int)text.size(),
+                 text.data());
+    }
+    if (panicking)
+      synchronize();
   }
+  ast.set_children(program, mark);
+  ast.root = program;
   return program;
 }
@@ -1,41 +1,66 @@
 #pragma once
 
 #include "ast_node.h"
+#include "diagnostics.h"
 #include "lexer.h"
 #include "token.h"
 #include <unordered_map>
+#include <vector>
 
 class Parser {
 private:
   Lexer &lexer;
-  Token current_token = Token{TokenType::None, ""};
+  Ast &ast;
+  Diagnostics &diagnostics;
+  Token current_token{};
+  // Set after an error until the parser reaches a synchronization point;
+  // suppresses follow-up errors and stops loops from spinning.
+  bool panicking = false;
   void advance();
   Token consume(TokenType type);
-  Token peek_next();
+  Token consume_name();
+  bool until(TokenType terminator) const;
+  void recover_line(TokenType closing);
+  void synchronize();
+#if defined(__GNUC__) || defined(__clang__)
+  __attribute__((format(printf, 2, 3)))
+#endif
+  void error_here(const char *format, ...);
+  NodeId error_node();
+  Token peek_next(size_t distance = 0);
   bool is_primary(TokenType kind);
   bool is_binary(TokenType kind);
-  ASTNode *parse_assignment(const Token &identifier);
-  ASTNode *parse_expression(int min_prec);
-  ASTNode *parse_function_def(const Token &identifier);
-  ASTNode *parse_data_definition();
-  ASTNode *parse_array();
-  ASTNode *parse_list();
-  ASTNode *parse_primary();
-  ASTNode *parse_includes();
-  ASTNode *parse_input();
-  ASTNode *parse_out();
-  ASTNode *parse_operator_overload(const Token &token);
-  ASTNode *parse_let_in_expr();
-  ASTNode *parse_let_binding();
-  ASTNode *parse_main_function();
-  ASTNode *parse_field_access(ASTNode *base);
-  ASTNode *parse_grouped_expression();
-  ASTNode *parse_type_signature(const Token &identifier);
-  ASTNode *parse_let();
+  NodeId parse_assignment(const Token &identifier);
+  NodeId parse_expression(int min_prec);
+  NodeId parse_function_def(const Token &identifier);
+  NodeId parse_data_definition();
+  NodeId parse_array();
+  NodeId parse_list();
+  NodeId parse_primary();
+  NodeId parse_includes();
+  NodeId parse_input();
+  NodeId parse_out();
+  NodeId parse_operator_overload();
+  NodeId parse_let_in_expr();
+  NodeId parse_let_binding();
+  NodeId parse_main_function();
+  NodeId parse_field_access(NodeId base);
+  NodeId parse_grouped_expression();
+  NodeId parse_type_signature(const Token &identifier);
+  NodeId parse_let();
+  NodeId parse_variant();
+  NodeId parse_field_type();
   int get_precedence(TokenType type) const;
-  std::unordered_map<std::string, std::vector<ASTNode *>> pending_signatures;
+  std::unordered_map<Symbol, std::vector<NodeId>> pending_signatures;
 
 public:
-  Parser(Lexer &lexer) : lexer{lexer} {};
-  ASTNode *parse();
+  Parser(Lexer &lexer, Ast &ast, Diagnostics &diagnostics)
+      : lexer{lexer}, ast{ast}, diagnostics{diagnostics} {};
+  NodeId parse();
+  // Type signatures no FunctionDef after them has claimed, by name in
+  // declaration order. Used to join signatures across separately parsed
+  // chunks of one file.
+  std::unordered_map<Symbol, std::vector<NodeId>> take_pending_signatures() {
+    return std::move(pending_signatures);
+  }
 };
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Length-prefixed fields for compile cache entries and compile server
+// frames. Written in native byte order, like the precompiled modules.
+
+inline void put(std::string &out, uint64_t value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+inline void put(std::string &out, std::string_view text) {
+  put(out, static_cast<uint64_t>(text.size()));
+  out += text;
+}
+
+// Bounds-checked reads of what put() wrote.
+struct Reader {
+  const char *cursor;
+  const char *end;
+
+  bool get(uint64_t &value) {
+    if (static_cast<size_t>(end - cursor) < sizeof(value))
+      return false;
+    std::memcpy(&value, cursor, sizeof(value));
+    cursor += sizeof(value);
+    return true;
+  }
+  bool get(std::string &text) {
+    uint64_t size;
+    if (!get(size) || size > static_cast<uint64_t>(end - cursor))
+      return false;
+    text.assign(cursor, size);
+    cursor += size;
+    return true;
+  }
+};
@@ -0,0 +1,558 @@
+#include "shader_program.h"
+#include "keywords.h"
+#include "vertex_layout.h"
+#include <algorithm>
+#include <cstdarg>
+
+namespace {
+
+using Result = BuiltinResult;
+
+constexpr BuiltinFunction builtins[] = {
+    {"dot", Result::Float, 0, "TTf"},
+    {"length", Result::Float, 66, "Tf"},
+    {"distance", Result::Float, 67, "TTf"},
+    {"cross", Result::FirstArg, 68, "333"},
+    {"normalize", Result::FirstArg, 69, "TT"},
+    {"reflect", Result::FirstArg, 71, "TTT"},
+    {"refract", Result::FirstArg, 72, "TTfT"},
+    {"faceforward", Result::FirstArg, 70, "TTTT"},
+    {"abs", Result::FirstArg, 4, "NN"},
+    {"sign", Result::FirstArg, 6, "NN"},
+    {"floor", Result::FirstArg, 8, "TT"},
+    {"ceil", Result::FirstArg, 9, "TT"},
+    {"fract", Result::FirstArg, 10, "TT"},
+    {"mod", Result::FirstArg, 0, "TTT TcT"},
+    {"min", Result::FirstArg, 37, "NNN NcN"},
+    {"max", Result::FirstArg, 40, "NNN NcN"},
+    {"clamp", Result::FirstArg, 43, "NNNN NccN"},
+    {"mix", Result::FirstArg, 46, "TTTT TTcT"},
+    {"step", Result::LastArg, 48, "TTT cTT"},
+    {"smoothstep", Result::LastArg, 49, "TTTT ccTT"},
+    {"sqrt", Result::FirstArg, 31, "TT"},
+    {"inversesqrt", Result::FirstArg, 32, "TT"},
+    {"pow", Result::FirstArg, 26, "TTT"},
+    {"exp", Result::FirstArg, 27, "TT"},
+    {"exp2", Result::FirstArg, 29, "TT"},
+    {"log", Result::FirstArg, 28, "TT"},
+    {"log2", Result::FirstArg, 30, "TT"},
+    {"sin", Result::FirstArg, 13, "TT"},
+    {"cos", Result::FirstArg, 14, "TT"},
+    {"tan", Result::FirstArg, 15, "TT"},
+    {"asin", Result::FirstArg, 16, "TT"},
+    {"acos", Result::FirstArg, 17, "TT"},
+    {"atan", Result::FirstArg, 18, "TT TTT"},
+    {"radians", Result::FirstArg, 11, "TT"},
+    {"degrees", Result::FirstArg, 12, "TT"},
+    {"transpose", Result::FirstArg, 0, "MM"},
+    {"inverse", Result::FirstArg, 34, "MM"},
+    {"texture", Result::Vec4, 0, "S*4"},
+    {"textureLod", Result::Vec4, 0, "S*f4"},
+};
+
+} // namespace
+
+const BuiltinFunction *find_builtin_function(std::string_view name) {
+  for (const BuiltinFunction &builtin : builtins) {
+    if (builtin.name == name)
+      return &builtin;
+  }
+  return nullptr;
+}
+
+bool is_name_operand(const Ast &ast, NodeId id, uint32_t index) {
+  const ASTNode &node = ast[id];
+  if (node.type == NodeType::FunctionApplication)
+    return index == 0 && ast[ast.child(id, 0)].type == NodeType::Identifier;
+  return node.type == NodeType::BinOp && index == 1 &&
+         symbol_text(node.value) == "Dot";
+}
+
+uint32_t count_reads(const Ast &ast, NodeId id, Symbol name) {
+  const ASTNode &node = ast[id];
+  if (node.type == NodeType::Identifier)
+    return node.value == name;
+  uint32_t reads = 0;
+  for (uint32_t i = 0; i < node.child_count; ++i) {
+    if (!is_name_operand(ast, id, i))
+      reads += count_reads(ast, ast.child(id, i), name);
+  }
+  return reads;
+}
+
+TypeShape shape_of(std::string_view type) {
+  if (type == "float" || type == "int" || type == "uint" || type == "bool")
+    return {type, 1};
+  if (type.size() < 4 || type.substr(type.size() - 4, 3) != "vec")
+    return {};
+  uint32_t width = type.back() - '0';
+  if (width < 2 || width > 4)
+    return {};
+  switch (type.size() == 4 ? 'v' : type[0]) {
+  case 'v':
+    return {"float", width};
+  case 'i':
+    return {"int", width};
+  case 'u':
+    return {"uint", width};
+  case 'b':
+    return {"bool", width};
+  }
+  return {};
+}
+
+Symbol shaped_type(std::string_view scalar, uint32_t width) {
+  if (width == 1)
+    return intern(scalar);
+  std::string name;
+  if (scalar != "float")
+    name += scalar[0];
+  name += "vec";
+  name += static_cast<char>('0' + width);
+  return intern(name);
+}
+
+uint32_t matrix_size(std::string_view type) {
+  if (type.size() != 4 || type.substr(0, 3) != "mat")
+    return 0;
+  uint32_t size = type[3] - '0';
+  return size >= 2 && size <= 4 ? size : 0;
+}
+
+int swizzle_index(char c) {
+  for (std::string_view set : {"xyzw", "rgba", "stpq"}) {
+    size_t index = set.find(c);
+    if (index != std::string_view::npos)
+      return static_cast<int>(index);
+  }
+  return -1;
+}
+
+bool is_comparison(std::string_view name) {
+  return name == "Equality" || name == "LessThan" || name == "GreaterThan" ||
+         name == "LessOrEqualsThan" || name == "GreaterOrEqualsThan";
+}
+
+ShaderProgram::ShaderProgram(Diagnostics &diagnostics)
+    : vertex(intern("vertex")), fragment(intern("fragment")),
+      float_type(intern("float")), bool_type(intern("bool")),
+      vec4_type(intern("vec4")), clip_position(intern("clip_position")),
+      checker(*this), diagnostics(diagnostics) {}
+
+bool ShaderProgram::collect(
+    const Ast &ast, NodeId root, const char *text,
+    const std::vector<std::shared_ptr<const Module>> &imports) {
+  main_ast = &ast;
+  source = text;
+
+  std::vector<const Module *> seen;
+  for (const auto &module : imports)
+    collect_module(*module, seen);
+  collect(ast, root, false);
+
+  checker.check_constants();
+  checker.check_overloads();
+  warn_untyped();
+
+  // Fragment inputs come from what the vertex stage passes on.
+  std::stable_sort(entries.begin(), entries.end(),
+                   [&](const AstRef &a, const AstRef &b) {
+                     return (*a.ast)[a.id].value == vertex &&
+                            (*b.ast)[b.id].value != vertex;
+                   });
+  return !failed;
+}
+
+bool ShaderProgram::analyze(
+    const Ast &ast, NodeId root, const char *text,
+    const std::vector<std::shared_ptr<const Module>> &imports,
+    std::vector<StageInfo> &stages) {
+  bool ok = collect(ast, root, text, imports);
+  bool ok_stages = true;
+  // Stages are analysed even after errors elsewhere, but a failed vertex
+  // stage would only make its varyings look unknown to the fragment stage.
+  stages.assign(entries.size(), {});
+  for (size_t i = 0; i < stages.size() && ok_stages; ++i)
+    ok_stages = analyze_stage(entries[i], stages[i]);
+  return ok && ok_stages;
+}
+
+void ShaderProgram::collect_module(const Module &module,
+                                   std::vector<const Module *> &seen) {
+  if (std::find(seen.begin(), seen.end(), &module) != seen.end())
+    return;
+  seen.push_back(&module);
+  for (const auto &import : module.imports)
+    collect_module(*import, seen);
+  collect(module.ast, module.root, true);
+}
+
+Symbol ShaderProgram::attribute_format(const Ast &ast, NodeId field) {
+  NodeId first = ast.child(field, 0);
+  if (ast[first].type != NodeType::AttributeFormat)
+    return NoSymbol;
+  AttributeFormat format;
+  std::string_view type =
+      symbol_text(ast[ast.child(field, ast[field].child_count - 1)].value);
+  std::string_view name = symbol_text(ast[first].value);
+  if (!parse_format(name, format))
+    error(ast, first,
+          "unknown attribute format '%s'; expected half, snorm16, unorm16, "
+          "snorm8, unorm8 or octahedral",
+          name.data());
+  else if (!format_fits(format, type))
+    error(ast, first, "a '%s' attribute cannot be stored as %s", type.data(),
+          name.data());
+  return ast[first].value;
+}
+
+void ShaderProgram::collect(const Ast &ast, NodeId root, bool imported) {
+  auto fields = [&](NodeId parent, std::vector<ShaderVariable> &into) {
+    for (NodeId field : ast.children(parent)) {
+      if (ast[field].type == NodeType::Uniform) {
+        for (NodeId uniform : ast.children(field)) {
+          NodeId type = ast.child(uniform, ast[uniform].child_count - 1);
+          uniforms.push_back({ast[uniform].value, ast[type].value});
+        }
+      } else if (ast[field].type == NodeType::Field &&
+                 ast[field].child_count != 0) {
+        NodeId type = ast.child(field, ast[field].child_count - 1);
+        into.push_back({ast[field].value, ast[type].value});
+        if (&into == &vertex_inputs)
+          vertex_formats.push_back(attribute_format(ast, field));
+      }
+    }
+  };
+
+  for (NodeId id : ast.children(root)) {
+    const ASTNode &node = ast[id];
+    switch (node.type) {
+    case NodeType::TypeDef:
+      types[node.value] = {&ast, id};
+      if (!node.internal && !is_builtin_type(symbol_text(node.value)))
+        structs.push_back({&ast, id});
+      break;
+    case NodeType::FunctionDef: {
+      if (node.internal)
+        break;
+      NodeRange children = ast.children(id);
+      uint32_t params = ast[children[children.size() - 2]].child_count;
+      bool typed = false;
+      for (NodeId signature : children) {
+        if (ast[signature].type != NodeType::TypeSignature)
+          break;
+        typed = true;
+        if (ast[signature].child_count != params + 1) {
+          std::string_view name = symbol_text(node.value);
+          error(ast, id, "'%.*s' has %u parameters but its signature has %u",
+                static_cast<int>(name.size()), name.data(), params,
+                ast[signature].child_count - 1);
+          continue;
+        }
+        add_overload(ast, id, signature);
+      }
+      if (!typed)
+        add_overload(ast, id, NoNode);
+    } break;
+    case NodeType::Let:
+      if (!node.internal)
+        constants.push_back({&ast, id});
+      break;
+    case NodeType::Input:
+      if (node.value == vertex)
+        fields(id, vertex_inputs);
+      else if (node.value == fragment)
+        fields(id, fragment_inputs);
+      break;
+    case NodeType::EntryPoint:
+      if (!imported)
+        entries.push_back({&ast, id});
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+void ShaderProgram::add_overload(const Ast &ast, NodeId function,
+                                 NodeId signature) {
+  Symbol name = ast[function].value;
+  std::vector<uint32_t> &named = function_overloads[name];
+  // A later signature with the same parameter types replaces an earlier
+  // one, keeping its place.
+  if (signature != NoNode) {
+    NodeRange types = ast.children(signature);
+    for (uint32_t index : named) {
+      Overload &overload = overloads[index];
+      if (overload.signature == NoNode)
+        continue;
+      const Ast &other = *overload.function.ast;
+      NodeRange other_types = other.children(overload.signature);
+      bool same = other_types.size() == types.size();
+      for (size_t i = 0; same && i + 1 < types.size(); ++i)
+        same = other[other_types[i]].value == ast[types[i]].value;
+      if (same) {
+        overload = {{&ast, function}, signature};
+        return;
+      }
+    }
+  }
+  named.push_back(static_cast<uint32_t>(overloads.size()));
+  overloads.push_back({{&ast, function}, signature});
+}
+
+void ShaderProgram::warn_untyped() {
+  for (uint32_t i = 0; i < overloads.size(); ++i) {
+    const Overload &overload = overloads[i];
+    if (overload.signature != NoNode || overload.function.ast != main_ast)
+      continue;
+    const Ast &ast = *overload.function.ast;
+    NodeId id = overload.function.id;
+    diagnostics.report(Severity::Warning, locate(source, ast.offset_of(id)),
+                       "function '%s' has no type signature and is not "
+                       "emitted; its inferred type is '%s'",
+                       symbol_text(ast[id].value).data(),
+                       checker.describe_overload(i).c_str());
+  }
+}
+
+bool ShaderProgram::analyze_stage(const AstRef &entry, StageInfo &info) {
+  const Ast &ast = *entry.ast;
+  info = {};
+  info.entry = entry;
+  info.stage = stage = ast[entry.id].value;
+  if (stage != vertex && stage != fragment) {
+    error(ast, entry.id, "unknown shader stage '%s'",
+          symbol_text(stage).data());
+    return false;
+  }
+  info.body = ast.child(entry.id, 0);
+  info.result = result_of(ast, info.body);
+
+  bool passes_varying = false;
+  NodeId body = info.body;
+  if (ast[body].type == NodeType::LetInExpr) {
+    NodeId last = ast.child(body, ast[body].child_count - 1);
+    if (stage == vertex && ast[last].type == NodeType::Input) {
+      passes_varying = true;
+      NodeId varying = ast.child(last, 1);
+      Symbol name = ast[varying].value;
+      bool bound = false;
+      for (NodeId binding : ast.children(body)) {
+        if (ast[binding].type != NodeType::LetBinding)
+          continue;
+        bound |= ast[binding].value == name;
+        if (ast[binding].value == clip_position)
+          info.position = binding;
+      }
+      if (!bound)
+        error(ast, varying,
+              "only let bindings can be passed to the fragment stage");
+      else
+        info.varying = name;
+      if (info.position == NoNode)
+        error(ast, varying,
+              "a vertex entry point that passes '%s' to the fragment stage "
+              "must bind its vec4 position to 'clip_position'",
+              symbol_text(name).data());
+    }
+  }
+  bool ok = !failed;
+  info.result_type = checker.check_stage(ast, body);
+  if (failed || !ok)
+    return false;
+
+  if (info.position != NoNode) {
+    Symbol type = checker.type_of(ast, info.position);
+    if (type != vec4_type) {
+      error(ast, info.position, "'clip_position' must be a vec4, not '%s'",
+            symbol_text(type).data());
+      return false;
+    }
+  }
+
+  if (!passes_varying && stage == vertex && info.result_type != vec4_type) {
+    error(ast, info.result,
+          "a vertex entry point must produce a vec4 position or pass a "
+          "let binding to the fragment stage, not '%s'",
+          symbol_text(info.result_type).data());
+    return false;
+  }
+  TypeShape shape = shape_of(symbol_text(info.result_type));
+  if (stage == fragment && (shape.scalar != "float" || shape.width == 2)) {
+    error(ast, info.result,
+          "a fragment entry point must produce a float, vec3 or vec4 "
+          "color, not '%s'",
+          symbol_text(info.result_type).data());
+    return false;
+  }
+  if (info.varying != NoSymbol)
+    varyings.push_back({info.varying, info.result_type});
+  return true;
+}
+
+void ShaderProgram::error(const Ast &ast, NodeId at, const char *format,
+                          ...) {
+  failed = true;
+  va_list args;
+  va_start(args, format);
+  diagnostics.vreport(Severity::Error, span_of(ast, at), format, args);
+  va_end(args);
+}
+
+SourceSpan ShaderProgram::span_of(const Ast &ast, NodeId at) const {
+  uint32_t length =
+      static_cast<uint32_t>(symbol_text(ast[at].value).size());
+  return locate(&ast == main_ast ? source : nullptr, ast.offset_of(at),
+                length);
+}
+
+Symbol ShaderProgram::field_name(Symbol type, Symbol field) const {
+  auto it = types.find(type);
+  if (it == types.end() || is_builtin_type(symbol_text(type)))
+    return field;
+  const Ast &ast = *it->second.ast;
+  for (NodeId member : ast.children(it->second.id)) {
+    if (ast[member].value == field)
+      return field;
+    NodeId aliases = ast.child(member, 0);
+    if (ast[aliases].type != NodeType::AliasList)
+      continue;
+    for (NodeId alias : ast.children(aliases)) {
+      if (ast[alias].value == field)
+        return ast[member].value;
+    }
+  }
+  return field;
+}
+
+int ShaderProgram::field_index(Symbol type, Symbol field) const {
+  auto it = types.find(type);
+  if (it == types.end() || is_builtin_type(symbol_text(type)))
+    return -1;
+  const Ast &ast = *it->second.ast;
+  Symbol real = field_name(type, field);
+  int index = 0;
+  for (NodeId member : ast.children(it->second.id)) {
+    if (ast[member].value == real)
+      return index;
+    index++;
+  }
+  return -1;
+}
+
+Symbol ShaderProgram::field_type(Symbol type, int index) const {
+  const AstRef &ref = types.at(type);
+  const Ast &ast = *ref.ast;
+  NodeId member = ast.child(ref.id, static_cast<uint32_t>(index));
+  return ast[ast.child(member, ast[member].child_count - 1)].value;
+}
+
+int ShaderProgram::resolve_call(Symbol function, const Symbol *args,
+                                size_t count) const {
+  auto it = function_overloads.find(function);
+  if (it == function_overloads.end())
+    return -1;
+  for (uint32_t index : it->second) {
+    if (!is_emitted(index))
+      continue;
+    const Overload &overload = overloads[index];
+    NodeRange types = overload.function.ast->children(overload.signature);
+    bool match = types.size() == count + 1;
+    for (size_t i = 0; match && i < count; ++i)
+      match = (*overload.function.ast)[types[i]].value == args[i];
+    if (match)
+      return static_cast<int>(index);
+  }
+  return -1;
+}
+
+Symbol ShaderProgram::return_type(uint32_t index) const {
+  const Overload &overload = overloads[index];
+  if (overload.signature == NoNode)
+    return NoSymbol;
+  const Ast &ast = *overload.function.ast;
+  return ast[ast.child(overload.signature,
+                       ast[overload.signature].child_count - 1)]
+      .value;
+}
+
+bool ShaderProgram::is_emitted(uint32_t index) const {
+  return overloads[index].signature != NoNode &&
+         checker.is_monomorphic(index);
+}
+
+StageUsage ShaderProgram::usage(const AstRef &entry) const {
+  StageUsage usage;
+  usage.overloads.assign(overloads.size(), false);
+  usage.constants.assign(constants.size(), false);
+  std::vector<AstRef> pending{entry};
+  while (!pending.empty()) {
+    AstRef ref = pending.back();
+    pending.pop_back();
+    const Ast &ast = *ref.ast;
+    const ASTNode &node = ast[ref.id];
+    if (node.type == NodeType::Identifier &&
+        usage.names.insert(node.value).second) {
+      for (size_t i = 0; i < constants.size(); ++i) {
+        const Ast &from = *constants[i].ast;
+        if (from[constants[i].id].value == node.value) {
+          usage.constants[i] = true;
+          pending.push_back({&from, from.child(constants[i].id, 0)});
+        }
+      }
+    }
+    int target = checker.call_target(ast, ref.id);
+    if (target >= 0 && !usage.overloads[target]) {
+      const AstRef &function = overloads[target].function;
+      const Ast &from = *function.ast;
+      for (uint32_t i : function_overloads.at(from[function.id].value)) {
+        if (usage.overloads[i])
+          continue;
+        usage.overloads[i] = true;
+        const Ast &body_ast = *overloads[i].function.ast;
+        NodeId def = overloads[i].function.id;
+        pending.push_back(
+            {&body_ast, body_ast.child(def, body_ast[def].child_count - 1)});
+      }
+    }
+    for (uint32_t i = 0; i < node.child_count; ++i)
+      pending.push_back({&ast, ast.child(ref.id, i)});
+  }
+  return usage;
+}
+
+NodeId ShaderProgram::result_of(const Ast &ast, NodeId body) const {
+  while (ast[body].type == NodeType::LetInExpr ||
+         ast[body].type == NodeType::Input) {
+    if (ast[body].type == NodeType::Input)
+      body = ast.child(body, 1);
+    else
+      body = ast.child(body, ast[body].child_count - 1);
+  }
+  return body;
+}
+
+const ShaderVariable *ShaderProgram::lookup(Symbol name) const {
+  for (auto it = locals.rbegin(); it != locals.rend(); ++it) {
+    if (it->name == name)
+      return &*it;
+  }
+  const std::vector<ShaderVariable> *scopes[] = {
+      &globals, &uniforms, stage == vertex ? &vertex_inputs : nullptr,
+      stage == fragment ? &fragment_inputs : nullptr,
+      stage == fragment ? &varyings : nullptr};
+  for (const std::vector<ShaderVariable> *scope : scopes) {
+    if (!scope)
+      continue;
+    for (const ShaderVariable &variable : *scope) {
+      if (variable.name == name)
+        return &variable;
+    }
+  }
+  return nullptr;
+}
+
+Symbol ShaderProgram::infer(const Ast &ast, NodeId id) {
+  return checker.infer_quietly(ast, id);
+}
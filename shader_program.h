@@ -0,0 +1,184 @@
+#pragma once
+#include "ast_node.h"
+#include "diagnostics.h"
+#include "module.h"
+#include "type_checker.h"
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Component type and width of a builtin scalar or vector type, e.g.
+// ("float", 3) for vec3. Width 0 for anything else.
+struct TypeShape {
+  std::string_view scalar;
+  uint32_t width = 0;
+};
+
+TypeShape shape_of(std::string_view type);
+Symbol shaped_type(std::string_view scalar, uint32_t width);
+// Column count of matN, 0 for anything else.
+uint32_t matrix_size(std::string_view type);
+// Component index of a swizzle letter (xyzw, rgba or stpq), or -1.
+int swizzle_index(char c);
+bool is_comparison(std::string_view op);
+
+// How a builtin function's result type follows from its arguments.
+enum class BuiltinResult : uint8_t { Float, FirstArg, LastArg, Vec4 };
+
+struct BuiltinFunction {
+  std::string_view name;
+  BuiltinResult result;
+  // GLSL.std.450 extended instruction, 0 for a core SPIR-V operation.
+  uint32_t glsl_std_450;
+  // Space-separated forms, one letter per parameter and then the result:
+  // T a float genType (float or vecN), N a genType of float, int or uint,
+  // c a scalar of that genType's component type, f float, 3 vec3, 4 vec4,
+  // M a matrix, S a sampler, * anything. T, N and M are one type within a
+  // form.
+  std::string_view signatures;
+};
+
+const BuiltinFunction *find_builtin_function(std::string_view name);
+
+// Whether child `index` of `id` is a name rather than a value: the called
+// function of an application or the field of a member access.
+bool is_name_operand(const Ast &ast, NodeId id, uint32_t index);
+// Reads of the variable `name` in the expression `id`.
+uint32_t count_reads(const Ast &ast, NodeId id, Symbol name);
+
+struct AstRef {
+  const Ast *ast = nullptr;
+  NodeId id = NoNode;
+};
+
+struct ShaderVariable {
+  Symbol name = NoSymbol;
+  Symbol type = NoSymbol;
+};
+
+// One signature of a function, which is what a call resolves to.
+struct Overload {
+  AstRef function;
+  // NoNode for a function without a signature; its type is inferred.
+  NodeId signature = NoNode;
+};
+
+// What a backend needs to know about an entry point before writing it.
+struct StageInfo {
+  AstRef entry;
+  Symbol stage = NoSymbol;
+  NodeId body = NoNode;
+  // Expression whose value the stage produces.
+  NodeId result = NoNode;
+  Symbol result_type = NoSymbol;
+  // Set for a vertex stage that ends in `@in fragment x`: the let binding
+  // that becomes the varying.
+  Symbol varying = NoSymbol;
+  // Such a stage's `clip_position` binding, which becomes the position.
+  NodeId position = NoNode;
+};
+
+// What an entry point reaches, directly or through the functions and
+// constants it uses. Indices follow ShaderProgram's `overloads` and
+// `constants`.
+struct StageUsage {
+  std::vector<bool> overloads;
+  std::vector<bool> constants;
+  // Every name read, including inputs and uniforms.
+  std::unordered_set<Symbol> names;
+};
+
+// The declarations of a program (a file plus every module it includes)
+// that code generators work from. Type errors are reported once, by the
+// TypeChecker while collecting and analysing; backends can then call
+// infer() freely. Types are GLSL type names.
+class ShaderProgram {
+public:
+  explicit ShaderProgram(Diagnostics &diagnostics);
+
+  // `source` is the text `ast` was parsed from, used to locate errors.
+  // Returns false if the program has errors.
+  bool collect(const Ast &ast, NodeId root, const char *source,
+               const std::vector<std::shared_ptr<const Module>> &imports);
+  // Types an entry point and checks what it produces. A vertex stage's
+  // varying is added to `varyings`, so analyse vertex stages first.
+  bool analyze_stage(const AstRef &entry, StageInfo &info);
+  // collect() and analyze_stage() for every entry point: what backends
+  // need, done once however many of them run.
+  bool analyze(const Ast &ast, NodeId root, const char *source,
+               const std::vector<std::shared_ptr<const Module>> &imports,
+               std::vector<StageInfo> &stages);
+  // Where `at` is in its source, for errors found after analysis.
+  SourceSpan span_of(const Ast &ast, NodeId at) const;
+
+  // Type of `id` with the variables in `locals` and the current stage in
+  // scope.
+  Symbol infer(const Ast &ast, NodeId id);
+  const ShaderVariable *lookup(Symbol name) const;
+  // The value a let-in (or `@in stage x`) expression stands for.
+  NodeId result_of(const Ast &ast, NodeId body) const;
+  // Real name of a struct field that may be given by one of its aliases.
+  Symbol field_name(Symbol type, Symbol field) const;
+  // Index of `field` in struct `type`, -1 if it has none.
+  int field_index(Symbol type, Symbol field) const;
+  // Type of member `index` of struct `type`.
+  Symbol field_type(Symbol type, int index) const;
+  // The overload of `function` whose signature is exactly `args`, or -1.
+  int resolve_call(Symbol function, const Symbol *args, size_t count) const;
+  Symbol return_type(uint32_t overload) const;
+  // Whether a backend writes this overload out: it has a signature without
+  // type variables.
+  bool is_emitted(uint32_t overload) const;
+  // What `entry` uses. A called function counts with all its overloads, as
+  // the overloads of one definition share a body.
+  StageUsage usage(const AstRef &entry) const;
+
+  std::unordered_map<Symbol, AstRef> types;
+  std::vector<Overload> overloads;
+  // Indices into `overloads`, in declaration order.
+  std::unordered_map<Symbol, std::vector<uint32_t>> function_overloads;
+  std::vector<AstRef> structs;
+  std::vector<AstRef> constants;
+  std::vector<AstRef> entries;
+  std::vector<ShaderVariable> uniforms;
+  std::vector<ShaderVariable> vertex_inputs;
+  // Format annotation of each vertex input, NoSymbol if it has none.
+  std::vector<Symbol> vertex_formats;
+  std::vector<ShaderVariable> fragment_inputs;
+  std::vector<ShaderVariable> varyings;
+  // Types of `constants`, in the same order.
+  std::vector<ShaderVariable> globals;
+  std::vector<ShaderVariable> locals;
+  // Stage whose inputs identifiers currently resolve against; none while
+  // in functions and constants.
+  Symbol stage = NoSymbol;
+
+  Symbol vertex, fragment, float_type, bool_type, vec4_type;
+  // Binding that holds the position of a vertex stage passing a varying.
+  Symbol clip_position;
+  TypeChecker checker;
+
+private:
+  friend class TypeChecker;
+
+  void collect(const Ast &ast, NodeId root, bool imported);
+  void collect_module(const Module &module,
+                      std::vector<const Module *> &seen);
+  void add_overload(const Ast &ast, NodeId function, NodeId signature);
+  void warn_untyped();
+  // Checks the format annotation of vertex input `field`, if it has one.
+  Symbol attribute_format(const Ast &ast, NodeId field);
+
+#if defined(__GNUC__) || defined(__clang__)
+  __attribute__((format(printf, 4, 5)))
+#endif
+  void error(const Ast &ast, NodeId at, const char *format, ...);
+
+  Diagnostics &diagnostics;
+  const Ast *main_ast = nullptr;
+  const char *source = nullptr;
+  bool failed = false;
+};
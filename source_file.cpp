@@ -0,0 +1,150 @@
+#include "source_file.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SourceFile::~SourceFile() { close(); }
+
+SourceFile::SourceFile(SourceFile &&other) noexcept { *this = std::move(other); }
+
+SourceFile &SourceFile::operator=(SourceFile &&other) noexcept {
+  if (this != &other) {
+    close();
+    bytes = std::exchange(other.bytes, "");
+    length = std::exchange(other.length, 0);
+    mapping = std::exchange(other.mapping, nullptr);
+    mapping_size = std::exchange(other.mapping_size, 0);
+    copy = std::move(other.copy);
+  }
+  return *this;
+}
+
+void SourceFile::close() {
+  if (mapping) {
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, mapping_size);
+#endif
+  }
+  mapping = nullptr;
+  mapping_size = 0;
+  copy.reset();
+  bytes = "";
+  length = 0;
+}
+
+#ifdef _WIN32
+
+bool SourceFile::open(const char *path) {
+  close();
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size)) {
+    CloseHandle(file);
+    return false;
+  }
+  size_t size = static_cast<size_t>(file_size.QuadPart);
+  if (size == 0) {
+    CloseHandle(file);
+    return true;
+  }
+
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  bool ok = false;
+  if (size % info.dwPageSize != 0) {
+    // The unused tail of the last mapped page is zero-filled, which gives
+    // us the sentinel for free.
+    HANDLE map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map) {
+      mapping = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(map);
+    }
+    if (mapping) {
+      mapping_size = size;
+      bytes = static_cast<const char *>(mapping);
+      ok = true;
+    }
+  } else {
+    copy.reset(new char[size + 1]);
+    DWORD read = 0;
+    ok = ReadFile(file, copy.get(), static_cast<DWORD>(size), &read, NULL) &&
+         read == size;
+    copy[size] = '\0';
+    bytes = copy.get();
+  }
+  CloseHandle(file);
+  if (!ok) {
+    close();
+    return false;
+  }
+  length = size;
+  return true;
+}
+
+#else
+
+bool SourceFile::open(const char *path) {
+  close();
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+  size_t size = static_cast<size_t>(st.st_size);
+  if (size == 0) {
+    ::close(fd);
+    return true;
+  }
+
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  void *base = MAP_FAILED;
+  size_t base_size = size;
+  if (size % page != 0) {
+    // The unused tail of the last mapped page is zero-filled, which gives
+    // us the sentinel for free.
+    base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  } else {
+    // The file ends exactly on a page boundary: reserve one extra page of
+    // zeroes and map the file over the front of the reservation.
+    base_size = size + page;
+    base = mmap(nullptr, base_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                -1, 0);
+    if (base != MAP_FAILED &&
+        mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+            MAP_FAILED) {
+      munmap(base, base_size);
+      base = MAP_FAILED;
+    }
+  }
+  ::close(fd);
+  if (base == MAP_FAILED)
+    return false;
+
+  madvise(base, size, MADV_SEQUENTIAL);
+  mapping = base;
+  mapping_size = base_size;
+  bytes = static_cast<const char *>(base);
+  length = size;
+  return true;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+
+// Read-only contents of a source file. The bytes are memory-mapped where
+// possible and are always followed by a NUL sentinel, so a Lexer can scan
+// data() in place without copying the file first.
+class SourceFile {
+public:
+  SourceFile() = default;
+  ~SourceFile();
+  SourceFile(const SourceFile &) = delete;
+  SourceFile &operator=(const SourceFile &) = delete;
+  SourceFile(SourceFile &&other) noexcept;
+  SourceFile &operator=(SourceFile &&other) noexcept;
+
+  bool open(const char *path);
+  void close();
+  const char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  const char *bytes = "";
+  size_t length = 0;
+  void *mapping = nullptr;
+  size_t mapping_size = 0;
+  std::unique_ptr<char[]> copy;
+};
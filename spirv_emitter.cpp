@@ -0,0 +1,1451 @@
+#include "spirv_emitter.h"
+#include "keywords.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+namespace op {
+constexpr uint16_t Name = 5, MemberName = 6, ExtInstImport = 11, ExtInst = 12,
+                   MemoryModel = 14, EntryPoint = 15, ExecutionMode = 16,
+                   Capability = 17, TypeVoid = 19, TypeBool = 20,
+                   TypeInt = 21, TypeFloat = 22, TypeVector = 23,
+                   TypeMatrix = 24, TypeStruct = 30, TypePointer = 32,
+                   TypeFunction = 33, ConstantTrue = 41, ConstantFalse = 42,
+                   Constant = 43, ConstantComposite = 44, Function = 54,
+                   FunctionParameter = 55, FunctionEnd = 56,
+                   FunctionCall = 57, Variable = 59, Load = 61, Store = 62,
+                   AccessChain = 65, Decorate = 71, MemberDecorate = 72,
+                   VectorShuffle = 79, CompositeConstruct = 80,
+                   CompositeExtract = 81, Transpose = 84, ConvertFToU = 109,
+                   ConvertFToS = 110, ConvertSToF = 111, ConvertUToF = 112,
+                   SNegate = 126, FNegate = 127, IAdd = 128, FAdd = 129,
+                   ISub = 130, FSub = 131, IMul = 132, FMul = 133, UDiv = 134,
+                   SDiv = 135, FDiv = 136, FMod = 141,
+                   VectorTimesScalar = 142, MatrixTimesScalar = 143,
+                   VectorTimesMatrix = 144, MatrixTimesVector = 145,
+                   MatrixTimesMatrix = 146, Dot = 148, LogicalEqual = 164,
+                   IEqual = 170, UGreaterThan = 172, SGreaterThan = 173,
+                   UGreaterThanEqual = 174, SGreaterThanEqual = 175,
+                   ULessThan = 176, SLessThan = 177, ULessThanEqual = 178,
+                   SLessThanEqual = 179, FOrdEqual = 180, FOrdLessThan = 184,
+                   FOrdGreaterThan = 186, FOrdLessThanEqual = 188,
+                   FOrdGreaterThanEqual = 190, Label = 248, Return = 253,
+                   ReturnValue = 254;
+} // namespace op
+
+constexpr uint32_t spirv_magic = 0x07230203;
+constexpr uint32_t spirv_version_1_0 = 0x00010000;
+
+constexpr uint32_t capability_shader = 1;
+constexpr uint32_t addressing_logical = 0, memory_model_glsl450 = 1;
+constexpr uint32_t model_vertex = 0, model_fragment = 4;
+constexpr uint32_t mode_origin_upper_left = 7;
+constexpr uint32_t storage_input = 1, storage_uniform = 2, storage_output = 3;
+constexpr uint32_t decoration_block = 2, decoration_buffer_block = 3,
+                   decoration_col_major = 5,
+                   decoration_matrix_stride = 7, decoration_builtin = 11,
+                   decoration_flat = 14, decoration_non_writable = 24,
+                   decoration_location = 30,
+                   decoration_binding = 33, decoration_descriptor_set = 34,
+                   decoration_offset = 35;
+constexpr uint32_t builtin_position = 0;
+
+// GLSL.std.450 instructions with integer variants.
+constexpr uint32_t std450_fabs = 4, std450_sabs = 5, std450_fsign = 6,
+                   std450_ssign = 7, std450_fmin = 37, std450_umin = 38,
+                   std450_smin = 39, std450_fmax = 40, std450_umax = 41,
+                   std450_smax = 42, std450_fclamp = 43, std450_uclamp = 44,
+                   std450_sclamp = 45, std450_step = 48,
+                   std450_normalize = 69;
+
+constexpr size_t max_arguments = 16;
+
+void append(std::vector<uint32_t> &section, uint16_t opcode,
+            const uint32_t *operands, size_t count) {
+  section.push_back(static_cast<uint32_t>(count + 1) << 16 | opcode);
+  section.insert(section.end(), operands, operands + count);
+}
+
+void append(std::vector<uint32_t> &section, uint16_t opcode,
+            std::initializer_list<uint32_t> operands) {
+  append(section, opcode, operands.begin(), operands.size());
+}
+
+// A literal string: UTF-8 bytes, NUL-terminated, padded to a whole word.
+void append_string(std::vector<uint32_t> &words, std::string_view text) {
+  for (size_t i = 0; i <= text.size(); i += 4) {
+    uint32_t word = 0;
+    for (size_t j = 0; j < 4 && i + j < text.size(); ++j)
+      word |= static_cast<uint32_t>(static_cast<uint8_t>(text[i + j]))
+              << (8 * j);
+    words.push_back(word);
+  }
+}
+
+uint16_t arithmetic_opcode(std::string_view name, std::string_view scalar) {
+  bool is_float = scalar == "float";
+  if (!is_float && scalar != "int" && scalar != "uint")
+    return 0;
+  if (name == "Plus")
+    return is_float ? op::FAdd : op::IAdd;
+  if (name == "Minus")
+    return is_float ? op::FSub : op::ISub;
+  if (name == "Multiply")
+    return is_float ? op::FMul : op::IMul;
+  if (name == "Divide")
+    return is_float ? op::FDiv : scalar == "int" ? op::SDiv : op::UDiv;
+  return 0;
+}
+
+uint16_t comparison_opcode(std::string_view name, std::string_view scalar) {
+  if (scalar == "bool")
+    return name == "Equality" ? op::LogicalEqual : 0;
+  if (name == "Equality")
+    return scalar == "float" ? op::FOrdEqual : op::IEqual;
+  struct Row {
+    std::string_view name;
+    uint16_t f, s, u;
+  };
+  static constexpr Row rows[] = {
+      {"LessThan", op::FOrdLessThan, op::SLessThan, op::ULessThan},
+      {"GreaterThan", op::FOrdGreaterThan, op::SGreaterThan,
+       op::UGreaterThan},
+      {"LessOrEqualsThan", op::FOrdLessThanEqual, op::SLessThanEqual,
+       op::ULessThanEqual},
+      {"GreaterOrEqualsThan", op::FOrdGreaterThanEqual, op::SGreaterThanEqual,
+       op::UGreaterThanEqual},
+  };
+  for (const Row &row : rows) {
+    if (row.name == name)
+      return scalar == "float" ? row.f : scalar == "int" ? row.s : row.u;
+  }
+  return 0;
+}
+
+} // namespace
+
+size_t SpirvEmitter::WordsHash::operator()(
+    const std::vector<uint32_t> &words) const {
+  uint64_t hash = 1469598103934665603ull;
+  for (uint32_t word : words)
+    hash = (hash ^ word) * 1099511628211ull;
+  return static_cast<size_t>(hash);
+}
+
+SpirvEmitter::SpirvEmitter(std::vector<uint32_t> &out,
+                           Diagnostics &diagnostics, SpirvOptions options)
+    : out(out), diagnostics(diagnostics), options(options) {}
+
+std::vector<SpirvShader>
+SpirvEmitter::emit(ShaderProgram &shader_program,
+                   const std::vector<StageInfo> &stages,
+                   const VaryingLayout &linked) {
+  failed = false;
+  varyings = linked;
+  program = &shader_program;
+  size_t start = out.size();
+  std::vector<SpirvShader> shaders;
+  for (const StageInfo &info : stages) {
+    size_t begin = out.size();
+    if (!emit_stage(info)) {
+      out.resize(start);
+      shaders.clear();
+      break;
+    }
+    shaders.push_back({info.stage, begin, out.size()});
+  }
+  program = nullptr;
+  return shaders;
+}
+
+void SpirvEmitter::reset() {
+  entry_points.clear();
+  debug.clear();
+  annotations.clear();
+  globals.clear();
+  code.clear();
+  next_id = 1;
+  declared.clear();
+  type_ids.clear();
+  laid_out.clear();
+  uniform_layout = {};
+  function_ids.clear();
+  attributes = {};
+  inputs.clear();
+  outputs.clear();
+  uniform_block = 0;
+  stage = NoSymbol;
+  locals.clear();
+  loaded.clear();
+}
+
+bool SpirvEmitter::emit_stage(const StageInfo &info) {
+  reset();
+  glsl_std_450 = next_id++;
+
+  // Calls may come before the callee, so every overload gets its id first.
+  StageUsage usage;
+  if (options.strip_unused)
+    usage = program->usage(info.entry);
+  for (uint32_t i = 0; i < program->overloads.size(); ++i) {
+    bool used = !options.strip_unused || usage.overloads[i];
+    function_ids.push_back(program->is_emitted(i) && used ? next_id++ : 0);
+  }
+
+  declare_uniforms();
+  declare_interface(info);
+  for (uint32_t i = 0; i < program->overloads.size(); ++i) {
+    if (function_ids[i])
+      emit_function(i);
+  }
+  emit_entry(info);
+  if (failed)
+    return false;
+
+  size_t begin = out.size();
+  out.insert(out.end(), {spirv_magic, spirv_version_1_0, 0, next_id, 0});
+  append(out, op::Capability, {capability_shader});
+  std::vector<uint32_t> operands{glsl_std_450};
+  append_string(operands, "GLSL.std.450");
+  append(out, op::ExtInstImport, operands.data(), operands.size());
+  append(out, op::MemoryModel, {addressing_logical, memory_model_glsl450});
+  for (const std::vector<uint32_t> *section :
+       {&entry_points, &debug, &annotations, &globals, &code})
+    out.insert(out.end(), section->begin(), section->end());
+
+  std::string problem;
+  if (!validate_spirv(out.data() + begin, out.size() - begin, problem)) {
+    diagnostics.report(Severity::Error, SourceSpan{},
+                       "internal error: invalid SPIR-V for the %s stage: %s",
+                       symbol_text(info.stage).data(), problem.c_str());
+    return false;
+  }
+  return true;
+}
+
+void SpirvEmitter::declare_uniforms() {
+  if (program->uniforms.empty())
+    return;
+  uniform_layout = layout_block(*program, program->uniforms, options.layout,
+                                options.reorder_uniforms);
+  std::vector<uint32_t> operands;
+  for (const MemberLayout &member : uniform_layout.members)
+    operands.push_back(type_id(member.type));
+  uint32_t block = next_id++;
+  operands.insert(operands.begin(), block);
+  append(globals, op::TypeStruct, operands.data(), operands.size());
+  name(block, "Uniforms");
+  for (size_t i = 0; i < uniform_layout.members.size(); ++i)
+    member_name(block, static_cast<uint32_t>(i),
+                symbol_text(uniform_layout.members[i].name));
+  // A Block in Uniform storage must follow std140; a std430 one is a
+  // read-only storage buffer, which SPIR-V 1.0 marks as a BufferBlock.
+  if (options.layout == LayoutRules::Std430) {
+    decorate(block, {decoration_buffer_block});
+    for (size_t i = 0; i < uniform_layout.members.size(); ++i)
+      member_decorate(block, static_cast<uint32_t>(i),
+                      {decoration_non_writable});
+  } else {
+    decorate(block, {decoration_block});
+  }
+  decorate_layout(block, uniform_layout);
+
+  uint32_t pointer = pointer_type(storage_uniform, block);
+  uniform_block = next_id++;
+  append(globals, op::Variable, {pointer, uniform_block, storage_uniform});
+  name(uniform_block, "uniforms");
+  decorate(uniform_block, {decoration_descriptor_set, 0});
+  decorate(uniform_block, {decoration_binding, 0});
+}
+
+void SpirvEmitter::declare_interface(const StageInfo &info) {
+  auto add_input = [&](Symbol name, Symbol type, uint32_t location) {
+    uint32_t id = variable(storage_input, type, symbol_text(name));
+    decorate(id, {decoration_location, location});
+    if (info.stage == program->fragment &&
+        shape_of(symbol_text(type)).scalar != "float")
+      decorate(id, {decoration_flat});
+    inputs.push_back({name, type, id});
+  };
+
+  if (info.stage == program->vertex) {
+    attributes = layout_vertex(*program);
+    for (const AttributeLayout &attribute : attributes.attributes)
+      add_input(attribute.name, input_type(attribute), attribute.location);
+    const VaryingSlots *slots = varyings.find(info.varying);
+    // The position comes last, so the varying's outputs start at 0.
+    if (slots && slots->packed) {
+      for (uint32_t k = 0; k < slots->count; ++k) {
+        std::string slot = packed_name(slots->location + k);
+        Symbol type = shaped_type("float", slots->widths[k]);
+        uint32_t id = variable(storage_output, type, slot);
+        decorate(id, {decoration_location, slots->location + k});
+        outputs.push_back({intern(slot), type, id});
+      }
+    } else if (slots) {
+      uint32_t id = variable(storage_output, info.result_type,
+                             symbol_text(info.varying));
+      decorate(id, {decoration_location, slots->location});
+      outputs.push_back({info.varying, info.result_type, id});
+    }
+    uint32_t id = variable(storage_output, program->vec4_type, "gl_Position");
+    decorate(id, {decoration_builtin, builtin_position});
+    outputs.push_back({NoSymbol, program->vec4_type, id});
+    return;
+  }
+
+  // Varyings keep the locations the vertex stage gave them; other fragment
+  // inputs come after. A fragment input of the same name as a varying
+  // declares its type, as it does for GLSL.
+  auto fragment_input = [&](Symbol name) -> const ShaderVariable * {
+    for (const ShaderVariable &input : program->fragment_inputs) {
+      if (input.name == name)
+        return &input;
+    }
+    return nullptr;
+  };
+  for (const VaryingSlots &slots : varyings.varyings) {
+    if (slots.packed) {
+      for (uint32_t k = 0; k < slots.count; ++k)
+        add_input(intern(packed_name(slots.location + k)),
+                  shaped_type("float", slots.widths[k]), slots.location + k);
+      continue;
+    }
+    const ShaderVariable *declared = fragment_input(slots.name);
+    add_input(slots.name, declared ? declared->type : slots.type,
+              slots.location);
+  }
+  uint32_t location = varyings.locations;
+  for (const ShaderVariable &input : program->fragment_inputs) {
+    if (varyings.find(input.name))
+      continue;
+    add_input(input.name, input.type, location);
+    location += location_count(*program, input.type);
+  }
+  uint32_t id = variable(storage_output, program->vec4_type, "out_color");
+  decorate(id, {decoration_location, 0});
+  outputs.push_back({NoSymbol, program->vec4_type, id});
+}
+
+void SpirvEmitter::emit_function(uint32_t overload) {
+  const AstRef &function = program->overloads[overload].function;
+  const Ast &ast = *function.ast;
+  NodeRange children = ast.children(function.id);
+  NodeId params = children[children.size() - 2];
+  NodeId body = children[children.size() - 1];
+  uint32_t id = function_ids[overload];
+
+  NodeRange types = ast.children(program->overloads[overload].signature);
+  std::vector<uint32_t> signature;
+  for (NodeId type : types)
+    signature.push_back(type_id(ast[type].value));
+  std::rotate(signature.begin(), signature.end() - 1, signature.end());
+  append(code, op::Function, {signature[0], id, 0, function_type(signature)});
+  name(id, symbol_text(ast[function.id].value));
+
+  locals.clear();
+  loaded.clear();
+  for (uint32_t i = 0; i < ast[params].child_count; ++i) {
+    Symbol param = ast[ast.child(params, i)].value;
+    uint32_t param_id = next_id++;
+    append(code, op::FunctionParameter, {signature[i + 1], param_id});
+    name(param_id, symbol_text(param));
+    locals.push_back({param, {param_id, ast[types[i]].value}});
+  }
+  append(code, op::Label, {next_id++});
+  Value result = value(ast, body);
+  append(code, op::ReturnValue, {result.id});
+  append(code, op::FunctionEnd, {});
+  locals.clear();
+  loaded.clear();
+}
+
+void SpirvEmitter::emit_entry(const StageInfo &info) {
+  const Ast &ast = *info.entry.ast;
+  uint32_t void_type = unique(op::TypeVoid, 0, {});
+  uint32_t entry = next_id++;
+  append(code, op::Function,
+         {void_type, entry, 0, function_type({void_type})});
+  name(entry, "main");
+  append(code, op::Label, {next_id++});
+
+  stage = info.stage;
+  locals.clear();
+  loaded.clear();
+  position_binding = info.position;
+  Value result = value(ast, info.body);
+  if (stage == program->fragment) {
+    // The color target is always a vec4; widen like the GLSL backend.
+    uint32_t one = constant_float(1.0f);
+    uint32_t vec4 = type_id(program->vec4_type);
+    uint32_t width = shape_of(symbol_text(result.type)).width;
+    if (width == 3)
+      result.id = instruction(op::CompositeConstruct, vec4, {result.id, one});
+    else if (width == 1)
+      result.id = instruction(op::CompositeConstruct, vec4,
+                              {result.id, result.id, result.id, one});
+  }
+  const VaryingSlots *slots = varyings.find(info.varying);
+  if (stage == program->vertex && slots && slots->packed)
+    store_packed(*slots, result);
+  else
+    append(code, op::Store, {outputs[0].variable, result.id});
+  if (info.position != NoNode)
+    append(code, op::Store, {outputs.back().variable, position.id});
+  position_binding = NoNode;
+  append(code, op::Return, {});
+  append(code, op::FunctionEnd, {});
+  stage = NoSymbol;
+  locals.clear();
+  loaded.clear();
+
+  std::vector<uint32_t> operands{
+      info.stage == program->vertex ? model_vertex : model_fragment, entry};
+  append_string(operands, "main");
+  for (const Interface &input : inputs)
+    operands.push_back(input.variable);
+  for (const Interface &output : outputs)
+    operands.push_back(output.variable);
+  append(entry_points, op::EntryPoint, operands.data(), operands.size());
+  if (info.stage == program->fragment)
+    append(entry_points, op::ExecutionMode, {entry, mode_origin_upper_left});
+}
+
+void SpirvEmitter::store_packed(const VaryingSlots &slots,
+                                const Value &varying) {
+  std::vector<ShaderVariable> fields = struct_fields(*program, slots.type);
+  for (uint32_t k = 0; k < slots.count; ++k) {
+    std::vector<const VaryingLeaf *> parts;
+    for (const VaryingLeaf &leaf : slots.leaves) {
+      if (leaf.slot == k)
+        parts.push_back(&leaf);
+    }
+    std::sort(parts.begin(), parts.end(),
+              [](const VaryingLeaf *a, const VaryingLeaf *b) {
+                return a->component < b->component;
+              });
+    std::vector<uint32_t> members;
+    for (const VaryingLeaf *leaf : parts)
+      members.push_back(
+          instruction(op::CompositeExtract, type_id(leaf->type),
+                      {varying.id, static_cast<uint32_t>(leaf->member)}));
+    Symbol type = shaped_type("float", slots.widths[k]);
+    uint32_t packed = members[0];
+    if (members.size() > 1)
+      packed = instruction(op::CompositeConstruct, type_id(type),
+                           members.data(), members.size());
+    append(code, op::Store, {outputs[k].variable, packed});
+  }
+}
+
+SpirvEmitter::Value SpirvEmitter::load_packed(const VaryingSlots &slots) {
+  std::vector<Value> loads;
+  for (uint32_t k = 0; k < slots.count; ++k) {
+    Symbol slot = intern(packed_name(slots.location + k));
+    for (const Interface &input : inputs) {
+      if (input.name == slot)
+        loads.push_back({instruction(op::Load, type_id(input.type),
+                                     {input.variable}),
+                         input.type});
+    }
+  }
+  std::vector<uint32_t> members;
+  for (const VaryingLeaf &leaf : slots.leaves) {
+    const Value &slot = loads[leaf.slot];
+    if (leaf.width == slots.widths[leaf.slot]) {
+      members.push_back(slot.id);
+    } else if (leaf.width == 1) {
+      members.push_back(instruction(op::CompositeExtract,
+                                    type_id(program->float_type),
+                                    {slot.id, leaf.component}));
+    } else {
+      std::vector<uint32_t> operands{slot.id, slot.id};
+      for (uint32_t c = 0; c < leaf.width; ++c)
+        operands.push_back(leaf.component + c);
+      members.push_back(instruction(op::VectorShuffle, type_id(leaf.type),
+                                    operands.data(), operands.size()));
+    }
+  }
+  return {instruction(op::CompositeConstruct, type_id(slots.type),
+                      members.data(), members.size()),
+          slots.type};
+}
+
+SpirvEmitter::Value SpirvEmitter::value(const Ast &ast, NodeId id) {
+  const ASTNode &node = ast[id];
+  switch (node.type) {
+  case NodeType::NumberLiteral: {
+    float number = std::strtof(symbol_text(node.value).data(), nullptr);
+    return {constant_float(number), program->float_type, true};
+  }
+  case NodeType::Identifier:
+    return identifier(ast, id);
+  case NodeType::UnaryOp: {
+    Value operand = value(ast, ast.child(id, 0));
+    if (!operand.id)
+      return {};
+    std::string_view type = symbol_text(operand.type);
+    std::string_view scalar = shape_of(type).scalar;
+    if (scalar == "float")
+      return {instruction(op::FNegate, type_id(operand.type), {operand.id}),
+              operand.type};
+    if (scalar == "int")
+      return {instruction(op::SNegate, type_id(operand.type), {operand.id}),
+              operand.type};
+    if (matrix_size(type))
+      return {instruction(op::MatrixTimesScalar, type_id(operand.type),
+                          {operand.id, constant_float(-1.0f)}),
+              operand.type};
+    error(ast, id, "cannot negate '%s'", type.data());
+    return {};
+  }
+  case NodeType::FieldAccess:
+    return member(ast, ast.child(id, 0), node.value, id);
+  case NodeType::BinOp:
+    return binary(ast, id);
+  case NodeType::FunctionApplication:
+    return call(ast, id);
+  case NodeType::LetInExpr: {
+    NodeRange children = ast.children(id);
+    for (NodeId child : children) {
+      if (ast[child].type != NodeType::LetBinding)
+        continue;
+      Value bound = value(ast, ast.child(child, 0));
+      if (!bound.constant)
+        name(bound.id, symbol_text(ast[child].value));
+      if (child == position_binding)
+        position = bound;
+      locals.push_back({ast[child].value, bound});
+    }
+    return value(ast, children[children.size() - 1]);
+  }
+  case NodeType::Input:
+    return value(ast, ast.child(id, 1));
+  default:
+    error(ast, id, "cannot generate SPIR-V for this expression");
+    return {};
+  }
+}
+
+SpirvEmitter::Value SpirvEmitter::identifier(const Ast &ast, NodeId id) {
+  Symbol symbol = ast[id].value;
+  for (auto it = locals.rbegin(); it != locals.rend(); ++it) {
+    if (it->name == symbol)
+      return it->value;
+  }
+  for (const Local &local : loaded) {
+    if (local.name == symbol)
+      return local.value;
+  }
+
+  // Constants are computed where they are used; only literals and
+  // constructors of them become module-level constants.
+  for (size_t i = 0; i < program->globals.size(); ++i) {
+    if (program->globals[i].name != symbol)
+      continue;
+    const AstRef &constant = program->constants[i];
+    std::vector<Local> scope;
+    scope.swap(locals);
+    Value result = value(*constant.ast, constant.ast->child(constant.id, 0));
+    scope.swap(locals);
+    if (!result.constant)
+      name(result.id, symbol_text(symbol));
+    loaded.push_back({symbol, result});
+    return result;
+  }
+
+  if (int i = uniform_layout.find(symbol); i >= 0) {
+    Symbol uniform_type = uniform_layout.members[i].type;
+    uint32_t type = type_id(uniform_type);
+    uint32_t pointer =
+        instruction(op::AccessChain, pointer_type(storage_uniform, type),
+                    {uniform_block, constant_int(i)});
+    Value result{instruction(op::Load, type, {pointer}), uniform_type};
+    loaded.push_back({symbol, result});
+    return result;
+  }
+
+  const VaryingSlots *slots = varyings.find(symbol);
+  if (stage == program->fragment && slots && slots->packed) {
+    Value result = load_packed(*slots);
+    name(result.id, symbol_text(symbol));
+    loaded.push_back({symbol, result});
+    return result;
+  }
+  for (const Interface &input : inputs) {
+    // Functions only see uniforms and constants.
+    if (stage == NoSymbol || input.name != symbol)
+      continue;
+    Value result{instruction(op::Load, type_id(input.type), {input.variable}),
+                 input.type};
+    const AttributeLayout *attribute = attributes.find(symbol);
+    if (attribute && attribute->format == AttributeFormat::Octahedral)
+      result = decode_octahedral(result);
+    loaded.push_back({symbol, result});
+    return result;
+  }
+  error(ast, id, "unknown identifier '%s'", symbol_text(symbol).data());
+  return {};
+}
+
+SpirvEmitter::Value SpirvEmitter::binary(const Ast &ast, NodeId id) {
+  std::string_view name = symbol_text(ast[id].value);
+  NodeId lhs = ast.child(id, 0);
+  NodeId rhs = ast.child(id, 1);
+  if (name == "Dot")
+    return member(ast, lhs, ast[rhs].value, rhs);
+  Value l = value(ast, lhs);
+  Value r = value(ast, rhs);
+  if (!l.id || !r.id)
+    return {};
+  std::string_view lt = symbol_text(l.type), rt = symbol_text(r.type);
+  TypeShape ls = shape_of(lt), rs = shape_of(rt);
+  uint32_t lm = matrix_size(lt), rm = matrix_size(rt);
+
+  if (is_comparison(name)) {
+    uint16_t opcode = l.type == r.type && ls.width == 1
+                          ? comparison_opcode(name, ls.scalar)
+                          : 0;
+    if (!opcode) {
+      error(ast, id, "SPIR-V output can only compare scalars of one type, "
+                     "not '%s' and '%s'",
+            lt.data(), rt.data());
+      return {};
+    }
+    Symbol type = program->bool_type;
+    return {instruction(opcode, type_id(type), {l.id, r.id}), type};
+  }
+
+  bool multiply = name == "Multiply";
+  if (lm || rm) {
+    uint16_t opcode = 0;
+    Value a = l, b = r;
+    Symbol type = NoSymbol;
+    if (multiply && lm && rm) {
+      opcode = op::MatrixTimesMatrix;
+      type = l.type;
+    } else if (multiply && lm && rs.width > 1) {
+      opcode = op::MatrixTimesVector;
+      type = r.type;
+    } else if (multiply && rm && ls.width > 1) {
+      opcode = op::VectorTimesMatrix;
+      type = l.type;
+    } else if (multiply && lm && rs.width == 1) {
+      opcode = op::MatrixTimesScalar;
+      type = l.type;
+    } else if (multiply && rm && ls.width == 1) {
+      opcode = op::MatrixTimesScalar;
+      std::swap(a, b);
+      type = r.type;
+    }
+    if (!opcode) {
+      error(ast, id, "SPIR-V output does not support '%.*s' on '%s' and '%s'",
+            static_cast<int>(name.size()), name.data(), lt.data(), rt.data());
+      return {};
+    }
+    return {instruction(opcode, type_id(type), {a.id, b.id}), type};
+  }
+
+  if (ls.scalar != rs.scalar) {
+    error(ast, id, "SPIR-V output cannot mix '%s' and '%s'", lt.data(),
+          rt.data());
+    return {};
+  }
+  if (multiply && ls.scalar == "float" && ls.width != rs.width) {
+    if (ls.width == 1)
+      std::swap(l, r);
+    return {instruction(op::VectorTimesScalar, type_id(l.type), {l.id, r.id}),
+            l.type};
+  }
+  if (ls.width == 1 && rs.width > 1)
+    l = splat(l, r.type);
+  else if (rs.width == 1 && ls.width > 1)
+    r = splat(r, l.type);
+  uint16_t opcode = arithmetic_opcode(name, ls.scalar);
+  if (!opcode) {
+    error(ast, id, "SPIR-V output does not support '%.*s' on '%s'",
+          static_cast<int>(name.size()), name.data(), lt.data());
+    return {};
+  }
+  return {instruction(opcode, type_id(l.type), {l.id, r.id}), l.type};
+}
+
+SpirvEmitter::Value SpirvEmitter::call(const Ast &ast, NodeId id) {
+  NodeId arg_nodes[max_arguments];
+  size_t count = 0;
+  NodeId head = id;
+  while (ast[head].type == NodeType::FunctionApplication &&
+         count < max_arguments) {
+    arg_nodes[count++] = ast.child(head, 1);
+    head = ast.child(head, 0);
+  }
+  Value args[max_arguments];
+  for (size_t i = 0; i < count; ++i) {
+    args[i] = value(ast, arg_nodes[count - 1 - i]);
+    if (!args[i].id)
+      return {};
+  }
+
+  Symbol function = ast[head].value;
+  std::string_view text = symbol_text(function);
+  if (is_builtin_type(text) || program->types.count(function))
+    return construct(ast, head, function, args, count);
+
+  if (program->function_overloads.count(function)) {
+    Symbol arg_types[max_arguments];
+    for (size_t i = 0; i < count; ++i)
+      arg_types[i] = args[i].type;
+    int index = program->resolve_call(function, arg_types, count);
+    if (index < 0) {
+      error(ast, head, "arguments of '%s' do not match its signature",
+            text.data());
+      return {};
+    }
+    Symbol type = program->return_type(static_cast<uint32_t>(index));
+    uint32_t operands[max_arguments + 1];
+    operands[0] = function_ids[index];
+    for (size_t i = 0; i < count; ++i)
+      operands[i + 1] = args[i].id;
+    return {instruction(op::FunctionCall, type_id(type), operands, count + 1),
+            type};
+  }
+
+  const BuiltinFunction *builtin = find_builtin_function(text);
+  if (!builtin) {
+    error(ast, head, "unknown function '%s'", text.data());
+    return {};
+  }
+  return builtin_call(ast, head, *builtin, args, count);
+}
+
+SpirvEmitter::Value SpirvEmitter::builtin_call(const Ast &ast, NodeId at,
+                                               const BuiltinFunction &builtin,
+                                               Value *args, size_t count) {
+  std::string_view name = builtin.name;
+  Symbol type = NoSymbol;
+  switch (builtin.result) {
+  case BuiltinResult::Float:
+    type = program->float_type;
+    break;
+  case BuiltinResult::FirstArg:
+    type = args[0].type;
+    break;
+  case BuiltinResult::LastArg:
+    type = args[count - 1].type;
+    break;
+  case BuiltinResult::Vec4:
+    error(ast, at, "'%.*s' is not supported by the SPIR-V output yet",
+          static_cast<int>(name.size()), name.data());
+    return {};
+  }
+
+  if (name == "dot") {
+    if (count != 2)
+      return {};
+    if (shape_of(symbol_text(args[0].type)).width == 1)
+      return {instruction(op::FMul, type_id(type), {args[0].id, args[1].id}),
+              type};
+    return {instruction(op::Dot, type_id(type), {args[0].id, args[1].id}),
+            type};
+  }
+  if (name == "transpose")
+    return {instruction(op::Transpose, type_id(type), {args[0].id}), type};
+
+  // GLSL lets one scalar stand for a whole vector in min, max, clamp, mix,
+  // step and friends; SPIR-V wants every operand of the result type. The
+  // ratio of refract stays a scalar.
+  TypeShape shape = shape_of(symbol_text(type));
+  if (shape.width > 1) {
+    for (size_t i = 0; i < count; ++i) {
+      if (shape_of(symbol_text(args[i].type)).width == 1 &&
+          !(name == "refract" && i == 2))
+        args[i] = splat(args[i], type);
+    }
+  }
+  if (name == "mod") {
+    if (count != 2)
+      return {};
+    return {instruction(op::FMod, type_id(type), {args[0].id, args[1].id}),
+            type};
+  }
+
+  uint32_t instruction_number = builtin.glsl_std_450;
+  if (shape.scalar == "int" || shape.scalar == "uint") {
+    bool is_signed = shape.scalar == "int";
+    switch (instruction_number) {
+    case std450_fabs:
+      instruction_number = is_signed ? std450_sabs : 0;
+      break;
+    case std450_fsign:
+      instruction_number = is_signed ? std450_ssign : 0;
+      break;
+    case std450_fmin:
+      instruction_number = is_signed ? std450_smin : std450_umin;
+      break;
+    case std450_fmax:
+      instruction_number = is_signed ? std450_smax : std450_umax;
+      break;
+    case std450_fclamp:
+      instruction_number = is_signed ? std450_sclamp : std450_uclamp;
+      break;
+    default:
+      instruction_number = 0;
+      break;
+    }
+  }
+  if (!instruction_number) {
+    error(ast, at, "SPIR-V output does not support '%.*s' on '%s'",
+          static_cast<int>(name.size()), name.data(),
+          symbol_text(type).data());
+    return {};
+  }
+  uint32_t operands[max_arguments + 2] = {glsl_std_450, instruction_number};
+  for (size_t i = 0; i < count; ++i)
+    operands[i + 2] = args[i].id;
+  return {instruction(op::ExtInst, type_id(type), operands, count + 2), type};
+}
+
+SpirvEmitter::Value SpirvEmitter::construct(const Ast &ast, NodeId at,
+                                            Symbol type, const Value *args,
+                                            size_t count) {
+  std::string_view text = symbol_text(type);
+  uint32_t result_type = type_id(type);
+  if (!result_type)
+    return {};
+  uint32_t ids[max_arguments];
+  bool constant = true;
+  for (size_t i = 0; i < count; ++i) {
+    ids[i] = args[i].id;
+    constant &= args[i].constant;
+  }
+  auto composite = [&](const uint32_t *ids, size_t count,
+                       bool constant) -> Value {
+    if (constant)
+      return {unique(op::ConstantComposite, result_type, ids, count), type,
+              true};
+    return {instruction(op::CompositeConstruct, result_type, ids, count),
+            type};
+  };
+  auto mismatch = [&]() -> Value {
+    error(ast, at, "cannot build a '%s' from these %zu arguments", text.data(),
+          count);
+    return {};
+  };
+
+  TypeShape shape = shape_of(text);
+  if (shape.width && count == 1) {
+    Value arg = args[0];
+    TypeShape from = shape_of(symbol_text(arg.type));
+    if (arg.type == type)
+      return arg;
+    if (from.width == 1 && from.scalar != shape.scalar) {
+      uint16_t opcode = 0;
+      if (shape.scalar == "float")
+        opcode = from.scalar == "int"    ? op::ConvertSToF
+                 : from.scalar == "uint" ? op::ConvertUToF
+                                         : 0;
+      else if (from.scalar == "float")
+        opcode = shape.scalar == "int"    ? op::ConvertFToS
+                 : shape.scalar == "uint" ? op::ConvertFToU
+                                          : 0;
+      if (!opcode)
+        return mismatch();
+      Symbol scalar = intern(shape.scalar);
+      arg = {instruction(opcode, type_id(scalar), {arg.id}), scalar};
+      from.scalar = shape.scalar;
+    }
+    if (shape.width == 1)
+      return arg;
+    if (from.width == 1)
+      return splat(arg, type);
+    // vec3 (v4) drops the trailing components.
+    if (from.scalar == shape.scalar && from.width > shape.width) {
+      uint32_t operands[6] = {arg.id, arg.id, 0, 1, 2, 3};
+      return {instruction(op::VectorShuffle, result_type, operands,
+                          2 + shape.width),
+              type};
+    }
+    return mismatch();
+  }
+  if (shape.width > 1) {
+    uint32_t components = 0;
+    bool scalars = true;
+    for (size_t i = 0; i < count; ++i) {
+      TypeShape from = shape_of(symbol_text(args[i].type));
+      if (from.scalar != shape.scalar)
+        return mismatch();
+      components += from.width;
+      scalars &= from.width == 1;
+    }
+    if (components != shape.width)
+      return mismatch();
+    return composite(ids, count, constant && scalars);
+  }
+
+  if (uint32_t columns = matrix_size(text)) {
+    Symbol column = shaped_type("float", columns);
+    if (count == columns) {
+      for (size_t i = 0; i < count; ++i) {
+        if (args[i].type != column)
+          return mismatch();
+      }
+      return composite(ids, count, constant);
+    }
+    // mat4 s is s along the diagonal.
+    if (count == 1 && args[0].type == program->float_type) {
+      uint32_t zero = constant_float(0.0f);
+      uint32_t column_type = type_id(column);
+      uint32_t cells[4];
+      for (uint32_t c = 0; c < columns; ++c) {
+        for (uint32_t r = 0; r < columns; ++r)
+          cells[r] = r == c ? args[0].id : zero;
+        ids[c] = constant ? unique(op::ConstantComposite, column_type, cells,
+                                   columns)
+                          : instruction(op::CompositeConstruct, column_type,
+                                        cells, columns);
+      }
+      return composite(ids, columns, constant);
+    }
+    return mismatch();
+  }
+
+  auto it = program->types.find(type);
+  if (it == program->types.end())
+    return mismatch();
+  const Ast &tast = *it->second.ast;
+  NodeRange members = tast.children(it->second.id);
+  if (members.size() != count)
+    return mismatch();
+  for (size_t i = 0; i < count; ++i) {
+    NodeId member = members[i];
+    if (tast[tast.child(member, tast[member].child_count - 1)].value !=
+        args[i].type)
+      return mismatch();
+  }
+  return composite(ids, count, constant);
+}
+
+SpirvEmitter::Value SpirvEmitter::member(const Ast &ast, NodeId base,
+                                         Symbol field, NodeId at) {
+  Value object = value(ast, base);
+  if (!object.id)
+    return {};
+  std::string_view name = symbol_text(field);
+
+  TypeShape shape = shape_of(symbol_text(object.type));
+  if (shape.width > 1 && !name.empty() && name.size() <= 4) {
+    uint32_t operands[6] = {object.id, object.id};
+    bool valid = true;
+    for (size_t i = 0; i < name.size(); ++i) {
+      int index = swizzle_index(name[i]);
+      valid &= index >= 0 && static_cast<uint32_t>(index) < shape.width;
+      operands[2 + i] = static_cast<uint32_t>(index);
+    }
+    if (valid) {
+      Symbol type =
+          shaped_type(shape.scalar, static_cast<uint32_t>(name.size()));
+      if (name.size() == 1)
+        return {instruction(op::CompositeExtract, type_id(type),
+                            {object.id, operands[2]}),
+                type};
+      return {instruction(op::VectorShuffle, type_id(type), operands,
+                          2 + name.size()),
+              type};
+    }
+  }
+
+  int index = program->field_index(object.type, field);
+  if (index < 0) {
+    error(ast, at, "'%s' has no field '%.*s'", symbol_text(object.type).data(),
+          static_cast<int>(name.size()), name.data());
+    return {};
+  }
+  const AstRef &ref = program->types.at(object.type);
+  NodeId node = ref.ast->child(ref.id, static_cast<uint32_t>(index));
+  Symbol type =
+      (*ref.ast)[ref.ast->child(node, (*ref.ast)[node].child_count - 1)].value;
+  return {instruction(op::CompositeExtract, type_id(type),
+                      {object.id, static_cast<uint32_t>(index)}),
+          type};
+}
+
+SpirvEmitter::Value SpirvEmitter::decode_octahedral(const Value &encoded) {
+  Symbol vec2 = encoded.type, vec3 = intern("vec3");
+  uint32_t float_id = type_id(program->float_type);
+  uint32_t vec2_id = type_id(vec2);
+  Value zero = splat({constant_float(0.0f), program->float_type, true}, vec2);
+  Value one = splat({constant_float(1.0f), program->float_type, true}, vec2);
+  auto std450 = [&](uint32_t type, uint32_t number,
+                    std::initializer_list<uint32_t> args) {
+    std::vector<uint32_t> operands{glsl_std_450, number};
+    operands.insert(operands.end(), args);
+    return instruction(op::ExtInst, type, operands.data(), operands.size());
+  };
+
+  // z = 1 - |x| - |y|; where z < 0 the lower hemisphere was folded over
+  // the diagonals: xy -= max(-z, 0) * (xy >= 0 ? 1 : -1).
+  uint32_t magnitude = std450(vec2_id, std450_fabs, {encoded.id});
+  uint32_t z = instruction(
+      op::FSub, float_id,
+      {instruction(op::FSub, float_id,
+                   {constant_float(1.0f),
+                    instruction(op::CompositeExtract, float_id,
+                                {magnitude, 0})}),
+       instruction(op::CompositeExtract, float_id, {magnitude, 1})});
+  uint32_t fold = std450(float_id, std450_fmax,
+                         {instruction(op::FNegate, float_id, {z}),
+                          constant_float(0.0f)});
+  uint32_t side = instruction(
+      op::FSub, vec2_id,
+      {instruction(op::VectorTimesScalar, vec2_id,
+                   {std450(vec2_id, std450_step, {zero.id, encoded.id}),
+                    constant_float(2.0f)}),
+       one.id});
+  uint32_t xy = instruction(
+      op::FSub, vec2_id,
+      {encoded.id,
+       instruction(op::VectorTimesScalar, vec2_id, {side, fold})});
+  uint32_t normal = instruction(op::CompositeConstruct, type_id(vec3),
+                                {xy, z});
+  return {std450(type_id(vec3), std450_normalize, {normal}), vec3};
+}
+
+SpirvEmitter::Value SpirvEmitter::splat(const Value &scalar,
+                                        Symbol vector_type) {
+  uint32_t width = shape_of(symbol_text(vector_type)).width;
+  uint32_t ids[4] = {scalar.id, scalar.id, scalar.id, scalar.id};
+  uint32_t type = type_id(vector_type);
+  if (scalar.constant)
+    return {unique(op::ConstantComposite, type, ids, width), vector_type,
+            true};
+  return {instruction(op::CompositeConstruct, type, ids, width), vector_type};
+}
+
+uint32_t SpirvEmitter::type_id(Symbol type) {
+  if (type == NoSymbol)
+    return 0;
+  auto found = type_ids.find(type);
+  if (found != type_ids.end())
+    return found->second;
+
+  std::string_view text = symbol_text(type);
+  TypeShape shape = shape_of(text);
+  uint32_t id = 0;
+  if (text == "float") {
+    id = unique(op::TypeFloat, 0, {32});
+  } else if (text == "int" || text == "uint") {
+    id = unique(op::TypeInt, 0, {32, text == "int" ? 1u : 0u});
+  } else if (text == "bool") {
+    id = unique(op::TypeBool, 0, {});
+  } else if (shape.width > 1) {
+    id = unique(op::TypeVector, 0,
+                {type_id(intern(shape.scalar)), shape.width});
+  } else if (uint32_t columns = matrix_size(text)) {
+    id = unique(op::TypeMatrix, 0,
+                {type_id(shaped_type("float", columns)), columns});
+  } else if (program->types.count(type) && !is_builtin_type(text)) {
+    const AstRef &ref = program->types.at(type);
+    const Ast &ast = *ref.ast;
+    std::vector<uint32_t> operands{0};
+    for (NodeId member : ast.children(ref.id))
+      operands.push_back(
+          type_id(ast[ast.child(member, ast[member].child_count - 1)].value));
+    id = operands[0] = next_id++;
+    append(globals, op::TypeStruct, operands.data(), operands.size());
+    name(id, text);
+    uint32_t index = 0;
+    for (NodeId member : ast.children(ref.id))
+      member_name(id, index++, symbol_text(ast[member].value));
+  } else {
+    failed = true;
+    diagnostics.report(Severity::Error, SourceSpan{},
+                       "type '%s' has no SPIR-V equivalent", text.data());
+  }
+  type_ids[type] = id;
+  return id;
+}
+
+uint32_t SpirvEmitter::pointer_type(uint32_t storage, uint32_t type) {
+  return unique(op::TypePointer, 0, {storage, type});
+}
+
+uint32_t SpirvEmitter::function_type(const std::vector<uint32_t> &types) {
+  return unique(op::TypeFunction, 0, types.data(), types.size());
+}
+
+uint32_t SpirvEmitter::constant_float(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof bits);
+  return unique(op::Constant, type_id(program->float_type), {bits});
+}
+
+uint32_t SpirvEmitter::constant_int(int32_t value) {
+  return unique(op::Constant, type_id(intern("int")),
+                {static_cast<uint32_t>(value)});
+}
+
+uint32_t SpirvEmitter::unique(uint16_t opcode, uint32_t type,
+                              const uint32_t *operands, size_t count) {
+  std::vector<uint32_t> key;
+  key.reserve(count + 2);
+  key.push_back(opcode);
+  key.push_back(type);
+  key.insert(key.end(), operands, operands + count);
+  auto [it, inserted] = declared.emplace(std::move(key), 0);
+  if (!inserted)
+    return it->second;
+  uint32_t id = it->second = next_id++;
+  globals.push_back(static_cast<uint32_t>(count + (type ? 3 : 2)) << 16 |
+                    opcode);
+  if (type)
+    globals.push_back(type);
+  globals.push_back(id);
+  globals.insert(globals.end(), operands, operands + count);
+  return id;
+}
+
+uint32_t SpirvEmitter::instruction(uint16_t opcode, uint32_t type,
+                                   const uint32_t *operands, size_t count) {
+  uint32_t id = next_id++;
+  code.push_back(static_cast<uint32_t>(count + 3) << 16 | opcode);
+  code.push_back(type);
+  code.push_back(id);
+  code.insert(code.end(), operands, operands + count);
+  return id;
+}
+
+void SpirvEmitter::name(uint32_t id, std::string_view text) {
+  std::vector<uint32_t> operands{id};
+  append_string(operands, text);
+  append(debug, op::Name, operands.data(), operands.size());
+}
+
+void SpirvEmitter::member_name(uint32_t type, uint32_t member,
+                               std::string_view text) {
+  std::vector<uint32_t> operands{type, member};
+  append_string(operands, text);
+  append(debug, op::MemberName, operands.data(), operands.size());
+}
+
+void SpirvEmitter::decorate(uint32_t id,
+                            std::initializer_list<uint32_t> operands) {
+  annotations.push_back(static_cast<uint32_t>(operands.size() + 2) << 16 |
+                        op::Decorate);
+  annotations.push_back(id);
+  annotations.insert(annotations.end(), operands);
+}
+
+void SpirvEmitter::member_decorate(uint32_t type, uint32_t member,
+                                   std::initializer_list<uint32_t> operands) {
+  annotations.push_back(static_cast<uint32_t>(operands.size() + 3) << 16 |
+                        op::MemberDecorate);
+  annotations.push_back(type);
+  annotations.push_back(member);
+  annotations.insert(annotations.end(), operands);
+}
+
+uint32_t SpirvEmitter::variable(uint32_t storage, Symbol type,
+                                std::string_view text) {
+  uint32_t pointer = pointer_type(storage, type_id(type));
+  uint32_t id = next_id++;
+  append(globals, op::Variable, {pointer, id, storage});
+  name(id, text);
+  return id;
+}
+
+void SpirvEmitter::decorate_layout(uint32_t id, const BlockLayout &layout) {
+  if (std::find(laid_out.begin(), laid_out.end(), id) != laid_out.end())
+    return;
+  laid_out.push_back(id);
+  for (uint32_t i = 0; i < layout.members.size(); ++i) {
+    const MemberLayout &member = layout.members[i];
+    member_decorate(id, i, {decoration_offset, member.offset});
+    if (member.matrix_stride) {
+      member_decorate(id, i, {decoration_col_major});
+      member_decorate(id, i, {decoration_matrix_stride, member.matrix_stride});
+    } else if (program->types.count(member.type) &&
+               !is_builtin_type(symbol_text(member.type))) {
+      // Structs keep their declared member order.
+      decorate_layout(type_id(member.type),
+                      layout_block(*program,
+                                   struct_fields(*program, member.type),
+                                   options.layout, false));
+    }
+  }
+}
+
+void SpirvEmitter::error(const Ast &ast, NodeId at, const char *format, ...) {
+  failed = true;
+  va_list args;
+  va_start(args, format);
+  diagnostics.vreport(Severity::Error, program->span_of(ast, at), format,
+                      args);
+  va_end(args);
+}
+
+namespace {
+
+// Logical layout sections, in the order a module must list them.
+enum Section : uint8_t {
+  SectionCapability = 1,
+  SectionExtInstImport,
+  SectionMemoryModel,
+  SectionEntryPoint,
+  SectionExecutionMode,
+  SectionDebug,
+  SectionAnnotation,
+  SectionGlobal,
+  SectionFunction,
+};
+
+constexpr uint8_t to_end = 0xFF;
+
+struct OpcodeInfo {
+  uint16_t opcode;
+  Section section;
+  bool has_type;
+  bool has_result;
+  // Operands [ids_begin, ids_end) after the result type and id are ids.
+  uint8_t ids_begin;
+  uint8_t ids_end;
+};
+
+constexpr OpcodeInfo opcode_table[] = {
+    {op::Name, SectionDebug, false, false, 0, 1},
+    {op::MemberName, SectionDebug, false, false, 0, 1},
+    {op::ExtInstImport, SectionExtInstImport, false, true, 0, 0},
+    // The instruction number is a literal; checked separately.
+    {op::ExtInst, SectionFunction, true, true, 0, 1},
+    {op::MemoryModel, SectionMemoryModel, false, false, 0, 0},
+    {op::EntryPoint, SectionEntryPoint, false, false, 1, 2},
+    {op::ExecutionMode, SectionExecutionMode, false, false, 0, 1},
+    {op::Capability, SectionCapability, false, false, 0, 0},
+    {op::TypeVoid, SectionGlobal, false, true, 0, 0},
+    {op::TypeBool, SectionGlobal, false, true, 0, 0},
+    {op::TypeInt, SectionGlobal, false, true, 0, 0},
+    {op::TypeFloat, SectionGlobal, false, true, 0, 0},
+    {op::TypeVector, SectionGlobal, false, true, 0, 1},
+    {op::TypeMatrix, SectionGlobal, false, true, 0, 1},
+    {op::TypeStruct, SectionGlobal, false, true, 0, to_end},
+    {op::TypePointer, SectionGlobal, false, true, 1, 2},
+    {op::TypeFunction, SectionGlobal, false, true, 0, to_end},
+    {op::ConstantTrue, SectionGlobal, true, true, 0, 0},
+    {op::ConstantFalse, SectionGlobal, true, true, 0, 0},
+    {op::Constant, SectionGlobal, true, true, 0, 0},
+    {op::ConstantComposite, SectionGlobal, true, true, 0, to_end},
+    {op::Function, SectionFunction, true, true, 1, 2},
+    {op::FunctionParameter, SectionFunction, true, true, 0, 0},
+    {op::FunctionEnd, SectionFunction, false, false, 0, 0},
+    {op::FunctionCall, SectionFunction, true, true, 0, to_end},
+    {op::Variable, SectionGlobal, true, true, 1, to_end},
+    {op::Load, SectionFunction, true, true, 0, 1},
+    {op::Store, SectionFunction, false, false, 0, 2},
+    {op::AccessChain, SectionFunction, true, true, 0, to_end},
+    {op::Decorate, SectionAnnotation, false, false, 0, 1},
+    {op::MemberDecorate, SectionAnnotation, false, false, 0, 1},
+    {op::VectorShuffle, SectionFunction, true, true, 0, 2},
+    {op::CompositeConstruct, SectionFunction, true, true, 0, to_end},
+    {op::CompositeExtract, SectionFunction, true, true, 0, 1},
+    {op::Transpose, SectionFunction, true, true, 0, to_end},
+    {op::ConvertFToU, SectionFunction, true, true, 0, to_end},
+    {op::ConvertFToS, SectionFunction, true, true, 0, to_end},
+    {op::ConvertSToF, SectionFunction, true, true, 0, to_end},
+    {op::ConvertUToF, SectionFunction, true, true, 0, to_end},
+    {op::SNegate, SectionFunction, true, true, 0, to_end},
+    {op::FNegate, SectionFunction, true, true, 0, to_end},
+    {op::IAdd, SectionFunction, true, true, 0, to_end},
+    {op::FAdd, SectionFunction, true, true, 0, to_end},
+    {op::ISub, SectionFunction, true, true, 0, to_end},
+    {op::FSub, SectionFunction, true, true, 0, to_end},
+    {op::IMul, SectionFunction, true, true, 0, to_end},
+    {op::FMul, SectionFunction, true, true, 0, to_end},
+    {op::UDiv, SectionFunction, true, true, 0, to_end},
+    {op::SDiv, SectionFunction, true, true, 0, to_end},
+    {op::FDiv, SectionFunction, true, true, 0, to_end},
+    {op::FMod, SectionFunction, true, true, 0, to_end},
+    {op::VectorTimesScalar, SectionFunction, true, true, 0, to_end},
+    {op::MatrixTimesScalar, SectionFunction, true, true, 0, to_end},
+    {op::VectorTimesMatrix, SectionFunction, true, true, 0, to_end},
+    {op::MatrixTimesVector, SectionFunction, true, true, 0, to_end},
+    {op::MatrixTimesMatrix, SectionFunction, true, true, 0, to_end},
+    {op::Dot, SectionFunction, true, true, 0, to_end},
+    {op::LogicalEqual, SectionFunction, true, true, 0, to_end},
+    {op::IEqual, SectionFunction, true, true, 0, to_end},
+    {op::UGreaterThan, SectionFunction, true, true, 0, to_end},
+    {op::SGreaterThan, SectionFunction, true, true, 0, to_end},
+    {op::UGreaterThanEqual, SectionFunction, true, true, 0, to_end},
+    {op::SGreaterThanEqual, SectionFunction, true, true, 0, to_end},
+    {op::ULessThan, SectionFunction, true, true, 0, to_end},
+    {op::SLessThan, SectionFunction, true, true, 0, to_end},
+    {op::ULessThanEqual, SectionFunction, true, true, 0, to_end},
+    {op::SLessThanEqual, SectionFunction, true, true, 0, to_end},
+    {op::FOrdEqual, SectionFunction, true, true, 0, to_end},
+    {op::FOrdLessThan, SectionFunction, true, true, 0, to_end},
+    {op::FOrdGreaterThan, SectionFunction, true, true, 0, to_end},
+    {op::FOrdLessThanEqual, SectionFunction, true, true, 0, to_end},
+    {op::FOrdGreaterThanEqual, SectionFunction, true, true, 0, to_end},
+    {op::Label, SectionFunction, false, true, 0, 0},
+    {op::Return, SectionFunction, false, false, 0, 0},
+    {op::ReturnValue, SectionFunction, false, false, 0, to_end},
+};
+
+const OpcodeInfo *find_opcode(uint16_t opcode) {
+  for (const OpcodeInfo &info : opcode_table) {
+    if (info.opcode == opcode)
+      return &info;
+  }
+  return nullptr;
+}
+
+bool is_type_opcode(uint16_t opcode) {
+  return opcode >= op::TypeVoid && opcode <= op::TypeFunction;
+}
+
+} // namespace
+
+bool validate_spirv(const uint32_t *words, size_t count, std::string &error) {
+  char message[160];
+  auto fail = [&](size_t at, const char *text, int64_t value = -1) {
+    if (value < 0)
+      snprintf(message, sizeof message, "word %zu: %s", at, text);
+    else
+      snprintf(message, sizeof message, "word %zu: %s %lld", at, text,
+               static_cast<long long>(value));
+    error = message;
+    return false;
+  };
+  if (count < 5)
+    return fail(0, "module shorter than its header, words:",
+                static_cast<uint32_t>(count));
+  if (words[0] != spirv_magic)
+    return fail(0, "bad magic number", words[0]);
+  if (words[1] < spirv_version_1_0 || words[1] > 0x00010600 ||
+      (words[1] & 0xFF0000FF))
+    return fail(1, "unknown version", words[1]);
+  uint32_t bound = words[3];
+  if (bound == 0 || words[4] != 0)
+    return fail(3, "bad id bound or schema", bound);
+
+  // Pass 1: instruction framing, result ids, result types, layout order and
+  // function structure.
+  std::vector<uint16_t> defined(bound, 0);
+  enum { Outside, Parameters, InBlock, Terminated } state = Outside;
+  uint8_t section = SectionCapability;
+  size_t memory_models = 0, entry_points = 0, capabilities = 0;
+  for (size_t at = 5; at < count;) {
+    uint32_t length = words[at] >> 16;
+    uint16_t opcode = static_cast<uint16_t>(words[at] & 0xFFFF);
+    if (length == 0 || at + length > count)
+      return fail(at, "bad word count", length);
+    const OpcodeInfo *info = find_opcode(opcode);
+    if (!info)
+      return fail(at, "unknown opcode", opcode);
+    size_t fixed = 1 + info->has_type + info->has_result;
+    if (length < fixed)
+      return fail(at, "too few operands for opcode", opcode);
+
+    bool function_level = info->section == SectionFunction ||
+                          (opcode == op::Variable && state != Outside);
+    if (function_level) {
+      if (opcode == op::Function) {
+        if (state != Outside)
+          return fail(at, "function inside a function");
+        state = Parameters;
+      } else if (state == Outside) {
+        return fail(at, "outside of a function: opcode", opcode);
+      } else if (opcode == op::FunctionParameter) {
+        if (state != Parameters)
+          return fail(at, "parameter after the first block");
+      } else if (opcode == op::Label) {
+        if (state == InBlock)
+          return fail(at, "block without a terminator");
+        state = InBlock;
+      } else if (opcode == op::FunctionEnd) {
+        if (state == InBlock)
+          return fail(at, "block without a terminator");
+        state = Outside;
+      } else if (state != InBlock) {
+        return fail(at, "instruction outside of a block: opcode", opcode);
+      } else if (opcode == op::Return || opcode == op::ReturnValue) {
+        state = Terminated;
+      }
+      section = SectionFunction;
+    } else {
+      if (info->section < section)
+        return fail(at, "out of layout order: opcode", opcode);
+      section = info->section;
+    }
+    memory_models += opcode == op::MemoryModel;
+    entry_points += opcode == op::EntryPoint;
+    capabilities += opcode == op::Capability;
+
+    if (info->has_type) {
+      uint32_t type = words[at + 1];
+      if (type >= bound || !defined[type] || !is_type_opcode(defined[type]))
+        return fail(at, "result type is not a declared type:", type);
+    }
+    if (info->has_result) {
+      uint32_t id = words[at + 1 + info->has_type];
+      if (id == 0 || id >= bound)
+        return fail(at, "result id out of bounds:", id);
+      if (defined[id])
+        return fail(at, "result id defined twice:", id);
+      defined[id] = opcode;
+    }
+    at += length;
+  }
+  if (state != Outside)
+    return fail(count, "module ends inside a function");
+  if (capabilities == 0 || memory_models != 1 || entry_points == 0)
+    return fail(count,
+                "needs a capability, one memory model and an entry point");
+
+  // Pass 2: every id operand names something the module defines. Calls,
+  // names and decorations may refer ahead, so this waits for pass 1.
+  auto check_id = [&](uint32_t id) {
+    return id != 0 && id < bound && defined[id] != 0;
+  };
+  for (size_t at = 5; at < count;) {
+    uint32_t length = words[at] >> 16;
+    uint16_t opcode = static_cast<uint16_t>(words[at] & 0xFFFF);
+    const OpcodeInfo *info = find_opcode(opcode);
+    size_t first = at + 1 + info->has_type + info->has_result;
+    size_t operands = at + length - first;
+    size_t end = info->ids_end == to_end
+                     ? operands
+                     : std::min<size_t>(info->ids_end, operands);
+    for (size_t i = info->ids_begin; i < end; ++i) {
+      if (!check_id(words[first + i]))
+        return fail(at, "undefined id", words[first + i]);
+    }
+    if (opcode == op::ExtInst) {
+      for (size_t i = 2; i < operands; ++i) {
+        if (!check_id(words[first + i]))
+          return fail(at, "undefined id", words[first + i]);
+      }
+    } else if (opcode == op::EntryPoint) {
+      if (operands < 3 || !check_id(words[first + 1]) ||
+          defined[words[first + 1]] != op::Function)
+        return fail(at, "entry point is not a function");
+      // Interface ids follow the name string.
+      size_t i = 2;
+      while (i < operands && (words[first + i] >> 24) != 0)
+        i++;
+      for (++i; i < operands; ++i) {
+        if (!check_id(words[first + i]) ||
+            defined[words[first + i]] != op::Variable)
+          return fail(at, "interface is not a variable:", words[first + i]);
+      }
+    } else if (opcode == op::FunctionCall) {
+      if (operands < 1 || !check_id(words[first]) ||
+          defined[words[first]] != op::Function)
+        return fail(at, "call of something that is not a function");
+    }
+    at += length;
+  }
+  return true;
+}
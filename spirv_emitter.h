@@ -0,0 +1,168 @@
+#pragma once
+#include "ast_node.h"
+#include "diagnostics.h"
+#include "shader_program.h"
+#include "uniform_layout.h"
+#include "varying_layout.h"
+#include "vertex_layout.h"
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SpirvOptions {
+  // Leave out functions the stage does not call.
+  bool strip_unused = false;
+  LayoutRules layout = LayoutRules::Std140;
+  // Order the uniform block's members to waste the least padding.
+  bool reorder_uniforms = false;
+};
+
+// One emitted module; its words are out[begin, end).
+struct SpirvShader {
+  Symbol stage = NoSymbol;
+  size_t begin = 0;
+  size_t end = 0;
+};
+
+// Writes a SPIR-V 1.0 module for every `@main` entry point of a program,
+// straight into a word buffer, with no GLSL in between. Types and
+// constants are declared once per module. Let bindings are SSA values and
+// functions take their parameters by value, so every function is a single
+// block. Uniforms share one block at set 0, binding 0: a uniform block
+// under std140, a read-only storage buffer under std430. Vertex inputs get
+// locations in declaration order and varyings those link_varyings() gives
+// them.
+class SpirvEmitter {
+public:
+  SpirvEmitter(std::vector<uint32_t> &out, Diagnostics &diagnostics,
+               SpirvOptions options = {});
+
+  // `stages` are what ShaderProgram::analyze() gave for a program without
+  // errors, and `varyings` what link_varyings() made of it.
+  std::vector<SpirvShader> emit(ShaderProgram &program,
+                                const std::vector<StageInfo> &stages,
+                                const VaryingLayout &varyings);
+
+private:
+  struct Value {
+    uint32_t id = 0;
+    Symbol type = NoSymbol;
+    bool constant = false;
+  };
+  struct Local {
+    Symbol name = NoSymbol;
+    Value value;
+  };
+  struct Interface {
+    Symbol name = NoSymbol;
+    Symbol type = NoSymbol;
+    uint32_t variable = 0;
+  };
+  struct WordsHash {
+    size_t operator()(const std::vector<uint32_t> &words) const;
+  };
+
+  void reset();
+  bool emit_stage(const StageInfo &info);
+  void declare_interface(const StageInfo &info);
+  void declare_uniforms();
+  void emit_function(uint32_t overload);
+  void emit_entry(const StageInfo &info);
+  // Stores the vertex stage's packed varying into its slot outputs, or
+  // loads the fragment stage's back out of its slot inputs.
+  void store_packed(const VaryingSlots &slots, const Value &varying);
+  Value load_packed(const VaryingSlots &slots);
+
+  Value value(const Ast &ast, NodeId id);
+  Value identifier(const Ast &ast, NodeId id);
+  Value binary(const Ast &ast, NodeId id);
+  Value call(const Ast &ast, NodeId id);
+  Value builtin_call(const Ast &ast, NodeId at, const BuiltinFunction &builtin,
+                     Value *args, size_t count);
+  Value construct(const Ast &ast, NodeId at, Symbol type, const Value *args,
+                  size_t count);
+  Value member(const Ast &ast, NodeId base, Symbol field, NodeId at);
+  Value splat(const Value &scalar, Symbol vector_type);
+  // Unit vec3 of an octahedral-encoded vec2.
+  Value decode_octahedral(const Value &encoded);
+
+  uint32_t type_id(Symbol type);
+  uint32_t pointer_type(uint32_t storage, uint32_t type);
+  uint32_t function_type(const std::vector<uint32_t> &types);
+  uint32_t constant_float(float value);
+  uint32_t constant_int(int32_t value);
+  // Declares a type (`type` 0) or constant once per module.
+  uint32_t unique(uint16_t opcode, uint32_t type, const uint32_t *operands,
+                  size_t count);
+  uint32_t unique(uint16_t opcode, uint32_t type,
+                  std::initializer_list<uint32_t> operands) {
+    return unique(opcode, type, operands.begin(), operands.size());
+  }
+  // Appends an instruction with a fresh result id to the current function.
+  uint32_t instruction(uint16_t opcode, uint32_t type,
+                       const uint32_t *operands, size_t count);
+  uint32_t instruction(uint16_t opcode, uint32_t type,
+                       std::initializer_list<uint32_t> operands) {
+    return instruction(opcode, type, operands.begin(), operands.size());
+  }
+  void name(uint32_t id, std::string_view text);
+  void member_name(uint32_t type, uint32_t member, std::string_view text);
+  void decorate(uint32_t id, std::initializer_list<uint32_t> operands);
+  void member_decorate(uint32_t type, uint32_t member,
+                       std::initializer_list<uint32_t> operands);
+  uint32_t variable(uint32_t storage, Symbol type, std::string_view text);
+  // Decorates the members of struct `id` (and of structs inside it) with
+  // the offsets of `layout`.
+  void decorate_layout(uint32_t id, const BlockLayout &layout);
+
+#if defined(__GNUC__) || defined(__clang__)
+  __attribute__((format(printf, 4, 5)))
+#endif
+  void error(const Ast &ast, NodeId at, const char *format, ...);
+
+  std::vector<uint32_t> &out;
+  Diagnostics &diagnostics;
+  SpirvOptions options;
+  ShaderProgram *program = nullptr;
+  bool failed = false;
+
+  // Sections of the module being written, in module order.
+  std::vector<uint32_t> entry_points;
+  std::vector<uint32_t> debug;
+  std::vector<uint32_t> annotations;
+  std::vector<uint32_t> globals;
+  std::vector<uint32_t> code;
+  uint32_t next_id = 1;
+  uint32_t glsl_std_450 = 0;
+
+  std::unordered_map<std::vector<uint32_t>, uint32_t, WordsHash> declared;
+  std::unordered_map<Symbol, uint32_t> type_ids;
+  std::vector<uint32_t> laid_out;
+  // Result id of every overload the program emits, 0 for the others.
+  std::vector<uint32_t> function_ids;
+
+  VaryingLayout varyings;
+  VertexLayout attributes;
+  // Packed slots are named by packed_name().
+  std::vector<Interface> inputs;
+  std::vector<Interface> outputs;
+  uint32_t uniform_block = 0;
+  // Members of the uniform block, in the order they are declared in it.
+  BlockLayout uniform_layout;
+
+  Symbol stage = NoSymbol;
+  std::vector<Local> locals;
+  // Uniform, input and constant values already loaded in this function.
+  std::vector<Local> loaded;
+  // The vertex stage's `clip_position` binding and its value.
+  NodeId position_binding = NoNode;
+  Value position;
+};
+
+// Structural check of a SPIR-V module: header, instruction word counts,
+// result ids unique and below the bound, result types and id operands
+// defined, logical layout section order, and functions made of blocks
+// that each end in a return. Returns false with a message in `error`.
+bool validate_spirv(const uint32_t *words, size_t count, std::string &error);
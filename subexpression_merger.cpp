@@ -0,0 +1,257 @@
+#include "subexpression_merger.h"
+#include "hash.h"
+#include "keywords.h"
+#include <algorithm>
+#include <string>
+
+SubexpressionMerger::SubexpressionMerger(Ast &ast,
+                                         const ShaderProgram &program)
+    : ast(ast), program(program) {}
+
+size_t SubexpressionMerger::run() {
+  for (NodeId id = 0; id < ast.size(); ++id)
+    names.insert(ast[id].value);
+  for (const Overload &overload : program.overloads)
+    names.insert((*overload.function.ast)[overload.function.id].value);
+  for (const AstRef &constant : program.constants)
+    names.insert((*constant.ast)[constant.id].value);
+
+  // Overloads of one FunctionDef share its body.
+  std::vector<NodeId> merged;
+  for (uint32_t i = 0; i < program.overloads.size(); ++i) {
+    const AstRef &function = program.overloads[i].function;
+    if (function.ast != &ast || !program.is_emitted(i) ||
+        std::find(merged.begin(), merged.end(), function.id) != merged.end())
+      continue;
+    merged.push_back(function.id);
+    NodeRange range = ast.children(function.id);
+    std::vector<NodeId> children(range.begin(), range.end());
+    NodeId body = merge(children.back());
+    if (body != children.back()) {
+      children.back() = body;
+      ast.set_children(function.id, children.data(), children.size());
+    }
+  }
+
+  for (const AstRef &entry : program.entries) {
+    NodeId body = ast.child(entry.id, 0);
+    NodeId merged_body = merge(body);
+    if (merged_body != body)
+      ast.set_children(entry.id, &merged_body, 1);
+  }
+  return added;
+}
+
+NodeId SubexpressionMerger::merge(NodeId body) {
+  bool is_let = ast[body].type == NodeType::LetInExpr;
+  std::vector<NodeId> slots;
+  if (is_let) {
+    NodeRange range = ast.children(body);
+    slots.assign(range.begin(), range.end());
+  } else {
+    slots.push_back(body);
+  }
+
+  inner.clear();
+  for (NodeId slot : slots)
+    collect_inner(slot, true);
+  size_t count = slots.size();
+  while (merge_largest(slots))
+    added++;
+
+  NodeId result = body;
+  if (slots.size() != count) {
+    if (!is_let) {
+      ast.set_location(ast.offset_of(body));
+      result = ast.add(NodeType::LetInExpr);
+    }
+    ast.set_children(result, slots.data(), slots.size());
+    ast[result].value = ast[slots[0]].value;
+  }
+
+  std::vector<NodeId> lets;
+  for (NodeId slot : slots)
+    nested_lets(slot, lets);
+  for (NodeId let : lets)
+    merge(let);
+  return result;
+}
+
+bool SubexpressionMerger::merge_largest(std::vector<NodeId> &slots) {
+  std::vector<Occurrence> occurrences;
+  for (uint32_t i = 0; i < slots.size(); ++i) {
+    NodeType type = ast[slots[i]].type;
+    if (type == NodeType::LetBinding)
+      number(ast.child(slots[i], 0), false, i, occurrences);
+    else if (type != NodeType::Input)
+      number(slots[i], false, i, occurrences);
+  }
+  std::stable_sort(occurrences.begin(), occurrences.end(),
+                   [](const Occurrence &a, const Occurrence &b) {
+                     if (a.size != b.size)
+                       return a.size > b.size;
+                     return a.hash < b.hash;
+                   });
+
+  std::vector<Occurrence> group;
+  for (size_t run = 0; run < occurrences.size() && group.size() < 2;) {
+    size_t end = run;
+    while (end < occurrences.size() &&
+           occurrences[end].size == occurrences[run].size &&
+           occurrences[end].hash == occurrences[run].hash)
+      ++end;
+    // Equal hashes are only candidates; compare the trees to be sure.
+    std::vector<bool> taken(end - run, false);
+    for (size_t first = run; first < end && group.size() < 2; ++first) {
+      if (taken[first - run])
+        continue;
+      group.assign(1, occurrences[first]);
+      for (size_t other = first + 1; other < end; ++other) {
+        if (!taken[other - run] &&
+            same(occurrences[first].id, occurrences[other].id)) {
+          taken[other - run] = true;
+          group.push_back(occurrences[other]);
+        }
+      }
+    }
+    run = end;
+  }
+  if (group.size() < 2)
+    return false;
+
+  uint32_t slot = group[0].slot;
+  for (const Occurrence &occurrence : group)
+    slot = std::min(slot, occurrence.slot);
+
+  // A binding whose whole value repeats is reused rather than copied.
+  NodeId binding = NoNode;
+  NodeId kept = NoNode;
+  if (ast[slots[slot]].type == NodeType::LetBinding) {
+    for (const Occurrence &occurrence : group) {
+      if (ast.child(slots[slot], 0) == occurrence.id) {
+        binding = slots[slot];
+        kept = occurrence.id;
+      }
+    }
+  }
+  ASTNode value = ast[group[0].id];
+  if (binding == NoNode) {
+    ast.set_location(ast.offset_of(group[0].id));
+    NodeId moved = ast.add(value.type);
+    ast[moved] = value;
+    binding = ast.add(NodeType::LetBinding, fresh_name(), {moved});
+    slots.insert(slots.begin() + slot, binding);
+  }
+
+  ASTNode use = value;
+  use.type = NodeType::Identifier;
+  use.internal = false;
+  use.value = ast[binding].value;
+  use.child_count = 0;
+  for (const Occurrence &occurrence : group) {
+    if (occurrence.id != kept)
+      ast[occurrence.id] = use;
+  }
+  return true;
+}
+
+SubexpressionMerger::Value
+SubexpressionMerger::number(NodeId id, bool partial, uint32_t slot,
+                            std::vector<Occurrence> &occurrences) {
+  ASTNode node = ast[id];
+  Value value;
+  value.hash = hash_combine(static_cast<uint64_t>(node.type), node.value);
+  value.size = 1;
+
+  switch (node.type) {
+  case NodeType::Identifier:
+    value.movable = !inner.count(node.value);
+    return value;
+  case NodeType::NumberLiteral:
+    value.movable = true;
+    return value;
+  case NodeType::BinOp:
+  case NodeType::UnaryOp:
+  case NodeType::FieldAccess:
+  case NodeType::FunctionApplication:
+    break;
+  default:
+    // Lets and inputs stay where they are, but may contain repeats.
+    for (uint32_t i = 0; i < node.child_count; ++i)
+      number(ast.child(id, i), false, slot, occurrences);
+    return value;
+  }
+
+  bool member = node.type == NodeType::BinOp &&
+                symbol_text(node.value) == "Dot";
+  bool call = node.type == NodeType::FunctionApplication;
+  value.movable = true;
+  value.work = node.type == NodeType::BinOp && !member;
+  for (uint32_t i = 0; i < node.child_count; ++i) {
+    NodeId child = ast.child(id, i);
+    if (is_name_operand(ast, id, i)) {
+      value.hash = hash_combine(value.hash, ast[child].value);
+      value.size++;
+      continue;
+    }
+    Value inner_value =
+        number(child, call && i == 0, slot, occurrences);
+    value.hash = hash_combine(value.hash, inner_value.hash);
+    value.size += inner_value.size;
+    value.movable &= inner_value.movable;
+    value.work |= inner_value.work;
+  }
+
+  // A call does work unless it only builds a vector from its arguments.
+  if (call && !partial) {
+    NodeId head = id;
+    while (ast[head].type == NodeType::FunctionApplication)
+      head = ast.child(head, 0);
+    if (ast[head].type != NodeType::Identifier ||
+        !is_builtin_type(symbol_text(ast[head].value)))
+      value.work = true;
+  }
+  if (value.movable && value.work && !partial)
+    occurrences.push_back({id, value.hash, value.size, slot});
+  return value;
+}
+
+bool SubexpressionMerger::same(NodeId a, NodeId b) const {
+  const ASTNode &x = ast[a];
+  const ASTNode &y = ast[b];
+  if (x.type != y.type || x.value != y.value ||
+      x.child_count != y.child_count)
+    return false;
+  for (uint32_t i = 0; i < x.child_count; ++i) {
+    if (!same(ast.child(a, i), ast.child(b, i)))
+      return false;
+  }
+  return true;
+}
+
+void SubexpressionMerger::collect_inner(NodeId id, bool top) {
+  if (!top && ast[id].type == NodeType::LetBinding)
+    inner.insert(ast[id].value);
+  for (uint32_t i = 0; i < ast[id].child_count; ++i)
+    collect_inner(ast.child(id, i), false);
+}
+
+void SubexpressionMerger::nested_lets(NodeId id,
+                                      std::vector<NodeId> &lets) const {
+  for (uint32_t i = 0; i < ast[id].child_count; ++i) {
+    NodeId child = ast.child(id, i);
+    if (ast[child].type == NodeType::LetInExpr)
+      lets.push_back(child);
+    else
+      nested_lets(child, lets);
+  }
+}
+
+Symbol SubexpressionMerger::fresh_name() {
+  Symbol fresh;
+  do
+    fresh = intern("cse_" + std::to_string(++next_name));
+  while (names.count(fresh));
+  names.insert(fresh);
+  return fresh;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "ast_node.h"
+#include "shader_program.h"
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+// Computes repeated expressions of the main file's entry points and
+// functions once: structurally identical calls and arithmetic inside one
+// body become a single let binding that every copy then names, or name an
+// existing binding whose whole value is the expression. Expressions
+// are hashed bottom-up so each body is compared in one walk per merge, and
+// the largest repeated expression is merged first, so `max (dot n l) 0.0`
+// used twice does not also leave `dot n l` behind as a binding of its own.
+// Every expression of the language is pure, so this never changes results.
+class SubexpressionMerger {
+public:
+  // `program` must have type-checked `ast`, including its entry points.
+  SubexpressionMerger(Ast &ast, const ShaderProgram &program);
+
+  // Returns the number of repeated expressions merged.
+  size_t run();
+
+private:
+  struct Value {
+    uint64_t hash = 0;
+    uint32_t size = 0;
+    // Can be bound to a let where the body's own bindings are in scope.
+    bool movable = false;
+    // Costs something to compute, unlike a name or a constructor of names.
+    bool work = false;
+  };
+  struct Occurrence {
+    NodeId id;
+    uint64_t hash;
+    uint32_t size;
+    // Index of the body's top-level child it is in.
+    uint32_t slot;
+  };
+
+  // Merges repeats in `body` and then in the let expressions nested in it.
+  // Returns the body to use in its place, which differs from `body` if it
+  // was not a let expression and has become one.
+  NodeId merge(NodeId body);
+  bool merge_largest(std::vector<NodeId> &slots);
+  Value number(NodeId id, bool partial, uint32_t slot,
+               std::vector<Occurrence> &occurrences);
+  bool same(NodeId a, NodeId b) const;
+  void collect_inner(NodeId id, bool top);
+  void nested_lets(NodeId id, std::vector<NodeId> &lets) const;
+  Symbol fresh_name();
+
+  Ast &ast;
+  const ShaderProgram &program;
+  size_t added = 0;
+
+  // Names bound by lets nested below the body being merged; expressions
+  // that use them cannot move up to the body's bindings.
+  std::unordered_set<Symbol> inner;
+  // Every name in the program, so fresh names cannot collide.
+  std::unordered_set<Symbol> names;
+  uint32_t next_name = 0;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+// Growable output buffer for generated code. One buffer is meant to be
+// reserved up front and reused for every shader a worker emits, so
+// emission appends into memory that is already there instead of building
+// and concatenating strings.
+class TextBuffer {
+public:
+  explicit TextBuffer(size_t capacity = 64 * 1024) { reserve(capacity); }
+  TextBuffer(const TextBuffer &) = delete;
+  TextBuffer &operator=(const TextBuffer &) = delete;
+
+  void reserve(size_t capacity) {
+    if (capacity <= allocated)
+      return;
+    std::unique_ptr<char[]> grown(new char[capacity]);
+    if (length)
+      std::memcpy(grown.get(), bytes.get(), length);
+    bytes = std::move(grown);
+    allocated = capacity;
+  }
+
+  TextBuffer &operator<<(std::string_view text) {
+    char *out = extend(text.size());
+    if (!text.empty())
+      std::memcpy(out, text.data(), text.size());
+    return *this;
+  }
+  TextBuffer &operator<<(char c) {
+    *extend(1) = c;
+    return *this;
+  }
+  TextBuffer &operator<<(uint32_t value) {
+    char digits[10];
+    size_t count = 0;
+    do {
+      digits[count++] = static_cast<char>('0' + value % 10);
+      value /= 10;
+    } while (value);
+    char *out = extend(count);
+    while (count)
+      *out++ = digits[--count];
+    return *this;
+  }
+  void indent(int depth) {
+    char *out = extend(depth * 4);
+    std::memset(out, ' ', depth * 4);
+  }
+
+  // Views stay valid until the next append or clear().
+  std::string_view view(size_t begin, size_t end) const {
+    return std::string_view(bytes.get() + begin, end - begin);
+  }
+  std::string_view view() const { return view(0, length); }
+  size_t size() const { return length; }
+  // Drops everything after the first `size` bytes.
+  void truncate(size_t size) { length = std::min(length, size); }
+  void clear() { length = 0; }
+
+private:
+  char *extend(size_t count) {
+    if (length + count > allocated)
+      reserve(std::max(allocated * 2, length + count));
+    char *out = bytes.get() + length;
+    length += count;
+    return out;
+  }
+
+  std::unique_ptr<char[]> bytes;
+  size_t length = 0;
+  size_t allocated = 0;
+};
@@ -0,0 +1,92 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(size_t threads) {
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+  if (threads == 0)
+    threads = 1;
+  workers.reserve(threads);
+  for (size_t i = 0; i < threads; ++i)
+    workers.push_back(std::make_unique<Worker>());
+  for (size_t i = 0; i < threads; ++i)
+    workers[i]->thread = std::thread([this, i] { run(i); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &worker : workers)
+    worker->thread.join();
+}
+
+void ThreadPool::parallel_for(size_t count,
+                              const std::function<void(size_t, size_t)> &body) {
+  if (count == 0)
+    return;
+  job = &body;
+  remaining.store(count, std::memory_order_relaxed);
+
+  // Deal out contiguous blocks, so neighbouring inputs (often of similar
+  // size) start on the same worker and stealing only evens out the tail.
+  size_t per_worker = (count + workers.size() - 1) / workers.size();
+  for (size_t w = 0; w < workers.size(); ++w) {
+    std::lock_guard<std::mutex> guard(workers[w]->mutex);
+    for (size_t i = w * per_worker; i < count && i < (w + 1) * per_worker; ++i)
+      workers[w]->tasks.push_back(i);
+  }
+
+  std::unique_lock<std::mutex> guard(mutex);
+  generation++;
+  wake.notify_all();
+  done.wait(guard, [this] {
+    return remaining.load(std::memory_order_acquire) == 0;
+  });
+  job = nullptr;
+}
+
+bool ThreadPool::next_task(size_t worker, size_t &index) {
+  {
+    Worker &own = *workers[worker];
+    std::lock_guard<std::mutex> guard(own.mutex);
+    if (!own.tasks.empty()) {
+      index = own.tasks.back();
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+  for (size_t i = 1; i < workers.size(); ++i) {
+    Worker &victim = *workers[(worker + i) % workers.size()];
+    std::lock_guard<std::mutex> guard(victim.mutex);
+    if (!victim.tasks.empty()) {
+      index = victim.tasks.front();
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run(size_t worker) {
+  uint64_t seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> guard(mutex);
+      wake.wait(guard, [&] { return stopping || generation != seen; });
+      if (stopping)
+        return;
+      seen = generation;
+    }
+
+    size_t index;
+    while (next_task(worker, index)) {
+      (*job)(index, worker);
+      if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> guard(mutex);
+        done.notify_all();
+      }
+    }
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run index-based jobs. Each worker has its
+// own task deque: it takes work from the back of its own deque and, when
+// that runs dry, steals from the front of the others, so uneven task sizes
+// (one huge shader among many small ones) still keep every core busy.
+class ThreadPool {
+public:
+  // `threads` == 0 uses one worker per hardware thread.
+  explicit ThreadPool(size_t threads = 0);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t size() const { return workers.size(); }
+
+  // Calls body(index, worker) for every index in [0, count) and returns
+  // once all calls have finished. `worker` is in [0, size()) and identifies
+  // the thread, so callers can keep per-worker state without locking.
+  // Not reentrant: body must not call parallel_for on the same pool.
+  void parallel_for(size_t count,
+                    const std::function<void(size_t, size_t)> &body);
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<size_t> tasks;
+    std::thread thread;
+  };
+
+  void run(size_t worker);
+  bool next_task(size_t worker, size_t &index);
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  const std::function<void(size_t, size_t)> *job = nullptr;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  uint64_t generation = 0;
+  bool stopping = false;
+  std::atomic<size_t> remaining{0};
+};
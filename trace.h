@@ -0,0 +1,43 @@
+#pragma once
+#include <cstdarg>
+#include <cstdio>
+
+// Levelled tracing for the lexer and parser. HGL_TRACE_LEVEL selects the
+// most verbose level compiled in; every TRACE_* call above it expands to
+// nothing, so disabled traces cost nothing and their arguments are never
+// evaluated.
+#define HGL_TRACE_OFF 0
+#define HGL_TRACE_ERROR 1
+#define HGL_TRACE_INFO 2
+#define HGL_TRACE_DEBUG 3
+
+#ifndef HGL_TRACE_LEVEL
+#define HGL_TRACE_LEVEL HGL_TRACE_OFF
+#endif
+
+inline void trace_print(const char *level, const char *format, ...) {
+  fprintf(stderr, "[%s] ", level);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+#if HGL_TRACE_LEVEL >= HGL_TRACE_ERROR
+#define TRACE_ERROR(...) trace_print("error", __VA_ARGS__)
+#else
+#define TRACE_ERROR(...) ((void)0)
+#endif
+
+#if HGL_TRACE_LEVEL >= HGL_TRACE_INFO
+#define TRACE_INFO(...) trace_print("info", __VA_ARGS__)
+#else
+#define TRACE_INFO(...) ((void)0)
+#endif
+
+#if HGL_TRACE_LEVEL >= HGL_TRACE_DEBUG
+#define TRACE_DEBUG(...) trace_print("debug", __VA_ARGS__)
+#else
+#define TRACE_DEBUG(...) ((void)0)
+#endif
@@ -0,0 +1,799 @@
+#include "type_checker.h"
+#include "keywords.h"
+#include "shader_program.h"
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+
+namespace {
+
+constexpr size_t max_arguments = 16;
+
+bool has_operator(std::string_view name) {
+  return name == "Plus" || name == "Minus" || name == "Multiply" ||
+         name == "Divide" || is_comparison(name);
+}
+
+// Components a value of `type` has: 1 for scalars, N for vecN, N * N for
+// matN, 0 for anything else.
+uint32_t component_count(std::string_view type) {
+  uint32_t columns = matrix_size(type);
+  return columns ? columns * columns : shape_of(type).width;
+}
+
+// "(genType, float) or (genType, genType)" for a builtin's forms.
+std::string describe_forms(std::string_view signatures) {
+  std::string out;
+  while (!signatures.empty()) {
+    size_t end = std::min(signatures.find(' '), signatures.size());
+    std::string_view form = signatures.substr(0, end);
+    signatures.remove_prefix(std::min(end + 1, signatures.size()));
+    out += out.empty() ? "(" : " or (";
+    for (size_t i = 0; i + 1 < form.size(); ++i) {
+      out += i ? ", " : "";
+      switch (form[i]) {
+      case 'T':
+      case 'N':
+        out += "genType";
+        break;
+      case 'c':
+        out += "scalar";
+        break;
+      case 'f':
+        out += "float";
+        break;
+      case '3':
+        out += "vec3";
+        break;
+      case '4':
+        out += "vec4";
+        break;
+      case 'M':
+        out += "matrix";
+        break;
+      case 'S':
+        out += "sampler";
+        break;
+      default:
+        out += "any";
+        break;
+      }
+    }
+    out += ')';
+  }
+  return out;
+}
+
+} // namespace
+
+TypeChecker::TypeChecker(ShaderProgram &program) : program(program) {}
+
+void TypeChecker::check_constants() {
+  // Constants may use the ones before them, and are visible everywhere.
+  emitting = true;
+  for (const AstRef &constant : program.constants) {
+    const Ast &ast = *constant.ast;
+    recording = true;
+    TypeTerm term = infer(ast, ast.child(constant.id, 0));
+    flush(0, true);
+    recording = false;
+    Symbol type = term == NoTerm ? NoSymbol : resolve(term);
+    program.globals.push_back({ast[constant.id].value, type});
+  }
+  emitting = false;
+}
+
+void TypeChecker::check_overloads() {
+  schemes.resize(program.overloads.size());
+  // Every scheme is inferred before any body is checked, so checking never
+  // has to infer one in the middle of trying overloads.
+  for (uint32_t i = 0; i < program.overloads.size(); ++i) {
+    recording = true;
+    scheme_of(i);
+    flush(0, true);
+    recording = false;
+  }
+  for (uint32_t i = 0; i < program.overloads.size(); ++i) {
+    const Overload &overload = program.overloads[i];
+    if (overload.signature == NoNode)
+      continue;
+    bool first = i == 0 ||
+                 program.overloads[i - 1].function.id != overload.function.id ||
+                 program.overloads[i - 1].function.ast != overload.function.ast;
+    check_overload(i, first);
+  }
+}
+
+Symbol TypeChecker::check_stage(const Ast &ast, NodeId body) {
+  recording = true;
+  emitting = true;
+  bind_lets(ast, body);
+  TypeTerm term = infer(ast, body);
+  flush(0, true);
+  recording = false;
+  emitting = false;
+  scope.clear();
+  return term == NoTerm ? NoSymbol : resolve(term);
+}
+
+Symbol TypeChecker::infer_quietly(const Ast &ast, NodeId id) {
+  Checkpoint start = checkpoint();
+  quiet = true;
+  TypeTerm term = infer(ast, id);
+  Symbol type = term == NoTerm ? NoSymbol : resolve(term);
+  quiet = false;
+  rollback(start);
+  return type;
+}
+
+void TypeChecker::check_overload(uint32_t index, bool first) {
+  const Overload &overload = program.overloads[index];
+  const Ast &ast = *overload.function.ast;
+  NodeRange children = ast.children(overload.function.id);
+  NodeId params = children[children.size() - 2];
+  NodeId body = children[children.size() - 1];
+  std::string_view name = symbol_text(ast[overload.function.id].value);
+  const Scheme &scheme = schemes[index];
+
+  // Type variables stay rigid inside the body: they only equal themselves.
+  scope.clear();
+  for (uint32_t i = 0; i < ast[params].child_count; ++i)
+    scope.push_back({ast[ast.child(params, i)].value, scheme.terms[i]});
+  recording = true;
+  emitting = is_monomorphic(index);
+  bind_lets(ast, body);
+  TypeTerm term = infer(ast, body);
+  TypeTerm expected = scheme.terms.back();
+  if (term != NoTerm && !unify(term, expected))
+    error(ast, body, "'%.*s' returns '%s' but its signature says '%s'",
+          static_cast<int>(name.size()), name.data(),
+          symbol_text(resolve(term)).data(),
+          symbol_text(resolve(expected)).data());
+  flush(0, first);
+  recording = false;
+  emitting = false;
+  scope.clear();
+}
+
+const TypeChecker::Scheme &TypeChecker::scheme_of(uint32_t index) {
+  Scheme &scheme = schemes[index];
+  if (scheme.state != SchemeState::Pending)
+    return scheme;
+  const Overload &overload = program.overloads[index];
+  const Ast &ast = *overload.function.ast;
+  if (overload.signature != NoNode) {
+    for (NodeId type : ast.children(overload.signature))
+      scheme.terms.push_back(named(ast[type].value));
+    scheme.state = SchemeState::Done;
+    return scheme;
+  }
+
+  // A function without a signature: one variable per parameter and one for
+  // the result, bound by inferring the body. Calls to itself use the same
+  // variables, so recursion is monomorphic.
+  NodeRange children = ast.children(overload.function.id);
+  NodeId params = children[children.size() - 2];
+  NodeId body = children[children.size() - 1];
+  scheme.state = SchemeState::InProgress;
+  for (uint32_t i = 0; i <= ast[params].child_count; ++i)
+    scheme.terms.push_back(fresh());
+
+  std::vector<std::pair<Symbol, TypeTerm>> outer;
+  outer.swap(scope);
+  Symbol stage = program.stage;
+  bool was_emitting = emitting;
+  program.stage = NoSymbol;
+  emitting = false;
+  for (uint32_t i = 0; i < ast[params].child_count; ++i)
+    scope.push_back({ast[ast.child(params, i)].value, scheme.terms[i]});
+  bind_lets(ast, body);
+  TypeTerm term = infer(ast, body);
+  if (term != NoTerm)
+    unify(term, scheme.terms.back());
+  scope.swap(outer);
+  program.stage = stage;
+  emitting = was_emitting;
+
+  // `schemes` does not grow while inferring, so `scheme` is still valid.
+  scheme.state = SchemeState::Done;
+  return scheme;
+}
+
+void TypeChecker::instantiate(const Scheme &scheme,
+                              std::vector<TypeTerm> &into) {
+  into.clear();
+  if (scheme.state == SchemeState::InProgress) {
+    into = scheme.terms;
+    return;
+  }
+  std::vector<std::pair<TypeTerm, TypeTerm>> renamed;
+  for (TypeTerm term : scheme.terms) {
+    TypeTerm root = find(term);
+    Symbol name = terms[root].name;
+    if (name != NoSymbol && !is_type_variable(name)) {
+      into.push_back(root);
+      continue;
+    }
+    TypeTerm copy = NoTerm;
+    for (const auto &pair : renamed) {
+      if (pair.first == root)
+        copy = pair.second;
+    }
+    if (copy == NoTerm) {
+      copy = fresh();
+      renamed.push_back({root, copy});
+    }
+    into.push_back(copy);
+  }
+}
+
+bool TypeChecker::is_type_variable(Symbol name) const {
+  std::string_view text = symbol_text(name);
+  return !text.empty() && std::islower(static_cast<unsigned char>(text[0])) &&
+         !is_builtin_type(text) && !program.types.count(name);
+}
+
+bool TypeChecker::is_monomorphic(uint32_t overload) const {
+  if (overload >= schemes.size() ||
+      schemes[overload].state != SchemeState::Done)
+    return false;
+  for (TypeTerm term : schemes[overload].terms) {
+    Symbol name = resolve(term);
+    if (name == NoSymbol || is_type_variable(name))
+      return false;
+  }
+  return true;
+}
+
+std::string TypeChecker::describe_overload(uint32_t overload) const {
+  std::string text;
+  std::vector<TypeTerm> variables;
+  for (TypeTerm term : schemes[overload].terms) {
+    if (!text.empty())
+      text += " -> ";
+    TypeTerm root = find(term);
+    if (terms[root].name != NoSymbol) {
+      text += symbol_text(terms[root].name);
+      continue;
+    }
+    size_t index = 0;
+    while (index < variables.size() && variables[index] != root)
+      index++;
+    if (index == variables.size())
+      variables.push_back(root);
+    text += static_cast<char>('a' + index % 26);
+  }
+  return text;
+}
+
+void TypeChecker::bind_lets(const Ast &ast, NodeId id) {
+  if (ast[id].type != NodeType::LetInExpr) {
+    for (NodeId child : ast.children(id))
+      bind_lets(ast, child);
+    return;
+  }
+  for (NodeId child : ast.children(id)) {
+    if (ast[child].type != NodeType::LetBinding) {
+      bind_lets(ast, child);
+      continue;
+    }
+    NodeId value = ast.child(child, 0);
+    bind_lets(ast, value);
+    TypeTerm term = infer(ast, value);
+    record(ast, child, term);
+    // A binding whose value failed was already reported.
+    scope.push_back({ast[child].value, term == NoTerm ? fresh() : term});
+  }
+}
+
+TypeTerm TypeChecker::lookup(Symbol name) {
+  for (auto it = scope.rbegin(); it != scope.rend(); ++it) {
+    if (it->first == name)
+      return it->second;
+  }
+  const ShaderVariable *variable = program.lookup(name);
+  if (!variable)
+    return NoTerm;
+  // A variable whose own type failed was already reported.
+  return variable->type == NoSymbol ? fresh() : named(variable->type);
+}
+
+TypeTerm TypeChecker::infer(const Ast &ast, NodeId id) {
+  const ASTNode &node = ast[id];
+  TypeTerm term = NoTerm;
+  switch (node.type) {
+  case NodeType::NumberLiteral:
+    term = named(program.float_type);
+    break;
+  case NodeType::Identifier:
+    term = lookup(node.value);
+    if (term == NoTerm)
+      error(ast, id, "unknown identifier '%s'",
+            symbol_text(node.value).data());
+    break;
+  case NodeType::UnaryOp:
+    term = infer(ast, ast.child(id, 0));
+    break;
+  case NodeType::FieldAccess:
+    term = infer_member(ast, ast.child(id, 0), node.value, id);
+    break;
+  case NodeType::BinOp:
+    term = infer_binary(ast, id);
+    break;
+  case NodeType::FunctionApplication:
+    // Records the call itself.
+    return infer_call(ast, id);
+  case NodeType::LetInExpr:
+  case NodeType::Input:
+    term = infer(ast, program.result_of(ast, id));
+    break;
+  default:
+    error(ast, id, "cannot generate shader code for this expression");
+    break;
+  }
+  record(ast, id, term);
+  return term;
+}
+
+TypeTerm TypeChecker::infer_binary(const Ast &ast, NodeId id) {
+  std::string_view name = symbol_text(ast[id].value);
+  NodeId lhs = ast.child(id, 0);
+  NodeId rhs = ast.child(id, 1);
+  if (name == "Dot")
+    return infer_member(ast, lhs, ast[rhs].value, rhs);
+  TypeTerm left = infer(ast, lhs);
+  TypeTerm right = infer(ast, rhs);
+  if (left == NoTerm || right == NoTerm)
+    return NoTerm;
+  if (!has_operator(name)) {
+    error(ast, id, "operator '%.*s' has no shader equivalent",
+          static_cast<int>(name.size()), name.data());
+    return NoTerm;
+  }
+
+  // Operands of an unknown type are taken to have the same type; mixing
+  // scalars, vectors and matrices needs both sides known.
+  Symbol l = resolve(left), r = resolve(right);
+  if (l == NoSymbol || r == NoSymbol) {
+    unify(left, right);
+    return is_comparison(name) ? named(program.bool_type) : left;
+  }
+  std::string_view lt = symbol_text(l), rt = symbol_text(r);
+  TypeShape ls = shape_of(lt), rs = shape_of(rt);
+  uint32_t lm = matrix_size(lt), rm = matrix_size(rt);
+  bool l_number = (ls.width && ls.scalar != "bool") || lm;
+  bool r_number = (rs.width && rs.scalar != "bool") || rm;
+  if (is_comparison(name)) {
+    // == compares two values of one type, the orderings two numbers.
+    if (l == r && (name == "Equality" || (ls.width == 1 && l_number)))
+      return named(program.bool_type);
+  } else if (l == r && l_number) {
+    return left;
+  } else if (ls.width == 1 && l_number &&
+             (rs.width > 1 ? rs.scalar == ls.scalar
+                           : rm && ls.scalar == "float")) {
+    return right;
+  } else if (rs.width == 1 && r_number &&
+             (ls.width > 1 ? ls.scalar == rs.scalar
+                           : lm && rs.scalar == "float")) {
+    return left;
+  } else if (name == "Multiply" && lm && rs.scalar == "float" &&
+             rs.width == lm) {
+    return right;
+  } else if (name == "Multiply" && rm && ls.scalar == "float" &&
+             ls.width == rm) {
+    return left;
+  }
+  error(ast, id, "cannot apply '%.*s' to '%s' and '%s'",
+        static_cast<int>(name.size()), name.data(), lt.data(), rt.data());
+  return NoTerm;
+}
+
+TypeTerm TypeChecker::infer_call(const Ast &ast, NodeId id) {
+  NodeId arg_nodes[max_arguments];
+  size_t count = 0;
+  NodeId head = id;
+  while (ast[head].type == NodeType::FunctionApplication) {
+    if (count == max_arguments) {
+      error(ast, id, "too many arguments");
+      return NoTerm;
+    }
+    arg_nodes[count++] = ast.child(head, 1);
+    head = ast.child(head, 0);
+  }
+  TypeTerm args[max_arguments];
+  bool typed = true;
+  for (size_t i = 0; i < count; ++i) {
+    args[i] = infer(ast, arg_nodes[count - 1 - i]);
+    typed &= args[i] != NoTerm;
+  }
+  if (!typed)
+    return NoTerm;
+  if (ast[head].type != NodeType::Identifier) {
+    error(ast, head, "only named functions can be called");
+    return NoTerm;
+  }
+
+  Symbol name = ast[head].value;
+  std::string_view text = symbol_text(name);
+  if (is_builtin_type(text) || program.types.count(name)) {
+    if (!check_construct(ast, head, name, args, count))
+      return NoTerm;
+    TypeTerm term = named(name);
+    record(ast, id, term);
+    return term;
+  }
+
+  if (program.function_overloads.count(name))
+    return call_overload(ast, id, head, args, count);
+
+  const BuiltinFunction *builtin = find_builtin_function(text);
+  if (!builtin) {
+    error(ast, head, "unknown function '%s'", text.data());
+    return NoTerm;
+  }
+  // Try each form and undo what it bound; the first that fits is the call.
+  for (std::string_view forms = builtin->signatures; !forms.empty();) {
+    size_t end = std::min(forms.find(' '), forms.size());
+    std::string_view form = forms.substr(0, end);
+    forms.remove_prefix(std::min(end + 1, forms.size()));
+    if (form.size() != count + 1)
+      continue;
+    Checkpoint start = checkpoint();
+    TypeTerm term = call_builtin(form, args, count);
+    if (term != NoTerm) {
+      record(ast, id, term);
+      return term;
+    }
+    rollback(start);
+  }
+  std::string types;
+  for (size_t i = 0; i < count; ++i) {
+    Symbol type = resolve(args[i]);
+    types += i ? ", " : "";
+    types += type == NoSymbol ? "?" : symbol_text(type);
+  }
+  error(ast, head, "'%s' takes %s, not (%s)", text.data(),
+        describe_forms(builtin->signatures).c_str(), types.c_str());
+  return NoTerm;
+}
+
+TypeTerm TypeChecker::call_builtin(std::string_view form, const TypeTerm *args,
+                                   size_t count) {
+  // The generic type of the form, fixed by the arguments it appears in.
+  TypeTerm generic = fresh();
+  for (size_t i = 0; i < count; ++i) {
+    TypeTerm expected = NoTerm;
+    switch (form[i]) {
+    case 'T':
+    case 'N':
+    case 'M':
+      expected = generic;
+      break;
+    case 'f':
+      expected = named(program.float_type);
+      break;
+    case '3':
+      expected = named(intern("vec3"));
+      break;
+    case '4':
+      expected = named(program.vec4_type);
+      break;
+    default:
+      continue;
+    }
+    if (!unify(args[i], expected))
+      return NoTerm;
+  }
+
+  // Arguments of a still unknown type fit any form.
+  std::string_view type = symbol_text(resolve(generic));
+  TypeShape shape = shape_of(type);
+  size_t kind = form.find_first_of("TNM");
+  if (!type.empty() && kind != std::string_view::npos) {
+    bool fits = form[kind] == 'M'   ? matrix_size(type) != 0
+                : form[kind] == 'T' ? shape.scalar == "float"
+                                    : shape.width && shape.scalar != "bool";
+    if (!fits)
+      return NoTerm;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    Symbol arg = resolve(args[i]);
+    if (form[i] == 'c' && !type.empty() &&
+        !unify(args[i], named(intern(shape.scalar))))
+      return NoTerm;
+    if (form[i] == 'S' && arg != NoSymbol &&
+        symbol_text(arg).substr(0, 7) != "sampler")
+      return NoTerm;
+  }
+
+  switch (form.back()) {
+  case 'f':
+    return named(program.float_type);
+  case '3':
+    return named(intern("vec3"));
+  case '4':
+    return named(program.vec4_type);
+  default:
+    return generic;
+  }
+}
+
+bool TypeChecker::check_construct(const Ast &ast, NodeId head, Symbol type,
+                                  const TypeTerm *args, size_t count) {
+  std::string_view name = symbol_text(type);
+  if (!is_builtin_type(name)) {
+    // A struct takes a value for each field, in order.
+    const AstRef &definition = program.types.at(type);
+    uint32_t fields = (*definition.ast)[definition.id].child_count;
+    if (count != fields) {
+      error(ast, head, "'%s' has %u fields, not %zu", name.data(), fields,
+            count);
+      return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      Symbol field = program.field_type(type, static_cast<int>(i));
+      if (field == NoSymbol || unify(args[i], named(field)))
+        continue;
+      error(ast, head, "field %zu of '%s' is a '%s', not a '%s'", i + 1,
+            name.data(), symbol_text(field).data(),
+            symbol_text(resolve(args[i])).data());
+      return false;
+    }
+    return true;
+  }
+
+  uint32_t width = component_count(name);
+  if (width == 0)
+    return true;
+  // Components before the last argument, which may be used in part.
+  uint32_t total = 0, before_last = 0;
+  for (size_t i = 0; i < count; ++i) {
+    Symbol arg = resolve(args[i]);
+    if (arg == NoSymbol)
+      return true;
+    uint32_t components = component_count(symbol_text(arg));
+    if (components == 0) {
+      error(ast, head, "'%s' cannot be built from a '%s'", name.data(),
+            symbol_text(arg).data());
+      return false;
+    }
+    before_last = total;
+    total += components;
+  }
+  // One scalar fills a vector or a matrix's diagonal; one matrix converts.
+  bool columns = matrix_size(name) != 0;
+  bool fits =
+      count != 0 &&
+      ((count == 1 && total == 1) ||
+       (columns && count == 1 && matrix_size(symbol_text(resolve(args[0])))) ||
+       (before_last < width && (columns ? total == width : total >= width)));
+  if (!fits)
+    error(ast, head, "'%s' takes %u components, not %u", name.data(), width,
+          total);
+  return fits;
+}
+
+TypeTerm TypeChecker::call_overload(const Ast &ast, NodeId id, NodeId head,
+                                    const TypeTerm *args, size_t count) {
+  Symbol name = ast[head].value;
+  std::string_view text = symbol_text(name);
+  std::vector<uint32_t> candidates;
+  for (uint32_t overload : program.function_overloads.at(name)) {
+    if (scheme_of(overload).terms.size() == count + 1)
+      candidates.push_back(overload);
+  }
+
+  // Try each overload and undo what it bound; commit only to a unique fit.
+  std::vector<TypeTerm> instance;
+  std::vector<uint32_t> fits;
+  for (uint32_t overload : candidates) {
+    Checkpoint start = checkpoint();
+    instantiate(schemes[overload], instance);
+    bool fit = true;
+    for (size_t i = 0; i < count && fit; ++i)
+      fit = unify(instance[i], args[i]);
+    rollback(start);
+    if (fit)
+      fits.push_back(overload);
+  }
+  // A concrete signature is more specific than a generic one.
+  if (fits.size() > 1) {
+    std::vector<uint32_t> concrete;
+    for (uint32_t overload : fits) {
+      if (is_monomorphic(overload))
+        concrete.push_back(overload);
+    }
+    if (concrete.size() == 1)
+      fits = concrete;
+  }
+
+  if (fits.empty()) {
+    std::string types;
+    for (size_t i = 0; i < count; ++i) {
+      Symbol type = resolve(args[i]);
+      types += i ? ", " : "";
+      types += type == NoSymbol ? "?" : symbol_text(type);
+    }
+    error(ast, head, "no overload of '%s' takes these %zu arguments (%s)",
+          text.data(), count, types.c_str());
+    return NoTerm;
+  }
+  if (fits.size() > 1) {
+    // With arguments still unknown the call may be resolved by a caller
+    // that has a signature; with all of them known it is ambiguous.
+    bool known = true;
+    for (size_t i = 0; i < count; ++i)
+      known &= resolve(args[i]) != NoSymbol;
+    if (known)
+      error(ast, head, "call to '%s' matches %zu overloads", text.data(),
+            fits.size());
+    return known ? NoTerm : fresh();
+  }
+
+  uint32_t overload = fits[0];
+  instantiate(schemes[overload], instance);
+  for (size_t i = 0; i < count; ++i)
+    unify(instance[i], args[i]);
+  if (emitting && !program.is_emitted(overload))
+    error(ast, head,
+          "'%s :: %s' has no concrete type signature, so shader code "
+          "cannot call it",
+          text.data(), describe_overload(overload).c_str());
+  record(ast, id, instance.back(), static_cast<int>(overload));
+  return instance.back();
+}
+
+TypeTerm TypeChecker::infer_member(const Ast &ast, NodeId base, Symbol field,
+                                   NodeId at) {
+  TypeTerm term = infer(ast, base);
+  if (term == NoTerm)
+    return NoTerm;
+  std::string_view name = symbol_text(field);
+  Symbol type = resolve(term);
+
+  if (type == NoSymbol) {
+    // The only struct with such a field; otherwise the type stays open.
+    Symbol owner = NoSymbol;
+    size_t owners = 0;
+    for (const AstRef &ref : program.structs) {
+      Symbol candidate = (*ref.ast)[ref.id].value;
+      if (program.field_index(candidate, field) >= 0) {
+        owner = candidate;
+        owners++;
+      }
+    }
+    if (owners != 1)
+      return fresh();
+    unify(term, named(owner));
+    type = owner;
+  }
+
+  TypeShape shape = shape_of(symbol_text(type));
+  if (shape.width > 1) {
+    bool valid = !name.empty() && name.size() <= 4;
+    for (char c : name) {
+      int index = swizzle_index(c);
+      valid &= index >= 0 && static_cast<uint32_t>(index) < shape.width;
+    }
+    if (valid)
+      return named(
+          shaped_type(shape.scalar, static_cast<uint32_t>(name.size())));
+  }
+
+  int index = program.field_index(type, field);
+  if (index >= 0)
+    return named(program.field_type(type, index));
+  error(ast, at, "'%s' has no field '%.*s'", symbol_text(type).data(),
+        static_cast<int>(name.size()), name.data());
+  return NoTerm;
+}
+
+void TypeChecker::record(const Ast &ast, NodeId id, TypeTerm term,
+                         int overload) {
+  if (recording)
+    pending.push_back({&ast, id, term, overload});
+}
+
+void TypeChecker::flush(size_t begin, bool first) {
+  for (size_t i = begin; i < pending.size(); ++i) {
+    const Pending &entry = pending[i];
+    NodeTypes &table = tables[entry.ast];
+    if (table.types.size() < entry.ast->size()) {
+      table.types.resize(entry.ast->size(), NoSymbol);
+      table.calls.resize(entry.ast->size(), -1);
+    }
+    Symbol type = entry.term == NoTerm ? NoSymbol : resolve(entry.term);
+    if (type != NoSymbol && is_type_variable(type))
+      type = NoSymbol;
+    if (first) {
+      table.types[entry.id] = type;
+      table.calls[entry.id] = entry.overload;
+      continue;
+    }
+    if (table.types[entry.id] != type)
+      table.types[entry.id] = NoSymbol;
+    if (table.calls[entry.id] != entry.overload)
+      table.calls[entry.id] = -1;
+  }
+  pending.resize(begin);
+}
+
+Symbol TypeChecker::type_of(const Ast &ast, NodeId id) const {
+  auto it = tables.find(&ast);
+  if (it == tables.end() || id >= it->second.types.size())
+    return NoSymbol;
+  return it->second.types[id];
+}
+
+int TypeChecker::call_target(const Ast &ast, NodeId id) const {
+  auto it = tables.find(&ast);
+  if (it == tables.end() || id >= it->second.calls.size())
+    return -1;
+  return it->second.calls[id];
+}
+
+TypeTerm TypeChecker::named(Symbol type) {
+  auto it = named_terms.find(type);
+  if (it != named_terms.end())
+    return it->second;
+  TypeTerm term = static_cast<TypeTerm>(terms.size());
+  terms.push_back({type, term});
+  named_terms.emplace(type, term);
+  return term;
+}
+
+TypeTerm TypeChecker::fresh() {
+  TypeTerm term = static_cast<TypeTerm>(terms.size());
+  terms.push_back({NoSymbol, term});
+  return term;
+}
+
+TypeTerm TypeChecker::find(TypeTerm term) const {
+  // No path compression: bindings must stay undoable through the trail.
+  while (terms[term].parent != term)
+    term = terms[term].parent;
+  return term;
+}
+
+bool TypeChecker::unify(TypeTerm a, TypeTerm b) {
+  a = find(a);
+  b = find(b);
+  if (a == b)
+    return true;
+  if (terms[a].name != NoSymbol && terms[b].name != NoSymbol)
+    return false;
+  if (terms[a].name != NoSymbol)
+    std::swap(a, b);
+  terms[a].parent = b;
+  trail.push_back(a);
+  return true;
+}
+
+Symbol TypeChecker::resolve(TypeTerm term) const {
+  return terms[find(term)].name;
+}
+
+void TypeChecker::rollback(const Checkpoint &to) {
+  while (trail.size() > to.trail) {
+    TypeTerm term = trail.back();
+    trail.pop_back();
+    terms[term].parent = term;
+  }
+  for (size_t i = to.terms; i < terms.size(); ++i) {
+    if (terms[i].name != NoSymbol)
+      named_terms.erase(terms[i].name);
+  }
+  terms.resize(to.terms);
+}
+
+void TypeChecker::error(const Ast &ast, NodeId at, const char *format, ...) {
+  if (quiet)
+    return;
+  char message[512];
+  va_list args;
+  va_start(args, format);
+  std::vsnprintf(message, sizeof message, format, args);
+  va_end(args);
+  program.error(ast, at, "%s", message);
+}
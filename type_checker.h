@@ -0,0 +1,135 @@
+#pragma once
+#include "ast_node.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class ShaderProgram;
+
+// A type while it is being inferred: a named type, or a variable that
+// unification binds to another term.
+using TypeTerm = uint32_t;
+constexpr TypeTerm NoTerm = UINT32_MAX;
+
+// Hindley-Milner style inference over a ShaderProgram. Types are flat (a
+// GLSL type name or a variable), so unification is union-find over terms.
+// Functions without a signature get a type scheme inferred from their
+// body; lowercase names in a signature that are not types are type
+// variables, rigid inside the function and instantiated at each call.
+// Calls pick the overload whose scheme unifies with the arguments.
+//
+// Declarations checked through check_*() and analyze_stage() get a
+// resolved type per node, which later passes read with type_of().
+class TypeChecker {
+public:
+  explicit TypeChecker(ShaderProgram &program);
+
+  // Types the program's constants into `globals`.
+  void check_constants();
+  // Infers the functions without a signature, then checks every body
+  // against its signature.
+  void check_overloads();
+  // Types an entry point's body with the stage inputs in scope.
+  Symbol check_stage(const Ast &ast, NodeId body);
+  // Infers `id` without reporting errors, recording types or keeping any
+  // binding it makes. Variables in the program's `locals` are in scope.
+  Symbol infer_quietly(const Ast &ast, NodeId id);
+
+  // "float -> vec3 -> vec3"; type variables print as a, b, ...
+  std::string describe_overload(uint32_t overload) const;
+  // False for an overload whose type still has type variables, or that is
+  // not inferred yet.
+  bool is_monomorphic(uint32_t overload) const;
+
+  // Resolved type of a checked node; NoSymbol if it has none or it differs
+  // between the overloads of one function.
+  Symbol type_of(const Ast &ast, NodeId id) const;
+  // Overload a checked call (its outermost FunctionApplication) resolved
+  // to, or -1.
+  int call_target(const Ast &ast, NodeId id) const;
+
+private:
+  struct Term {
+    Symbol name = NoSymbol;
+    TypeTerm parent = 0;
+  };
+  enum class SchemeState : uint8_t { Pending, InProgress, Done };
+  // Parameter types then the return type.
+  struct Scheme {
+    std::vector<TypeTerm> terms;
+    SchemeState state = SchemeState::Pending;
+  };
+  struct Checkpoint {
+    size_t terms;
+    size_t trail;
+  };
+  struct Pending {
+    const Ast *ast;
+    NodeId id;
+    TypeTerm term;
+    int32_t overload;
+  };
+  struct NodeTypes {
+    std::vector<Symbol> types;
+    std::vector<int32_t> calls;
+  };
+
+  TypeTerm infer(const Ast &ast, NodeId id);
+  TypeTerm infer_binary(const Ast &ast, NodeId id);
+  TypeTerm infer_call(const Ast &ast, NodeId id);
+  TypeTerm infer_member(const Ast &ast, NodeId base, Symbol field, NodeId at);
+  TypeTerm call_overload(const Ast &ast, NodeId id, NodeId head,
+                         const TypeTerm *args, size_t count);
+  // Result of a builtin called with `args` in the shape of `form` (see
+  // BuiltinFunction::signatures), or NoTerm if they do not fit it.
+  TypeTerm call_builtin(std::string_view form, const TypeTerm *args,
+                        size_t count);
+  // Checks the arguments of a vector, matrix, scalar or struct constructor.
+  bool check_construct(const Ast &ast, NodeId head, Symbol type,
+                       const TypeTerm *args, size_t count);
+  // Brings every let binding under `id` into scope, in the order a backend
+  // hoists them.
+  void bind_lets(const Ast &ast, NodeId id);
+  TypeTerm lookup(Symbol name);
+  void record(const Ast &ast, NodeId id, TypeTerm term, int overload = -1);
+
+  void check_overload(uint32_t overload, bool first);
+  const Scheme &scheme_of(uint32_t overload);
+  // Copy of a scheme's terms with its variables renamed apart; the terms
+  // themselves while the scheme is still being inferred.
+  void instantiate(const Scheme &scheme, std::vector<TypeTerm> &into);
+  bool is_type_variable(Symbol name) const;
+
+  TypeTerm named(Symbol type);
+  TypeTerm fresh();
+  TypeTerm find(TypeTerm term) const;
+  bool unify(TypeTerm a, TypeTerm b);
+  // The named type `term` stands for, or NoSymbol while it is a variable.
+  Symbol resolve(TypeTerm term) const;
+  Checkpoint checkpoint() const { return {terms.size(), trail.size()}; }
+  void rollback(const Checkpoint &to);
+  // Stores the types recorded since `begin`; with `first` false, a node
+  // keeps its type only if it matches what an earlier overload gave it.
+  void flush(size_t begin, bool first);
+
+#if defined(__GNUC__) || defined(__clang__)
+  __attribute__((format(printf, 4, 5)))
+#endif
+  void error(const Ast &ast, NodeId at, const char *format, ...);
+
+  ShaderProgram &program;
+  std::vector<Term> terms;
+  std::vector<TypeTerm> trail;
+  std::unordered_map<Symbol, TypeTerm> named_terms;
+  std::vector<Scheme> schemes;
+  std::vector<std::pair<Symbol, TypeTerm>> scope;
+  std::vector<Pending> pending;
+  bool recording = false;
+  bool quiet = false;
+  // Set while checking code a backend writes out, which cannot call
+  // overloads that are not emitted.
+  bool emitting = false;
+  std::unordered_map<const Ast *, NodeTypes> tables;
+};
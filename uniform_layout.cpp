@@ -0,0 +1,163 @@
+#include "uniform_layout.h"
+#include <algorithm>
+#include <numeric>
+
+namespace {
+
+struct Shape {
+  uint32_t size = 0;
+  uint32_t align = 4;
+  uint32_t matrix_stride = 0;
+};
+
+uint32_t round_up(uint32_t value, uint32_t align) {
+  return (value + align - 1) / align * align;
+}
+
+Shape shape_in_block(const ShaderProgram &program, Symbol type,
+                     LayoutRules rules) {
+  std::string_view text = symbol_text(type);
+  if (uint32_t columns = matrix_size(text)) {
+    // Columns are vectors as tall as the matrix is wide.
+    uint32_t stride = columns == 2 ? 8 : 16;
+    if (rules == LayoutRules::Std140)
+      stride = 16;
+    return {stride * columns, stride, stride};
+  }
+  switch (shape_of(text).width) {
+  case 1:
+    return {4, 4, 0};
+  case 2:
+    return {8, 8, 0};
+  case 3:
+    return {12, 16, 0};
+  case 4:
+    return {16, 16, 0};
+  }
+  if (program.types.count(type)) {
+    BlockLayout inner =
+        layout_block(program, struct_fields(program, type), rules, false);
+    return {inner.size, inner.align, 0};
+  }
+  return {};
+}
+
+BlockLayout place(const std::vector<ShaderVariable> &members,
+                  const std::vector<Shape> &shapes,
+                  const std::vector<size_t> &order, LayoutRules rules) {
+  BlockLayout layout;
+  layout.align = rules == LayoutRules::Std140 ? 16 : 4;
+  uint32_t offset = 0;
+  for (size_t i : order) {
+    offset = round_up(offset, shapes[i].align);
+    layout.members.push_back({members[i].name, members[i].type, offset,
+                              shapes[i].size, shapes[i].matrix_stride});
+    offset += shapes[i].size;
+    layout.align = std::max(layout.align, shapes[i].align);
+  }
+  layout.size = round_up(offset, layout.align);
+  return layout;
+}
+
+} // namespace
+
+std::string_view rules_name(LayoutRules rules) {
+  return rules == LayoutRules::Std140 ? "std140" : "std430";
+}
+
+bool parse_rules(std::string_view text, LayoutRules &rules) {
+  if (text == "std140")
+    rules = LayoutRules::Std140;
+  else if (text == "std430")
+    rules = LayoutRules::Std430;
+  else
+    return false;
+  return true;
+}
+
+int BlockLayout::find(Symbol name) const {
+  for (size_t i = 0; i < members.size(); ++i) {
+    if (members[i].name == name)
+      return static_cast<int>(i);
+  }
+  return -1;
+}
+
+BlockLayout layout_block(const ShaderProgram &program,
+                         const std::vector<ShaderVariable> &members,
+                         LayoutRules rules, bool reorder) {
+  std::vector<Shape> shapes;
+  for (const ShaderVariable &member : members)
+    shapes.push_back(shape_in_block(program, member.type, rules));
+  std::vector<size_t> declared(members.size());
+  std::iota(declared.begin(), declared.end(), 0);
+  BlockLayout layout = place(members, shapes, declared, rules);
+  if (!reorder)
+    return layout;
+
+  // Greedily take the member that needs the least padding where the block
+  // ends so far; among those, the most aligned and then the largest, so
+  // the small ones are left to fill later holes.
+  std::vector<size_t> left = declared;
+  std::vector<size_t> order;
+  uint32_t offset = 0;
+  while (!left.empty()) {
+    size_t best = 0;
+    uint32_t best_padding = UINT32_MAX;
+    for (size_t i = 0; i < left.size(); ++i) {
+      const Shape &shape = shapes[left[i]];
+      const Shape &chosen = shapes[left[best]];
+      uint32_t padding = round_up(offset, shape.align) - offset;
+      if (padding < best_padding ||
+          (padding == best_padding &&
+           (shape.align > chosen.align ||
+            (shape.align == chosen.align && shape.size > chosen.size)))) {
+        best = i;
+        best_padding = padding;
+      }
+    }
+    offset = round_up(offset, shapes[left[best]].align) +
+             shapes[left[best]].size;
+    order.push_back(left[best]);
+    left.erase(left.begin() + best);
+  }
+  BlockLayout packed = place(members, shapes, order, rules);
+  return packed.size < layout.size ? packed : layout;
+}
+
+std::vector<ShaderVariable> struct_fields(const ShaderProgram &program,
+                                          Symbol type) {
+  std::vector<ShaderVariable> fields;
+  const AstRef &ref = program.types.at(type);
+  const Ast &ast = *ref.ast;
+  for (NodeId field : ast.children(ref.id)) {
+    NodeId field_type = ast.child(field, ast[field].child_count - 1);
+    fields.push_back({ast[field].value, ast[field_type].value});
+  }
+  return fields;
+}
+
+std::string reflection_header(std::string_view name,
+                              const BlockLayout &layout, LayoutRules rules) {
+  std::string out = "#pragma once\n#include <cstdint>\n\n";
+  out += "// Uniform block of " + std::string(name) + ", laid out by " +
+         std::string(rules_name(rules)) + " rules.\n";
+  out += "namespace " + std::string(name) + "_uniforms {\n\n";
+  out += "constexpr uint32_t size = " + std::to_string(layout.size) + ";\n";
+  for (const MemberLayout &member : layout.members)
+    out += "constexpr uint32_t " + std::string(symbol_text(member.name)) +
+           "_offset = " + std::to_string(member.offset) + ";\n";
+  if (layout.members.empty())
+    return out + "\n} // namespace " + std::string(name) + "_uniforms\n";
+
+  out += "\nstruct Member {\n  const char *name;\n  const char *type;\n"
+         "  uint32_t offset;\n  uint32_t size;\n};\n\n";
+  out += "constexpr Member members[] = {\n";
+  for (const MemberLayout &member : layout.members)
+    out += "    {\"" + std::string(symbol_text(member.name)) + "\", \"" +
+           std::string(symbol_text(member.type)) + "\", " +
+           std::to_string(member.offset) + ", " +
+           std::to_string(member.size) + "},\n";
+  out += "};\n\n} // namespace " + std::string(name) + "_uniforms\n";
+  return out;
+}
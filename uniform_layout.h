@@ -0,0 +1,52 @@
+#pragma once
+#include "shader_program.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Rules a uniform block's members are laid out by. std430 drops std140's
+// rounding of struct and matrix column alignment up to a vec4.
+enum class LayoutRules : uint8_t { Std140, Std430 };
+
+std::string_view rules_name(LayoutRules rules);
+// Parses "std140" or "std430".
+bool parse_rules(std::string_view text, LayoutRules &rules);
+
+struct MemberLayout {
+  Symbol name = NoSymbol;
+  Symbol type = NoSymbol;
+  uint32_t offset = 0;
+  uint32_t size = 0;
+  // Bytes between the columns of a matrix, 0 for other types.
+  uint32_t matrix_stride = 0;
+};
+
+struct BlockLayout {
+  // In offset order, which differs from declaration order if the members
+  // were reordered.
+  std::vector<MemberLayout> members;
+  uint32_t size = 0;
+  uint32_t align = 0;
+
+  // Index in `members` of the member called `name`, -1 if there is none.
+  int find(Symbol name) const;
+};
+
+// Offsets of `members`, scalars, vectors, matrices and structs of them, in
+// a block laid out by `rules`; the size is rounded up to the block's
+// alignment. With `reorder`, members are placed so that smaller ones fill
+// the holes alignment leaves, e.g. a float in the tail of a vec3, unless
+// declaration order is already as small.
+BlockLayout layout_block(const ShaderProgram &program,
+                         const std::vector<ShaderVariable> &members,
+                         LayoutRules rules, bool reorder);
+
+// The fields of struct `type`, in declaration order.
+std::vector<ShaderVariable> struct_fields(const ShaderProgram &program,
+                                          Symbol type);
+
+// A C++ header with the offset of every member of `layout`, for the host
+// code that fills the block. `name` prefixes the declarations.
+std::string reflection_header(std::string_view name,
+                              const BlockLayout &layout, LayoutRules rules);
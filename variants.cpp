@@ -0,0 +1,55 @@
+#include "variants.h"
+
+std::vector<VariantFlag> variant_flags(const Ast &ast, NodeId root) {
+  std::vector<VariantFlag> flags;
+  for (NodeId id : ast.children(root)) {
+    if (ast[id].type != NodeType::Variant)
+      continue;
+    VariantFlag flag{ast[id].value, id, {}};
+    for (NodeId value : ast.children(id))
+      flag.values.push_back(ast[value].value);
+    if (!flag.values.empty())
+      flags.push_back(std::move(flag));
+  }
+  return flags;
+}
+
+std::vector<Variant> variant_matrix(const std::vector<VariantFlag> &flags) {
+  std::vector<Variant> matrix{Variant(flags.size(), 0)};
+  for (size_t i = flags.size(); i-- > 0;) {
+    std::vector<Variant> grown;
+    for (uint32_t value = 0; value < flags[i].values.size(); ++value) {
+      for (Variant variant : matrix) {
+        variant[i] = value;
+        grown.push_back(std::move(variant));
+      }
+    }
+    matrix = std::move(grown);
+  }
+  return matrix;
+}
+
+std::string variant_name(const std::vector<VariantFlag> &flags,
+                         const Variant &variant) {
+  if (flags.empty())
+    return "default";
+  std::string name;
+  for (size_t i = 0; i < flags.size(); ++i) {
+    if (i)
+      name += ' ';
+    name += std::string(symbol_text(flags[i].name)) + '=' +
+            std::string(symbol_text(flags[i].values[variant[i]]));
+  }
+  return name;
+}
+
+void specialize(Ast &ast, const std::vector<VariantFlag> &flags,
+                const Variant &variant) {
+  for (size_t i = 0; i < flags.size(); ++i) {
+    Symbol value = flags[i].values[variant.empty() ? 0 : variant[i]];
+    ast.set_location(ast.offset_of(flags[i].declaration));
+    NodeId literal = ast.add(NodeType::NumberLiteral, value);
+    ast.set_children(flags[i].declaration, &literal, 1);
+    ast[flags[i].declaration].type = NodeType::Let;
+  }
+}
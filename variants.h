@@ -0,0 +1,35 @@
+#pragma once
+#include "ast_node.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A compile-time flag of the main file, `@variant shadows = [0, 1, 2]`. It
+// is a constant that takes each listed value in turn when the variant
+// matrix is compiled, and its first value otherwise.
+struct VariantFlag {
+  Symbol name = NoSymbol;
+  // The Variant node, or the Let it became.
+  NodeId declaration = NoNode;
+  // Number literal texts.
+  std::vector<Symbol> values;
+};
+
+// Index into each flag's `values`, one per flag.
+using Variant = std::vector<uint32_t>;
+
+// The flags declared at the top level of `root`, in declaration order.
+std::vector<VariantFlag> variant_flags(const Ast &ast, NodeId root);
+
+// Every combination of flag values, the last flag varying fastest.
+std::vector<Variant> variant_matrix(const std::vector<VariantFlag> &flags);
+
+// "shadows=2 skinning=1", or "default" for a file without flags.
+std::string variant_name(const std::vector<VariantFlag> &flags,
+                         const Variant &variant);
+
+// Makes every flag a constant of the value `variant` picks for it, the
+// first one where `variant` is empty. Works on the parsed tree as well as
+// on a copy of an already specialised one.
+void specialize(Ast &ast, const std::vector<VariantFlag> &flags,
+                const Variant &variant);
@@ -0,0 +1,91 @@
+#include "varying_layout.h"
+#include "keywords.h"
+#include "uniform_layout.h"
+#include <algorithm>
+
+namespace {
+
+bool is_struct(const ShaderProgram &program, Symbol type) {
+  return program.types.count(type) &&
+         !is_builtin_type(symbol_text(type));
+}
+
+// Packs the members of struct varying `slots`, if they are all float
+// scalars or vectors and packing saves a location.
+void pack(const ShaderProgram &program, VaryingSlots &slots) {
+  std::vector<VaryingLeaf> leaves;
+  std::vector<ShaderVariable> fields = struct_fields(program, slots.type);
+  for (size_t i = 0; i < fields.size(); ++i) {
+    TypeShape shape = shape_of(symbol_text(fields[i].type));
+    if (shape.scalar != "float" || shape.width == 0)
+      return;
+    leaves.push_back(
+        {static_cast<int>(i), fields[i].type, shape.width, 0, 0});
+  }
+
+  std::vector<VaryingLeaf *> order;
+  for (VaryingLeaf &leaf : leaves)
+    order.push_back(&leaf);
+  std::stable_sort(order.begin(), order.end(),
+                   [](const VaryingLeaf *a, const VaryingLeaf *b) {
+                     return a->width > b->width;
+                   });
+  std::vector<uint32_t> widths;
+  for (VaryingLeaf *leaf : order) {
+    size_t slot = 0;
+    while (slot < widths.size() && widths[slot] + leaf->width > 4)
+      ++slot;
+    if (slot == widths.size())
+      widths.push_back(0);
+    leaf->slot = static_cast<uint32_t>(slot);
+    leaf->component = widths[slot];
+    widths[slot] += leaf->width;
+  }
+  if (widths.size() >= slots.count)
+    return;
+  slots.packed = true;
+  slots.count = static_cast<uint32_t>(widths.size());
+  slots.leaves = std::move(leaves);
+  slots.widths = std::move(widths);
+}
+
+} // namespace
+
+const VaryingSlots *VaryingLayout::find(Symbol name) const {
+  for (const VaryingSlots &slots : varyings) {
+    if (slots.name == name)
+      return &slots;
+  }
+  return nullptr;
+}
+
+VaryingLayout link_varyings(const ShaderProgram &program, bool pack_members) {
+  VaryingLayout layout;
+  for (const ShaderVariable &varying : program.varyings) {
+    VaryingSlots slots;
+    slots.name = varying.name;
+    slots.type = varying.type;
+    slots.location = layout.locations;
+    slots.count = location_count(program, varying.type);
+    if (pack_members && is_struct(program, varying.type))
+      pack(program, slots);
+    layout.locations += slots.count;
+    layout.varyings.push_back(std::move(slots));
+  }
+  return layout;
+}
+
+uint32_t location_count(const ShaderProgram &program, Symbol type) {
+  if (uint32_t columns = matrix_size(symbol_text(type)))
+    return columns;
+  if (!is_struct(program, type))
+    return 1;
+  uint32_t count = 0;
+  for (const ShaderVariable &field : struct_fields(program, type))
+    count += location_count(program, field.type);
+  return count;
+}
+
+std::string packed_name(uint32_t location) {
+  return "hgl_packed" + std::to_string(location);
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "shader_program.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Part of a packed varying: the whole varying, or one member of a struct
+// varying, placed in components [component, component + width) of a slot.
+struct VaryingLeaf {
+  // Member index, -1 for the varying as a whole.
+  int member = -1;
+  Symbol type = NoSymbol;
+  uint32_t width = 0;
+  // Relative to the varying's first location.
+  uint32_t slot = 0;
+  uint32_t component = 0;
+};
+
+// The locations one varying occupies between the stages.
+struct VaryingSlots {
+  Symbol name = NoSymbol;
+  Symbol type = NoSymbol;
+  uint32_t location = 0;
+  uint32_t count = 0;
+  // Packed varyings travel as `count` float vectors, one per location,
+  // named by packed_name(); `widths` gives their sizes.
+  bool packed = false;
+  std::vector<VaryingLeaf> leaves;
+  std::vector<uint32_t> widths;
+};
+
+struct VaryingLayout {
+  // In the order of ShaderProgram's `varyings`.
+  std::vector<VaryingSlots> varyings;
+  // Locations used by all varyings; other fragment inputs come after.
+  uint32_t locations = 0;
+
+  const VaryingSlots *find(Symbol name) const;
+};
+
+// Assigns every varying its locations. A struct varying takes a location
+// per member, and more for a matrix. With `pack`, the float and vector
+// members of a struct varying are instead packed first-fit, widest first,
+// into as few vec4 slots as hold them (a vec3 and a float share one), when
+// that saves a location.
+VaryingLayout link_varyings(const ShaderProgram &program, bool pack);
+
+// Locations a value of `type` takes as a stage input or output.
+uint32_t location_count(const ShaderProgram &program, Symbol type);
+
+// Name of the packed vector at `location`.
+std::string packed_name(uint32_t location);
@@ -0,0 +1,211 @@
+#include "vertex_layout.h"
+#include "keywords.h"
+
+namespace {
+
+struct FormatInfo {
+  AttributeFormat format;
+  std::string_view name;
+  uint32_t bits;
+  // Scalar type of the stored components in C++ and in a VkFormat name.
+  std::string_view c_type;
+  std::string_view numeric;
+};
+
+constexpr FormatInfo formats[] = {
+    {AttributeFormat::Float, "float", 32, "float", "SFLOAT"},
+    {AttributeFormat::Half, "half", 16, "uint16_t", "SFLOAT"},
+    {AttributeFormat::Snorm16, "snorm16", 16, "int16_t", "SNORM"},
+    {AttributeFormat::Unorm16, "unorm16", 16, "uint16_t", "UNORM"},
+    {AttributeFormat::Snorm8, "snorm8", 8, "int8_t", "SNORM"},
+    {AttributeFormat::Unorm8, "unorm8", 8, "uint8_t", "UNORM"},
+    {AttributeFormat::Octahedral, "octahedral", 16, "int16_t", "SNORM"},
+};
+
+const FormatInfo &info(AttributeFormat format) {
+  return formats[static_cast<size_t>(format)];
+}
+
+// Matrices are float columns.
+std::string_view scalar_of(const AttributeLayout &attribute) {
+  std::string_view type = symbol_text(attribute.type);
+  return matrix_size(type) ? "float" : shape_of(type).scalar;
+}
+
+// Locations an attribute takes, one per matrix column.
+uint32_t column_count(const AttributeLayout &attribute) {
+  uint32_t columns = matrix_size(symbol_text(attribute.type));
+  return columns ? columns : 1;
+}
+
+// Integer attributes keep their own 32-bit format.
+std::string_view c_type(const AttributeLayout &attribute) {
+  std::string_view scalar = scalar_of(attribute);
+  if (attribute.format == AttributeFormat::Float && scalar == "int")
+    return "int32_t";
+  if (attribute.format == AttributeFormat::Float && scalar != "float")
+    return "uint32_t";
+  return info(attribute.format).c_type;
+}
+
+// Format of one location of the attribute, a column for a matrix.
+std::string vk_format(const AttributeLayout &attribute) {
+  std::string_view scalar = scalar_of(attribute);
+  std::string_view numeric = info(attribute.format).numeric;
+  if (attribute.format == AttributeFormat::Float && scalar == "int")
+    numeric = "SINT";
+  else if (attribute.format == AttributeFormat::Float && scalar != "float")
+    numeric = "UINT";
+  std::string bits = std::to_string(info(attribute.format).bits);
+  std::string out;
+  for (uint32_t i = 0; i < attribute.components / column_count(attribute);
+       ++i)
+    out += std::string(1, "RGBA"[i % 4]) + bits;
+  return out + "_" + std::string(numeric);
+}
+
+} // namespace
+
+std::string_view format_name(AttributeFormat format) {
+  return info(format).name;
+}
+
+bool parse_format(std::string_view text, AttributeFormat &format) {
+  for (const FormatInfo &candidate : formats) {
+    if (candidate.name == text) {
+      format = candidate.format;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool format_fits(AttributeFormat format, std::string_view type) {
+  if (format == AttributeFormat::Float)
+    return true;
+  if (format == AttributeFormat::Octahedral)
+    return type == "vec3";
+  TypeShape shape = shape_of(type);
+  return shape.scalar == "float" && shape.width != 0;
+}
+
+const AttributeLayout *VertexLayout::find(Symbol name) const {
+  for (const AttributeLayout &attribute : attributes) {
+    if (attribute.name == name)
+      return &attribute;
+  }
+  return nullptr;
+}
+
+VertexLayout layout_vertex(const ShaderProgram &program) {
+  VertexLayout layout;
+  uint32_t location = 0;
+  for (size_t i = 0; i < program.vertex_inputs.size(); ++i) {
+    const ShaderVariable &input = program.vertex_inputs[i];
+    AttributeLayout attribute;
+    attribute.name = input.name;
+    attribute.type = input.type;
+    Symbol format = program.vertex_formats[i];
+    if (format != NoSymbol)
+      parse_format(symbol_text(format), attribute.format);
+    attribute.location = location;
+
+    std::string_view type = symbol_text(input.type);
+    uint32_t columns = matrix_size(type);
+    uint32_t width = columns ? columns * columns : shape_of(type).width;
+    location += columns ? columns : 1;
+    switch (info(attribute.format).bits) {
+    case 32:
+      attribute.components = width;
+      break;
+    case 16:
+      attribute.components = width % 2 ? width + 1 : width;
+      break;
+    default:
+      attribute.components = 4;
+      break;
+    }
+    if (attribute.format == AttributeFormat::Octahedral)
+      attribute.components = 2;
+    attribute.size = attribute.components * info(attribute.format).bits / 8;
+    attribute.offset = layout.stride;
+    layout.stride += attribute.size;
+    layout.attributes.push_back(attribute);
+  }
+  return layout;
+}
+
+Symbol input_type(const AttributeLayout &layout) {
+  if (layout.format == AttributeFormat::Octahedral)
+    return intern("vec2");
+  return layout.type;
+}
+
+std::string vertex_header(std::string_view name, const VertexLayout &layout) {
+  bool octahedral = false;
+  for (const AttributeLayout &attribute : layout.attributes)
+    octahedral |= attribute.format == AttributeFormat::Octahedral;
+
+  std::string out = "#pragma once\n";
+  if (octahedral)
+    out += "#include <cmath>\n";
+  out += "#include <cstdint>\n\n";
+  out += "// Interleaved vertex of " + std::string(name) +
+         ": one buffer, attributes in location order.\n";
+  out += "namespace " + std::string(name) + "_vertex {\n\n";
+  out += "constexpr uint32_t stride = " + std::to_string(layout.stride) +
+         ";\n";
+  for (const AttributeLayout &attribute : layout.attributes)
+    out += "constexpr uint32_t " +
+           std::string(symbol_text(attribute.name)) + "_offset = " +
+           std::to_string(attribute.offset) + ";\n";
+  if (layout.attributes.empty())
+    return out + "\n} // namespace " + std::string(name) + "_vertex\n";
+
+  out += "\nstruct Attribute {\n  const char *name;\n  uint32_t location;\n"
+         "  uint32_t offset;\n  // VkFormat without its VK_FORMAT_ prefix.\n"
+         "  const char *format;\n};\n\n";
+  // A matrix is bound as one attribute per column.
+  out += "constexpr Attribute attributes[] = {\n";
+  for (const AttributeLayout &attribute : layout.attributes) {
+    uint32_t columns = column_count(attribute);
+    for (uint32_t c = 0; c < columns; ++c)
+      out += "    {\"" + std::string(symbol_text(attribute.name)) + "\", " +
+             std::to_string(attribute.location + c) + ", " +
+             std::to_string(attribute.offset + attribute.size / columns * c) +
+             ", \"" + vk_format(attribute) + "\"},\n";
+  }
+  out += "};\n\n";
+
+  out += "struct Vertex {\n";
+  for (const AttributeLayout &attribute : layout.attributes) {
+    out += "  " + std::string(c_type(attribute)) + ' ' +
+           std::string(symbol_text(attribute.name));
+    if (attribute.components > 1)
+      out += '[' + std::to_string(attribute.components) + ']';
+    out += ';';
+    if (attribute.format != AttributeFormat::Float)
+      out += " // " + std::string(format_name(attribute.format));
+    out += '\n';
+  }
+  out += "};\nstatic_assert(sizeof(Vertex) == stride, \"Vertex does not "
+         "match the stride\");\n";
+
+  if (octahedral)
+    out += "\n// The encoding the vertex stage decodes; `n` is unit length.\n"
+           "inline void encode_octahedral(const float n[3], int16_t out[2]) "
+           "{\n"
+           "  float sum = std::fabs(n[0]) + std::fabs(n[1]) + "
+           "std::fabs(n[2]);\n"
+           "  float x = n[0] / sum, y = n[1] / sum;\n"
+           "  if (n[2] < 0) {\n"
+           "    float folded = (1 - std::fabs(y)) * (x >= 0 ? 1 : -1);\n"
+           "    y = (1 - std::fabs(x)) * (y >= 0 ? 1 : -1);\n"
+           "    x = folded;\n"
+           "  }\n"
+           "  out[0] = static_cast<int16_t>(std::lround(x * 32767));\n"
+           "  out[1] = static_cast<int16_t>(std::lround(y * 32767));\n"
+           "}\n";
+  out += "\n} // namespace " + std::string(name) + "_vertex\n";
+  return out;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "shader_program.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Format a vertex attribute is stored in. The vertex fetch unit converts
+// all but Octahedral to the attribute's own type; an octahedral normal is
+// two snorm16 components the vertex stage decodes to a vec3.
+enum class AttributeFormat : uint8_t {
+  Float,
+  Half,
+  Snorm16,
+  Unorm16,
+  Snorm8,
+  Unorm8,
+  Octahedral
+};
+
+std::string_view format_name(AttributeFormat format);
+// Parses a format annotation without its '@', e.g. "half".
+bool parse_format(std::string_view text, AttributeFormat &format);
+// Whether an attribute of `type` can be stored in `format`: the smaller
+// formats hold float scalars and vectors, octahedral only a vec3.
+bool format_fits(AttributeFormat format, std::string_view type);
+
+struct AttributeLayout {
+  Symbol name = NoSymbol;
+  Symbol type = NoSymbol;
+  AttributeFormat format = AttributeFormat::Float;
+  uint32_t location = 0;
+  uint32_t offset = 0;
+  uint32_t size = 0;
+  // Stored components; 8- and 16-bit vectors are padded to a 4-byte size.
+  uint32_t components = 0;
+};
+
+// One interleaved vertex buffer holding every vertex input.
+struct VertexLayout {
+  // In location order.
+  std::vector<AttributeLayout> attributes;
+  uint32_t stride = 0;
+
+  // The attribute called `name`, nullptr if there is none.
+  const AttributeLayout *find(Symbol name) const;
+};
+
+// Places the vertex inputs of `program` one after another, in declaration
+// order, each in its annotated format.
+VertexLayout layout_vertex(const ShaderProgram &program);
+
+// Type of the stage input an attribute of `layout` is declared with.
+Symbol input_type(const AttributeLayout &layout);
+
+// A C++ header with the stride, offsets and Vulkan formats of `layout` and
+// a struct of the same size, for the mesh baker that writes the buffer.
+// `name` prefixes the declarations.
+std::string vertex_header(std::string_view name, const VertexLayout &layout);